@@ -0,0 +1,338 @@
+#include "flow_scheduler.h"
+#include "packet_pool.h"
+#include <cmath>
+
+namespace {
+constexpr uint8_t kProtoTcp = 6;
+constexpr uint8_t kProtoUdp = 17;
+constexpr uint8_t kTcpFlagAck = 0x10;
+
+uint32_t load32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+uint16_t load16(const uint8_t *p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+bool isFragment(const uint8_t *packet) {
+  return ((packet[6] & 0x3F) | packet[7]) != 0; // MF or offset
+}
+
+// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m').
+uint16_t adjustChecksum(uint16_t checksum, uint16_t oldWord, uint16_t newWord) {
+  uint32_t sum = static_cast<uint16_t>(~checksum);
+  sum += static_cast<uint16_t>(~oldWord);
+  sum += newWord;
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+} // namespace
+
+uint32_t FlowScheduler::flowHash(const uint8_t *packet, size_t length) {
+  if (length < 20 || ((packet[0] >> 4) & 0x0F) != 4) {
+    return 0;
+  }
+  uint32_t hash = 2166136261u;
+  auto mix = [&hash](const uint8_t *bytes, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+  };
+  const uint8_t protocol = packet[9];
+  mix(packet + 12, 8);
+  mix(&protocol, 1);
+  const size_t headerLength = static_cast<size_t>(packet[0] & 0x0F) * 4;
+  if ((protocol == kProtoTcp || protocol == kProtoUdp) &&
+      !isFragment(packet) && length >= headerLength + 4) {
+    mix(packet + headerLength, 4);
+  }
+  return hash;
+}
+
+bool FlowScheduler::isPriority(const uint8_t *ip, size_t length) {
+  if (length < 20 || (ip[0] >> 4) != 4) {
+    return false;
+  }
+  // EF, CS5-CS7 and AF4x: voice, video and network control.
+  const uint8_t dscp = ip[1] >> 2;
+  if (dscp >= 40 || (dscp >= 34 && dscp <= 38 && !(dscp & 1))) {
+    return true;
+  }
+  // A pure ACK: no payload and no flag beyond ACK (ECE/CWR allowed).
+  const size_t headerLength = static_cast<size_t>(ip[0] & 0x0F) * 4;
+  if (ip[9] != kProtoTcp || isFragment(ip) || length < headerLength + 20) {
+    return false;
+  }
+  const uint8_t *tcp = ip + headerLength;
+  const size_t tcpHeaderLength = static_cast<size_t>(tcp[12] >> 4) * 4;
+  return (tcp[13] & 0x3F) == kTcpFlagAck &&
+         load16(ip + 2) == headerLength + tcpHeaderLength;
+}
+
+FlowScheduler::Flow &FlowScheduler::flowFor(const uint8_t *ip, size_t length,
+                                            uint32_t &bucket) {
+  bucket = flowHash(ip, length) % kFlowBuckets;
+  Flow &flow = flows_[bucket];
+  if (length < 20) {
+    return flow;
+  }
+  // Buckets are shared on collision; the stats follow the latest tuple.
+  const uint32_t sourceIP = load32(ip + 12);
+  const uint32_t destIP = load32(ip + 16);
+  const uint8_t protocol = ip[9];
+  uint16_t sourcePort = 0;
+  uint16_t destPort = 0;
+  const size_t headerLength = static_cast<size_t>(ip[0] & 0x0F) * 4;
+  if ((protocol == kProtoTcp || protocol == kProtoUdp) && !isFragment(ip) &&
+      length >= headerLength + 4) {
+    sourcePort = load16(ip + headerLength);
+    destPort = load16(ip + headerLength + 2);
+  }
+  FlowStats &stats = flow.stats;
+  if (stats.sourceIP != sourceIP || stats.destIP != destIP ||
+      stats.protocol != protocol || stats.sourcePort != sourcePort ||
+      stats.destPort != destPort) {
+    stats = FlowStats{};
+    stats.sourceIP = sourceIP;
+    stats.destIP = destIP;
+    stats.protocol = protocol;
+    stats.sourcePort = sourcePort;
+    stats.destPort = destPort;
+  }
+  return flow;
+}
+
+void FlowScheduler::setDelayTarget(Clock::duration target,
+                                   Clock::duration interval) {
+  target_ = target;
+  interval_ = interval;
+}
+
+void FlowScheduler::enqueue(const Packet &packet) {
+  const uint8_t *ip = packet.ip;
+  uint32_t bucket = 0;
+  Flow &flow = flowFor(ip, packet.ipLength, bucket);
+  flow.stats.packets++;
+  flow.stats.bytes += packet.ipLength;
+
+  if (isPriority(ip, packet.ipLength)) {
+    if (priority_.size() >= kMaxPriorityPackets) {
+      flow.stats.drops++;
+      drops_++;
+      release(packet);
+      return;
+    }
+    flow.stats.priorityPackets++;
+    priority_.push_back({packet, bucket});
+    priority_.back().packet.priority = true;
+  } else {
+    flow.packets.push_back(packet);
+    flow.backlogBytes += packet.ipLength;
+    if (!flow.listed) {
+      flow.listed = true;
+      flow.deficit = kQuantum;
+      newFlows_.push_back(bucket);
+    }
+  }
+  backlogPackets_++;
+  backlogBytes_ += packet.ipLength;
+  if (backlogPackets_ > kMaxPackets) {
+    dropFromLongestFlow();
+  }
+}
+
+bool FlowScheduler::dequeue(Packet &out, Clock::time_point now,
+                            Clock::duration pathDelay) {
+  const bool flowsWaiting = !newFlows_.empty() || !oldFlows_.empty();
+  if (!priority_.empty() && (priorityServed_ < kPriorityBurst || !flowsWaiting)) {
+    out = priority_.front().packet;
+    priority_.pop_front();
+    priorityServed_++;
+    backlogPackets_--;
+    backlogBytes_ -= out.ipLength;
+    return true;
+  }
+  priorityServed_ = 0;
+
+  for (;;) {
+    const bool fromNew = !newFlows_.empty();
+    std::deque<uint32_t> &list = fromNew ? newFlows_ : oldFlows_;
+    if (list.empty()) {
+      return false;
+    }
+    const uint32_t bucket = list.front();
+    Flow &flow = flows_[bucket];
+    if (flow.deficit <= 0) {
+      flow.deficit += kQuantum;
+      list.pop_front();
+      oldFlows_.push_back(bucket);
+      continue;
+    }
+    bool found = false;
+    while (!found && pop(flow, out)) {
+      if (!codelShouldShed(flow, now - out.enqueued + pathDelay, now) ||
+          markCongestion(flow, out)) {
+        found = true;
+      } else {
+        flow.stats.drops++;
+        drops_++;
+        release(out);
+      }
+    }
+    if (!found) {
+      list.pop_front();
+      // A new flow that emptied goes to the back of the old list once, so
+      // it cannot jump the queue again straight away.
+      if (fromNew && !oldFlows_.empty()) {
+        oldFlows_.push_back(bucket);
+      } else {
+        flow.listed = false;
+      }
+      continue;
+    }
+    flow.deficit -= static_cast<int>(out.ipLength);
+    return true;
+  }
+}
+
+bool FlowScheduler::pop(Flow &flow, Packet &out) {
+  if (flow.packets.empty()) {
+    return false;
+  }
+  out = flow.packets.front();
+  flow.packets.pop_front();
+  flow.backlogBytes -= out.ipLength;
+  backlogPackets_--;
+  backlogBytes_ -= out.ipLength;
+  return true;
+}
+
+// RFC 8289 with the state kept per flow, as fq_codel does.
+bool FlowScheduler::codelShouldShed(Flow &flow, Clock::duration sojourn,
+                                    Clock::time_point now) {
+  Codel &codel = flow.codel;
+  const bool over = overTarget(flow, sojourn, now);
+  if (codel.dropping) {
+    if (!over) {
+      codel.dropping = false;
+      return false;
+    }
+    if (now < codel.dropNext) {
+      return false;
+    }
+    codel.count++;
+    codel.dropNext = controlLaw(codel.dropNext, codel.count);
+    return true;
+  }
+  if (!over) {
+    return false;
+  }
+  // Resume near the previous drop rate if we only just left dropping.
+  codel.dropping = true;
+  const uint32_t delta = codel.count - codel.lastCount;
+  codel.count =
+      delta > 1 && now - codel.dropNext < 16 * interval_ ? delta : 1;
+  codel.lastCount = codel.count;
+  codel.dropNext = controlLaw(now, codel.count);
+  return true;
+}
+
+bool FlowScheduler::overTarget(Flow &flow, Clock::duration sojourn,
+                               Clock::time_point now) {
+  Codel &codel = flow.codel;
+  // A flow with at most one packet left has no standing queue to shed.
+  if (sojourn < target_ || flow.backlogBytes <= static_cast<size_t>(kQuantum)) {
+    codel.firstAbove = Clock::time_point{};
+    return false;
+  }
+  if (codel.firstAbove == Clock::time_point{}) {
+    codel.firstAbove = now + interval_;
+    return false;
+  }
+  return now >= codel.firstAbove;
+}
+
+FlowScheduler::Clock::time_point
+FlowScheduler::controlLaw(Clock::time_point t, uint32_t count) const {
+  return t + std::chrono::duration_cast<Clock::duration>(
+                 interval_ / std::sqrt(static_cast<double>(count)));
+}
+
+bool FlowScheduler::markCongestion(Flow &flow, Packet &packet) {
+  uint8_t *ip = packet.ip;
+  if (packet.ipLength < 20 || (ip[0] >> 4) != 4 || (ip[1] & 0x03) == 0) {
+    return false; // Not-ECT
+  }
+  const uint16_t oldWord = load16(ip);
+  ip[1] |= 0x03; // CE
+  const uint16_t checksum =
+      adjustChecksum(load16(ip + 10), oldWord, load16(ip));
+  ip[10] = static_cast<uint8_t>(checksum >> 8);
+  ip[11] = static_cast<uint8_t>(checksum & 0xFF);
+  flow.stats.ecnMarked++;
+  ecnMarked_++;
+  return true;
+}
+
+void FlowScheduler::dropFromLongestFlow() {
+  Flow *longest = nullptr;
+  for (auto &kv : flows_) {
+    if (!kv.second.packets.empty() &&
+        (!longest || kv.second.backlogBytes > longest->backlogBytes)) {
+      longest = &kv.second;
+    }
+  }
+  if (!longest) {
+    // Only priority packets are queued; shed the oldest.
+    const PriorityPacket oldest = priority_.front();
+    priority_.pop_front();
+    flows_[oldest.bucket].stats.drops++;
+    backlogPackets_--;
+    backlogBytes_ -= oldest.packet.ipLength;
+    drops_++;
+    release(oldest.packet);
+    return;
+  }
+  Packet dropped;
+  pop(*longest, dropped);
+  longest->stats.drops++;
+  drops_++;
+  release(dropped);
+}
+
+void FlowScheduler::release(const Packet &packet) {
+  PacketPool::instance().release(packet.buffer);
+}
+
+void FlowScheduler::clear() {
+  for (const PriorityPacket &entry : priority_) {
+    release(entry.packet);
+  }
+  priority_.clear();
+  for (auto &kv : flows_) {
+    for (const Packet &packet : kv.second.packets) {
+      release(packet);
+    }
+  }
+  flows_.clear();
+  newFlows_.clear();
+  oldFlows_.clear();
+  priorityServed_ = 0;
+  backlogPackets_ = 0;
+  backlogBytes_ = 0;
+}
+
+std::vector<FlowScheduler::FlowStats> FlowScheduler::flowStats() const {
+  std::vector<FlowStats> result;
+  result.reserve(flows_.size());
+  for (const auto &kv : flows_) {
+    FlowStats stats = kv.second.stats;
+    stats.backlogPackets = kv.second.packets.size();
+    result.push_back(stats);
+  }
+  return result;
+}
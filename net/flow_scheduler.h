@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// fq_codel-style egress scheduler for the packets headed to one peer.
+// Packets are hashed by 5-tuple into flows served deficit round robin with a
+// byte quantum; flows that just became active (sparse ones: game traffic,
+// DNS, interactive sessions) are served before long-running bulk flows.
+// DSCP-marked real-time traffic and pure TCP ACKs skip the flows through a
+// small priority queue. Each flow runs CoDel on its sojourn time plus the
+// delay the caller reports further down the path (Steam's send queue), and
+// marks ECN-capable packets CE instead of dropping them.
+// Not thread-safe: the owner locks.
+class FlowScheduler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Packet {
+    uint8_t *buffer = nullptr; // PacketPool buffer, owned while queued
+    uint8_t *ip = nullptr;     // the IPv4 packet inside buffer
+    size_t ipLength = 0;
+    Clock::time_point enqueued;
+    bool priority = false; // set by enqueue(): real-time or a pure ACK
+  };
+
+  struct FlowStats {
+    uint32_t sourceIP = 0; // host byte order
+    uint32_t destIP = 0;
+    uint8_t protocol = 0;
+    uint16_t sourcePort = 0;
+    uint16_t destPort = 0;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t drops = 0;          // overflow and CoDel
+    uint64_t ecnMarked = 0;
+    uint64_t priorityPackets = 0;
+    size_t backlogPackets = 0;
+  };
+
+  // FNV-1a over addresses, protocol and, for unfragmented TCP/UDP, ports.
+  static uint32_t flowHash(const uint8_t *packet, size_t length);
+
+  FlowScheduler() = default;
+  FlowScheduler(const FlowScheduler &) = delete;
+  FlowScheduler &operator=(const FlowScheduler &) = delete;
+  ~FlowScheduler() { clear(); }
+
+  // CoDel target (acceptable standing delay) and interval (how long it may
+  // be exceeded before acting). Defaults are 5 ms and 100 ms.
+  void setDelayTarget(Clock::duration target, Clock::duration interval);
+
+  // Takes ownership of packet.buffer. A full scheduler drops from the head
+  // of the longest flow to make room.
+  void enqueue(const Packet &packet);
+  // pathDelay is added to each packet's own sojourn time for CoDel.
+  bool dequeue(Packet &out, Clock::time_point now,
+               Clock::duration pathDelay = Clock::duration::zero());
+  bool empty() const { return backlogPackets_ == 0; }
+  size_t backlogPackets() const { return backlogPackets_; }
+  size_t backlogBytes() const { return backlogBytes_; }
+  uint64_t drops() const { return drops_; }
+  uint64_t ecnMarked() const { return ecnMarked_; }
+  // Release every queued buffer.
+  void clear();
+
+  std::vector<FlowStats> flowStats() const;
+
+private:
+  static constexpr uint32_t kFlowBuckets = 1024;
+  static constexpr int kQuantum = 1514;
+  static constexpr size_t kMaxPackets = 1024;
+  static constexpr size_t kMaxPriorityPackets = 256;
+  // Priority packets served back to back before one flow packet must go.
+  static constexpr int kPriorityBurst = 8;
+
+  struct Codel {
+    bool dropping = false;
+    uint32_t count = 0;
+    uint32_t lastCount = 0;
+    Clock::time_point firstAbove{}; // epoch: delay is below target
+    Clock::time_point dropNext{};
+  };
+  struct Flow {
+    std::deque<Packet> packets;
+    size_t backlogBytes = 0;
+    int deficit = 0;
+    bool listed = false;
+    Codel codel;
+    FlowStats stats;
+  };
+  struct PriorityPacket {
+    Packet packet;
+    uint32_t bucket;
+  };
+
+  static bool isPriority(const uint8_t *ip, size_t length);
+  Flow &flowFor(const uint8_t *ip, size_t length, uint32_t &bucket);
+  bool pop(Flow &flow, Packet &out);
+  // CoDel's verdict for the packet just taken from flow: true to shed it.
+  bool codelShouldShed(Flow &flow, Clock::duration sojourn,
+                       Clock::time_point now);
+  bool overTarget(Flow &flow, Clock::duration sojourn, Clock::time_point now);
+  Clock::time_point controlLaw(Clock::time_point t, uint32_t count) const;
+  // Mark CE if the packet is ECN-capable; false if it has to be dropped.
+  bool markCongestion(Flow &flow, Packet &packet);
+  void dropFromLongestFlow();
+  void release(const Packet &packet);
+
+  std::unordered_map<uint32_t, Flow> flows_;
+  std::deque<uint32_t> newFlows_;
+  std::deque<uint32_t> oldFlows_;
+  std::deque<PriorityPacket> priority_;
+  int priorityServed_ = 0;
+  size_t backlogPackets_ = 0;
+  size_t backlogBytes_ = 0;
+  uint64_t drops_ = 0;
+  uint64_t ecnMarked_ = 0;
+  Clock::duration target_ = std::chrono::milliseconds(5);
+  Clock::duration interval_ = std::chrono::milliseconds(100);
+};
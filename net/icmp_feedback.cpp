@@ -0,0 +1,80 @@
+#include "icmp_feedback.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+constexpr uint8_t kProtoIcmp = 1;
+constexpr uint8_t kIcmpDestUnreachable = 3;
+constexpr uint8_t kIcmpFragNeeded = 4;
+constexpr size_t kIpHeaderLength = 20;
+constexpr size_t kIcmpHeaderLength = 8;
+
+uint16_t checksum(const uint8_t *data, size_t length) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    sum += static_cast<uint32_t>((data[i] << 8) | data[i + 1]);
+  }
+  if (length & 1) {
+    sum += static_cast<uint32_t>(data[length - 1] << 8);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return static_cast<uint16_t>(~sum);
+}
+
+bool isIcmpError(uint8_t type) {
+  return type == 3 || type == 4 || type == 5 || type == 11 || type == 12;
+}
+} // namespace
+
+bool IcmpFeedback::dontFragment(const uint8_t *packet, size_t length) {
+  return length >= kIpHeaderLength && (packet[0] >> 4) == 4 &&
+         (packet[6] & 0x40) != 0;
+}
+
+bool IcmpFeedback::fragmentationNeeded(const uint8_t *packet, size_t length,
+                                       uint16_t nextHopMtu,
+                                       std::vector<uint8_t> &out) {
+  if (!dontFragment(packet, length)) {
+    return false;
+  }
+  const size_t headerLength = static_cast<size_t>(packet[0] & 0x0F) * 4;
+  if (headerLength < kIpHeaderLength || headerLength > length) {
+    return false;
+  }
+  if (((packet[6] & 0x1F) | packet[7]) != 0) {
+    return false; // not the first fragment
+  }
+  if (packet[9] == kProtoIcmp &&
+      (length <= headerLength || isIcmpError(packet[headerLength]))) {
+    return false;
+  }
+
+  // Quote the original header and the first 8 bytes of its payload.
+  const size_t quoted = std::min(length, headerLength + 8);
+  const size_t total = kIpHeaderLength + kIcmpHeaderLength + quoted;
+  out.assign(total, 0);
+  uint8_t *ip = out.data();
+  ip[0] = 0x45;
+  ip[2] = static_cast<uint8_t>(total >> 8);
+  ip[3] = static_cast<uint8_t>(total & 0xFF);
+  ip[8] = 64; // TTL
+  ip[9] = kProtoIcmp;
+  std::memcpy(ip + 12, packet + 16, 4); // from the unreachable destination
+  std::memcpy(ip + 16, packet + 12, 4); // back to the sender
+  const uint16_t ipSum = checksum(ip, kIpHeaderLength);
+  ip[10] = static_cast<uint8_t>(ipSum >> 8);
+  ip[11] = static_cast<uint8_t>(ipSum & 0xFF);
+
+  uint8_t *icmp = ip + kIpHeaderLength;
+  icmp[0] = kIcmpDestUnreachable;
+  icmp[1] = kIcmpFragNeeded;
+  icmp[6] = static_cast<uint8_t>(nextHopMtu >> 8);
+  icmp[7] = static_cast<uint8_t>(nextHopMtu & 0xFF);
+  std::memcpy(icmp + kIcmpHeaderLength, packet, quoted);
+  const uint16_t icmpSum = checksum(icmp, kIcmpHeaderLength + quoted);
+  icmp[2] = static_cast<uint8_t>(icmpSum >> 8);
+  icmp[3] = static_cast<uint8_t>(icmpSum & 0xFF);
+  return true;
+}
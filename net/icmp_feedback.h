@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ICMP errors the bridge generates on behalf of the tunnel, written back to
+// the local stack through the TUN device.
+class IcmpFeedback {
+public:
+  // IPv4 with DF set.
+  static bool dontFragment(const uint8_t *packet, size_t length);
+  // Build a "fragmentation needed" (type 3 code 4) reply to packet
+  // advertising nextHopMtu. It appears to come from packet's destination so
+  // the stack files the new PMTU under it. False for packets that must not
+  // trigger an ICMP error (ICMP errors themselves, fragments, malformed).
+  static bool fragmentationNeeded(const uint8_t *packet, size_t length,
+                                  uint16_t nextHopMtu,
+                                  std::vector<uint8_t> &out);
+};
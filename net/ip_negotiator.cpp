@@ -49,6 +49,17 @@ void IpNegotiator::setSuccessCallback(NegotiationSuccessCallback callback) {
   successCallback_ = std::move(callback);
 }
 
+void IpNegotiator::setDeadlineChangedCallback(DeadlineChangedCallback callback) {
+  deadlineChangedCallback_ = std::move(callback);
+}
+
+std::chrono::steady_clock::time_point IpNegotiator::nextDeadline() const {
+  if (state_ != NegotiationState::PROBING) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return probeStartTime_ + std::chrono::milliseconds(PROBE_TIMEOUT_MS);
+}
+
 void IpNegotiator::startNegotiation() {
   {
     std::lock_guard<std::mutex> lock(conflictsMutex_);
@@ -66,6 +77,9 @@ void IpNegotiator::startNegotiation() {
 
   sendProbeRequest();
   probeStartTime_ = std::chrono::steady_clock::now();
+  if (deadlineChangedCallback_) {
+    deadlineChangedCallback_();
+  }
 }
 
 uint32_t IpNegotiator::generateCandidateIP(uint32_t offset) {
@@ -299,9 +313,10 @@ void IpNegotiator::sendAddressAnnounce() {
   if (!broadcastCallback_) {
     return;
   }
-  AddressAnnouncePayload payload;
-  payload.ipAddress = htonl(localIP_);
-  payload.nodeId = localNodeId_;
+  AddressAnnounceSessionPayload payload;
+  payload.announce.ipAddress = htonl(localIP_);
+  payload.announce.nodeId = localNodeId_;
+  payload.sessionIndex = htons(sessionIndex_);
   broadcastCallback_(VpnMessageType::ADDRESS_ANNOUNCE,
                      reinterpret_cast<const uint8_t *>(&payload),
                      sizeof(payload), true);
@@ -311,9 +326,10 @@ void IpNegotiator::sendAddressAnnounceTo(CSteamID targetSteamID) {
   if (!sendCallback_ || state_ != NegotiationState::STABLE || localIP_ == 0) {
     return;
   }
-  AddressAnnouncePayload payload;
-  payload.ipAddress = htonl(localIP_);
-  payload.nodeId = localNodeId_;
+  AddressAnnounceSessionPayload payload;
+  payload.announce.ipAddress = htonl(localIP_);
+  payload.announce.nodeId = localNodeId_;
+  payload.sessionIndex = htons(sessionIndex_);
   sendCallback_(VpnMessageType::ADDRESS_ANNOUNCE,
                 reinterpret_cast<const uint8_t *>(&payload), sizeof(payload),
                 targetSteamID, true);
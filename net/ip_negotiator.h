@@ -26,6 +26,7 @@ using VpnBroadcastMessageCallback =
                        size_t length, bool reliable)>;
 using NegotiationSuccessCallback =
     std::function<void(uint32_t ipAddress, const NodeID &nodeId)>;
+using DeadlineChangedCallback = std::function<void()>;
 
 class IpNegotiator {
 public:
@@ -35,9 +36,14 @@ public:
   void setSendCallback(VpnSendMessageCallback sendCb,
                        VpnBroadcastMessageCallback broadcastCb);
   void setSuccessCallback(NegotiationSuccessCallback callback);
+  // Fired when a new probe deadline is armed, so a waiting caller can
+  // recompute its timeout.
+  void setDeadlineChangedCallback(DeadlineChangedCallback callback);
   void reset();
   void startNegotiation();
   void checkTimeout();
+  // When checkTimeout() next has work to do; time_point::max() when idle.
+  std::chrono::steady_clock::time_point nextDeadline() const;
   void handleProbeRequest(const ProbeRequestPayload &request,
                           CSteamID senderSteamID);
   void handleProbeResponse(const ProbeResponsePayload &response,
@@ -53,6 +59,8 @@ public:
   const NodeID &getLocalNodeID() const { return localNodeId_; }
   uint32_t getCandidateIP() const { return candidateIP_; }
 
+  // Session index appended to our announces (0 = compact headers off).
+  void setSessionIndex(uint16_t index) { sessionIndex_ = index; }
   void sendAddressAnnounce();
   void sendAddressAnnounceTo(CSteamID targetSteamID);
   void markIPUsed(uint32_t ip);
@@ -65,6 +73,7 @@ private:
   void sendForcedRelease(uint32_t ipAddress, CSteamID targetSteamID);
 
   NodeID localNodeId_;
+  uint16_t sessionIndex_ = 0;
   CSteamID localSteamID_;
   uint32_t localIP_;
   uint32_t baseIP_;
@@ -83,4 +92,5 @@ private:
   VpnSendMessageCallback sendCallback_;
   VpnBroadcastMessageCallback broadcastCallback_;
   NegotiationSuccessCallback successCallback_;
+  DeadlineChangedCallback deadlineChangedCallback_;
 };
@@ -0,0 +1,112 @@
+#include "message_segmenter.h"
+#include "packet_pool.h"
+#include "vpn_wire.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace {
+constexpr size_t kSegmentOverhead =
+    sizeof(VpnMessageHeader) + sizeof(SegmentHeader);
+} // namespace
+
+bool MessageSegmenter::split(const uint8_t *message, size_t length,
+                             size_t budget,
+                             const std::function<void(uint8_t *, size_t)> &fn) {
+  if (budget <= kSegmentOverhead) {
+    return false;
+  }
+  const size_t piece = budget - kSegmentOverhead;
+  const size_t count = (length + piece - 1) / piece;
+  if (count == 0 || count > kMaxSegments) {
+    return false;
+  }
+  // Even pieces, so the last one is not a runt.
+  const size_t even = (length + count - 1) / count;
+  const uint16_t id = htons(nextId_++);
+  for (size_t i = 0; i < count; ++i) {
+    const size_t offset = i * even;
+    const size_t size = std::min(even, length - offset);
+    uint8_t *segment = PacketPool::instance().acquire();
+    VpnMessageHeader header{};
+    header.type = VpnMessageType::IP_PACKET_SEGMENT;
+    header.length = htons(static_cast<uint16_t>(sizeof(SegmentHeader) + size));
+    SegmentHeader segmentHeader{};
+    segmentHeader.messageId = id;
+    segmentHeader.index = static_cast<uint8_t>(i);
+    segmentHeader.count = static_cast<uint8_t>(count);
+    std::memcpy(segment, &header, sizeof(header));
+    std::memcpy(segment + sizeof(header), &segmentHeader,
+                sizeof(segmentHeader));
+    std::memcpy(segment + kSegmentOverhead, message + offset, size);
+    fn(segment, kSegmentOverhead + size);
+  }
+  return true;
+}
+
+bool MessageReassembler::add(const uint8_t *payload, size_t length,
+                             Clock::time_point now,
+                             std::vector<uint8_t> &out) {
+  SegmentHeader header{};
+  if (length <= sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, payload, sizeof(header));
+  if (header.count == 0 || header.count > MessageSegmenter::kMaxSegments ||
+      header.index >= header.count) {
+    return false;
+  }
+  expire(now);
+  const uint16_t id = ntohs(header.messageId);
+  auto it = pending_.find(id);
+  if (it == pending_.end()) {
+    if (pending_.size() >= kMaxPending) {
+      // Make room by giving up on the oldest.
+      auto oldest = std::min_element(
+          pending_.begin(), pending_.end(), [](const auto &a, const auto &b) {
+            return a.second.started < b.second.started;
+          });
+      pending_.erase(oldest);
+      abandoned_++;
+    }
+    it = pending_.emplace(id, Pending()).first;
+    it->second.pieces.resize(header.count);
+    it->second.started = now;
+  }
+  Pending &message = it->second;
+  if (message.pieces.size() != header.count) {
+    return false; // an id reused with another shape; let it time out
+  }
+  std::vector<uint8_t> &piece = message.pieces[header.index];
+  if (!piece.empty()) {
+    return false; // duplicate
+  }
+  piece.assign(payload + sizeof(header), payload + length);
+  if (++message.received < header.count) {
+    return false;
+  }
+  out.clear();
+  for (const std::vector<uint8_t> &part : message.pieces) {
+    out.insert(out.end(), part.begin(), part.end());
+  }
+  pending_.erase(it);
+  return true;
+}
+
+void MessageReassembler::expire(Clock::time_point now) {
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    if (now - it->second.started >= kTimeout) {
+      it = pending_.erase(it);
+      abandoned_++;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void MessageReassembler::clear() { pending_.clear(); }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+// Splits messages too large for one Steam packet into IP_PACKET_SEGMENT
+// messages, and puts them back together on the other side. Steam would
+// fragment a large message itself, but as separate messages each piece
+// fits a datagram, is paced and scheduled like any packet, and can be
+// rebuilt by FEC. Not thread-safe: the owner locks.
+class MessageSegmenter {
+public:
+  static constexpr size_t kMaxSegments = 64;
+
+  // Sender: call fn(segment, size) for each IP_PACKET_SEGMENT message of at
+  // most budget bytes that together carry message. The segment memory is
+  // a PacketPool buffer handed to fn. False if budget is too small.
+  bool split(const uint8_t *message, size_t length, size_t budget,
+             const std::function<void(uint8_t *, size_t)> &fn);
+
+private:
+  uint16_t nextId_ = 0;
+};
+
+class MessageReassembler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Take one IP_PACKET_SEGMENT payload. True once its message is complete,
+  // which is then in out.
+  bool add(const uint8_t *payload, size_t length, Clock::time_point now,
+           std::vector<uint8_t> &out);
+  // Messages given up on because a piece never came.
+  uint64_t abandoned() const { return abandoned_; }
+  void clear();
+
+private:
+  static constexpr size_t kMaxPending = 8;
+  static constexpr std::chrono::milliseconds kTimeout{500};
+
+  struct Pending {
+    std::vector<std::vector<uint8_t>> pieces;
+    size_t received = 0;
+    Clock::time_point started;
+  };
+  void expire(Clock::time_point now);
+
+  std::map<uint16_t, Pending> pending_;
+  uint64_t abandoned_ = 0;
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded lock-free ring for many producers and one consumer (Vyukov's
+// sequence-numbered cells). Slots are constructed once and reused, so a T
+// that keeps its capacity (e.g. std::vector) stops allocating after warmup.
+template <typename T> class MpscRing {
+public:
+  // capacity is rounded up to a power of two.
+  explicit MpscRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask_ = size - 1;
+    cells_ = std::vector<Cell>(size);
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(const MpscRing &) = delete;
+  MpscRing &operator=(const MpscRing &) = delete;
+
+  // Any thread. fill(T &) writes the claimed slot; false if the ring is full.
+  template <typename Fill> bool push(Fill &&fill) {
+    Cell *cell = nullptr;
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueuePos_.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueuePos_.load(std::memory_order_relaxed);
+      }
+    }
+    fill(cell->value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer thread only. drain(T &) reads the oldest slot; false if empty.
+  template <typename Drain> bool pop(Drain &&drain) {
+    const size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    Cell &cell = cells_[pos & mask_];
+    if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+      return false;
+    }
+    drain(cell.value);
+    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+    dequeuePos_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Approximate while producers are active.
+  size_t size() const {
+    const size_t head = dequeuePos_.load(std::memory_order_relaxed);
+    const size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence{0};
+    T value;
+  };
+
+  std::vector<Cell> cells_;
+  size_t mask_ = 0;
+  alignas(64) std::atomic<size_t> enqueuePos_{0};
+  alignas(64) std::atomic<size_t> dequeuePos_{0};
+};
@@ -0,0 +1,95 @@
+#include "mss_clamp.h"
+
+namespace {
+constexpr uint8_t kProtoTcp = 6;
+constexpr uint8_t kTcpFlagSyn = 0x02;
+constexpr uint8_t kOptionEnd = 0;
+constexpr uint8_t kOptionNop = 1;
+constexpr uint8_t kOptionMss = 2;
+
+// RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m').
+uint16_t adjustChecksum(uint16_t checksum, uint16_t oldWord, uint16_t newWord) {
+  uint32_t sum = static_cast<uint16_t>(~checksum);
+  sum += static_cast<uint16_t>(~oldWord);
+  sum += newWord;
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+uint16_t wordAt(const uint8_t *segment, size_t length, size_t offset) {
+  const uint8_t low = offset + 1 < length ? segment[offset + 1] : 0;
+  return static_cast<uint16_t>((segment[offset] << 8) | low);
+}
+} // namespace
+
+bool TcpMssClamp::isSyn(const uint8_t *packet, size_t length) {
+  if (length < 20 || (packet[0] >> 4) != 4 || packet[9] != kProtoTcp) {
+    return false;
+  }
+  // Only the first fragment holds the TCP header; require none at all.
+  if (((packet[6] & 0x3F) | packet[7]) != 0) {
+    return false;
+  }
+  const size_t ipHeaderLength = static_cast<size_t>(packet[0] & 0x0F) * 4;
+  return length >= ipHeaderLength + 20 &&
+         (packet[ipHeaderLength + 13] & kTcpFlagSyn) != 0;
+}
+
+bool TcpMssClamp::clamp(uint8_t *packet, size_t length, uint16_t maxMss) {
+  if (!isSyn(packet, length)) {
+    return false;
+  }
+  const size_t ipHeaderLength = static_cast<size_t>(packet[0] & 0x0F) * 4;
+  uint8_t *tcp = packet + ipHeaderLength;
+  const size_t tcpLength = length - ipHeaderLength;
+  const size_t dataOffset = static_cast<size_t>(tcp[12] >> 4) * 4;
+  if (dataOffset < 20 || dataOffset > tcpLength) {
+    return false;
+  }
+
+  for (size_t offset = 20; offset < dataOffset;) {
+    const uint8_t kind = tcp[offset];
+    if (kind == kOptionEnd) {
+      break;
+    }
+    if (kind == kOptionNop) {
+      ++offset;
+      continue;
+    }
+    if (offset + 1 >= dataOffset) {
+      break;
+    }
+    const size_t optionLength = tcp[offset + 1];
+    if (optionLength < 2 || offset + optionLength > dataOffset) {
+      break;
+    }
+    if (kind != kOptionMss || optionLength != 4) {
+      offset += optionLength;
+      continue;
+    }
+
+    const size_t value = offset + 2;
+    const uint16_t mss = static_cast<uint16_t>((tcp[value] << 8) | tcp[value + 1]);
+    if (mss <= maxMss) {
+      return false;
+    }
+    // Options need not be word aligned: fold in every 16-bit word of the
+    // segment that the two value bytes touch.
+    const size_t first = value & ~static_cast<size_t>(1);
+    const size_t last = (value + 1) & ~static_cast<size_t>(1);
+    const uint16_t oldFirst = wordAt(tcp, tcpLength, first);
+    const uint16_t oldLast = wordAt(tcp, tcpLength, last);
+    tcp[value] = static_cast<uint8_t>(maxMss >> 8);
+    tcp[value + 1] = static_cast<uint8_t>(maxMss & 0xFF);
+    uint16_t checksum = static_cast<uint16_t>((tcp[16] << 8) | tcp[17]);
+    checksum = adjustChecksum(checksum, oldFirst, wordAt(tcp, tcpLength, first));
+    if (last != first) {
+      checksum = adjustChecksum(checksum, oldLast, wordAt(tcp, tcpLength, last));
+    }
+    tcp[16] = static_cast<uint8_t>(checksum >> 8);
+    tcp[17] = static_cast<uint8_t>(checksum & 0xFF);
+    return true;
+  }
+  return false;
+}
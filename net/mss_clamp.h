@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Rewrites the MSS option of IPv4 TCP SYN and SYN-ACK packets so neither end
+// sends segments that would not fit the tunnel path in one piece.
+class TcpMssClamp {
+public:
+  // Unfragmented IPv4 TCP with SYN set; cheap enough for every packet.
+  static bool isSyn(const uint8_t *packet, size_t length);
+  // Lower the MSS option to maxMss if it is larger, updating the TCP
+  // checksum incrementally. Returns true if the packet was changed.
+  static bool clamp(uint8_t *packet, size_t length, uint16_t maxMss);
+};
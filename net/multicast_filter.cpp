@@ -0,0 +1,253 @@
+#include "multicast_filter.h"
+#include <algorithm>
+
+namespace {
+// RFC 3376 group membership interval with default timers.
+constexpr auto kMembershipTimeout = std::chrono::seconds(260);
+constexpr auto kRepeatWindow = std::chrono::milliseconds(1000);
+constexpr size_t kMaxRecent = 512;
+constexpr double kDiscoveryRate = 10.0; // packets per second per protocol
+constexpr double kDiscoveryBurst = 20.0;
+
+constexpr uint8_t kProtoIgmp = 2;
+constexpr uint8_t kProtoUdp = 17;
+
+uint16_t load16(const uint8_t *p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t load32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+size_t ipHeaderLength(const uint8_t *packet, size_t length) {
+  if (length < 20 || (packet[0] >> 4) != 4) {
+    return 0;
+  }
+  const size_t headerLength = static_cast<size_t>(packet[0] & 0x0F) * 4;
+  return headerLength >= 20 && headerLength <= length ? headerLength : 0;
+}
+
+bool isMulticast(uint32_t ip) { return (ip >> 28) == 0xE; }
+
+// 224.0.0.0/24 is never routed and hosts need not report it.
+bool isLinkLocalMulticast(uint32_t ip) { return (ip >> 8) == 0xE00000; }
+} // namespace
+
+MulticastFilter::Protocol MulticastFilter::protocolOf(const uint8_t *packet,
+                                                      size_t length) {
+  const size_t headerLength = ipHeaderLength(packet, length);
+  if (headerLength == 0) {
+    return Protocol::Other;
+  }
+  if (packet[9] == kProtoIgmp) {
+    return Protocol::Igmp;
+  }
+  if (packet[9] != kProtoUdp || length < headerLength + 8) {
+    return Protocol::Other;
+  }
+  switch (load16(packet + headerLength + 2)) {
+  case 1900:
+    return Protocol::Ssdp;
+  case 5353:
+    return Protocol::Mdns;
+  case 5355:
+    return Protocol::Llmnr;
+  case 137:
+  case 138:
+    return Protocol::NetBios;
+  case 3702:
+    return Protocol::WsDiscovery;
+  default:
+    return Protocol::Other;
+  }
+}
+
+MulticastFilter::Verdict MulticastFilter::classify(const uint8_t *packet,
+                                                   size_t length,
+                                                   Clock::time_point now) {
+  if (ipHeaderLength(packet, length) == 0) {
+    return Verdict::Flood;
+  }
+  const uint32_t dest = load32(packet + 16);
+  const Protocol protocol = protocolOf(packet, length);
+  // Reports must reach every peer so they can snoop us; game traffic sent
+  // to broadcast is left alone.
+  if (protocol == Protocol::Igmp) {
+    return Verdict::Flood;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (protocol != Protocol::Other) {
+    if (!takeToken(protocol, now)) {
+      stats_.rateLimited++;
+      return Verdict::Drop;
+    }
+    if (isRepeat(packet, length, now)) {
+      stats_.duplicates++;
+      return Verdict::Drop;
+    }
+  }
+  return isMulticast(dest) && !isLinkLocalMulticast(dest) ? Verdict::Subscribed
+                                                          : Verdict::Flood;
+}
+
+bool MulticastFilter::takeToken(Protocol protocol, Clock::time_point now) {
+  Bucket &bucket = buckets_[protocol];
+  if (bucket.tokens < 0.0) {
+    bucket.tokens = kDiscoveryBurst;
+  } else {
+    const double elapsed =
+        std::chrono::duration<double>(now - bucket.refilled).count();
+    bucket.tokens =
+        std::min(kDiscoveryBurst, bucket.tokens + elapsed * kDiscoveryRate);
+  }
+  bucket.refilled = now;
+  if (bucket.tokens < 1.0) {
+    return false;
+  }
+  bucket.tokens -= 1.0;
+  return true;
+}
+
+bool MulticastFilter::isRepeat(const uint8_t *packet, size_t length,
+                               Clock::time_point now) {
+  // Addresses plus everything after the IP header; IP ID, TTL and checksum
+  // differ between otherwise identical announcements.
+  const size_t headerLength = ipHeaderLength(packet, length);
+  uint64_t hash = 1469598103934665603ull;
+  auto mix = [&hash](const uint8_t *bytes, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  mix(packet + 12, 8);
+  mix(packet + headerLength, length - headerLength);
+
+  if (recent_.size() > kMaxRecent) {
+    for (auto it = recent_.begin(); it != recent_.end();) {
+      if (now - it->second > kRepeatWindow) {
+        it = recent_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  auto it = recent_.find(hash);
+  if (it != recent_.end() && now - it->second <= kRepeatWindow) {
+    return true;
+  }
+  recent_[hash] = now;
+  return false;
+}
+
+bool MulticastFilter::wantsGroup(CSteamID peer, uint32_t group,
+                                 Clock::time_point now) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (snoopedPeers_.find(peer) == snoopedPeers_.end()) {
+    return true;
+  }
+  auto groupIt = groups_.find(group);
+  if (groupIt == groups_.end()) {
+    return false;
+  }
+  auto memberIt = groupIt->second.find(peer);
+  return memberIt != groupIt->second.end() && memberIt->second > now;
+}
+
+void MulticastFilter::countAvoided(uint64_t sends) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.peerSendsAvoided += sends;
+}
+
+void MulticastFilter::snoop(CSteamID peer, const uint8_t *packet,
+                            size_t length, Clock::time_point now) {
+  const size_t headerLength = ipHeaderLength(packet, length);
+  if (headerLength == 0 || packet[9] != kProtoIgmp ||
+      length < headerLength + 8) {
+    return;
+  }
+  const uint8_t *igmp = packet + headerLength;
+  const size_t igmpLength = length - headerLength;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  switch (igmp[0]) {
+  case 0x12: // v1 report
+  case 0x16: // v2 report
+    snoopedPeers_.insert(peer);
+    join(peer, load32(igmp + 4), now);
+    break;
+  case 0x17: // v2 leave
+    snoopedPeers_.insert(peer);
+    leave(peer, load32(igmp + 4));
+    break;
+  case 0x22: { // v3 report
+    snoopedPeers_.insert(peer);
+    const uint16_t records = load16(igmp + 6);
+    size_t offset = 8;
+    for (uint16_t i = 0; i < records && offset + 8 <= igmpLength; ++i) {
+      const uint8_t type = igmp[offset];
+      const size_t auxWords = igmp[offset + 1];
+      const uint16_t sources = load16(igmp + offset + 2);
+      const uint32_t group = load32(igmp + offset + 4);
+      // IS_INCLUDE / TO_INCLUDE with no sources is a leave; BLOCK never
+      // adds interest.
+      if ((type == 1 || type == 3) && sources == 0) {
+        leave(peer, group);
+      } else if (type != 6) {
+        join(peer, group, now);
+      }
+      offset += 8 + static_cast<size_t>(sources) * 4 + auxWords * 4;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void MulticastFilter::join(CSteamID peer, uint32_t group,
+                           Clock::time_point now) {
+  if (isMulticast(group)) {
+    groups_[group][peer] = now + kMembershipTimeout;
+  }
+}
+
+void MulticastFilter::leave(CSteamID peer, uint32_t group) {
+  auto it = groups_.find(group);
+  if (it == groups_.end()) {
+    return;
+  }
+  it->second.erase(peer);
+  if (it->second.empty()) {
+    groups_.erase(it);
+  }
+}
+
+void MulticastFilter::removePeer(CSteamID peer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  snoopedPeers_.erase(peer);
+  for (auto it = groups_.begin(); it != groups_.end();) {
+    it->second.erase(peer);
+    if (it->second.empty()) {
+      it = groups_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void MulticastFilter::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  groups_.clear();
+  snoopedPeers_.clear();
+  buckets_.clear();
+  recent_.clear();
+}
+
+MulticastFilter::Stats MulticastFilter::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
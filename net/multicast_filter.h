@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <steam_api.h>
+#include <unordered_map>
+
+// Decides which peers get a broadcast/multicast packet read from the TUN
+// device. Group membership is snooped from the IGMP reports peers send us;
+// link-local and broadcast discovery chatter (SSDP, mDNS, LLMNR, NetBIOS,
+// WS-Discovery) is rate limited per protocol and repeated copies dropped.
+class MulticastFilter {
+public:
+  enum class Verdict {
+    Drop,      // rate limited or a repeat
+    Flood,     // every peer
+    Subscribed // only peers for which wantsGroup() holds
+  };
+
+  struct Stats {
+    uint64_t rateLimited = 0;
+    uint64_t duplicates = 0;
+    uint64_t peerSendsAvoided = 0; // copies not sent to unsubscribed peers
+  };
+
+  using Clock = std::chrono::steady_clock;
+
+  Verdict classify(const uint8_t *packet, size_t length, Clock::time_point now);
+  // Whether peer should get traffic for group: it joined it, or it has
+  // never sent us an IGMP report (so snooping cannot speak for it).
+  bool wantsGroup(CSteamID peer, uint32_t group, Clock::time_point now) const;
+  void countAvoided(uint64_t sends);
+
+  // Learn memberships from an IGMP packet received from peer.
+  void snoop(CSteamID peer, const uint8_t *packet, size_t length,
+             Clock::time_point now);
+  void removePeer(CSteamID peer);
+  void clear();
+  Stats getStats() const;
+
+private:
+  enum class Protocol { Igmp, Ssdp, Mdns, Llmnr, NetBios, WsDiscovery, Other };
+  struct Bucket {
+    double tokens = -1.0; // < 0: not primed yet
+    Clock::time_point refilled;
+  };
+
+  static Protocol protocolOf(const uint8_t *packet, size_t length);
+  bool takeToken(Protocol protocol, Clock::time_point now);
+  bool isRepeat(const uint8_t *packet, size_t length, Clock::time_point now);
+  void join(CSteamID peer, uint32_t group, Clock::time_point now);
+  void leave(CSteamID peer, uint32_t group);
+
+  // group -> peer -> membership expiry
+  std::map<uint32_t, std::map<CSteamID, Clock::time_point>> groups_;
+  std::set<CSteamID> snoopedPeers_;
+  std::map<Protocol, Bucket> buckets_;
+  std::unordered_map<uint64_t, Clock::time_point> recent_;
+  Stats stats_;
+  mutable std::mutex mutex_;
+};
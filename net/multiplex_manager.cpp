@@ -99,6 +99,11 @@ bool MultiplexManager::removeClient(const std::string &id) {
   return removed;
 }
 
+size_t MultiplexManager::clientCount() {
+  std::lock_guard<std::mutex> lock(mapMutex_);
+  return clientMap_.size();
+}
+
 std::shared_ptr<tcp::socket>
 MultiplexManager::getClient(const std::string &id) {
   std::lock_guard<std::mutex> lock(mapMutex_);
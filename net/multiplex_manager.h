@@ -26,6 +26,7 @@ public:
     std::string addClient(std::shared_ptr<tcp::socket> socket);
     bool removeClient(const std::string& id);
     std::shared_ptr<tcp::socket> getClient(const std::string& id);
+    size_t clientCount();
 
     void sendTunnelPacket(const std::string& id, const char* data, size_t len, int type);
 
@@ -0,0 +1,89 @@
+#include "packet_bundler.h"
+#include "packet_pool.h"
+#include "vpn_wire.h"
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+namespace {
+constexpr size_t kBundleHeader =
+    sizeof(VpnMessageHeader) + sizeof(CompactPacketHeader);
+constexpr size_t kEntryHeader = sizeof(uint16_t);
+} // namespace
+
+bool PacketBundler::fits(size_t ipLength, size_t budget) const {
+  const size_t used = open() ? length_ : kBundleHeader;
+  return used + kEntryHeader + ipLength <= budget;
+}
+
+void PacketBundler::add(const uint8_t *ip, size_t ipLength, bool urgent,
+                        Clock::time_point now) {
+  if (!buffer_) {
+    buffer_ = PacketPool::instance().acquire();
+    length_ = kBundleHeader;
+    openedAt_ = now;
+  }
+  const uint16_t wireLength = htons(static_cast<uint16_t>(ipLength));
+  std::memcpy(buffer_ + length_, &wireLength, kEntryHeader);
+  std::memcpy(buffer_ + length_ + kEntryHeader, ip, ipLength);
+  length_ += kEntryHeader + ipLength;
+  packets_++;
+  urgent_ = urgent_ || urgent;
+}
+
+PacketBundler::Message PacketBundler::finish(uint16_t sessionIndex) {
+  VpnMessageHeader header{};
+  header.type = VpnMessageType::IP_PACKET_BUNDLE;
+  if (packets_ == 1) {
+    // Close the gap left by the length field.
+    header.type = VpnMessageType::IP_PACKET_COMPACT;
+    std::memmove(buffer_ + kBundleHeader, buffer_ + kBundleHeader + kEntryHeader,
+                 length_ - kBundleHeader - kEntryHeader);
+    length_ -= kEntryHeader;
+  }
+  header.length = htons(static_cast<uint16_t>(length_ - sizeof(header)));
+  CompactPacketHeader compact{};
+  compact.sessionIndex = htons(sessionIndex);
+  std::memcpy(buffer_, &header, sizeof(header));
+  std::memcpy(buffer_ + sizeof(header), &compact, sizeof(compact));
+
+  Message message;
+  message.buffer = buffer_;
+  message.data = buffer_;
+  message.size = length_;
+  buffer_ = nullptr;
+  length_ = 0;
+  packets_ = 0;
+  urgent_ = false;
+  return message;
+}
+
+void PacketBundler::reset() {
+  PacketPool::instance().release(buffer_);
+  buffer_ = nullptr;
+  length_ = 0;
+  packets_ = 0;
+  urgent_ = false;
+}
+
+bool PacketBundler::forEach(
+    const uint8_t *packets, size_t length,
+    const std::function<void(const uint8_t *, size_t)> &fn) {
+  size_t offset = 0;
+  while (offset + kEntryHeader <= length) {
+    uint16_t ipLength = 0;
+    std::memcpy(&ipLength, packets + offset, kEntryHeader);
+    ipLength = ntohs(ipLength);
+    offset += kEntryHeader;
+    if (ipLength == 0 || offset + ipLength > length) {
+      return false;
+    }
+    fn(packets + offset, ipLength);
+    offset += ipLength;
+  }
+  return offset == length;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Packs small IP packets for one peer into a single IP_PACKET_BUNDLE
+// message in a PacketPool buffer. Not thread-safe: the owner locks.
+class PacketBundler {
+public:
+  using Clock = std::chrono::steady_clock;
+  // Larger packets are sent on their own.
+  static constexpr size_t kMaxPacket = 256;
+
+  struct Message {
+    uint8_t *buffer = nullptr; // PacketPool buffer, now the caller's
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+  };
+
+  PacketBundler() = default;
+  PacketBundler(const PacketBundler &) = delete;
+  PacketBundler &operator=(const PacketBundler &) = delete;
+  ~PacketBundler() { reset(); }
+
+  // Whether a packet of ipLength still fits a message of budget bytes.
+  bool fits(size_t ipLength, size_t budget) const;
+  // urgent: the bundle should not wait for more packets.
+  void add(const uint8_t *ip, size_t ipLength, bool urgent,
+           Clock::time_point now);
+  bool open() const { return packets_ > 0; }
+  bool urgent() const { return urgent_; }
+  size_t packets() const { return packets_; }
+  Clock::time_point openedAt() const { return openedAt_; }
+  // Seal the bundle. A bundle of one packet goes out as a plain
+  // IP_PACKET_COMPACT message.
+  Message finish(uint16_t sessionIndex);
+  // Drop the open bundle, if any.
+  void reset();
+
+  // Receive side: call fn(ip, length) for each packet of a bundle payload
+  // (after its CompactPacketHeader). False if it is malformed.
+  static bool forEach(const uint8_t *packets, size_t length,
+                      const std::function<void(const uint8_t *, size_t)> &fn);
+
+private:
+  uint8_t *buffer_ = nullptr;
+  size_t length_ = 0;
+  size_t packets_ = 0;
+  bool urgent_ = false;
+  Clock::time_point openedAt_{};
+};
@@ -0,0 +1,98 @@
+#include "packet_pool.h"
+#include <algorithm>
+
+namespace {
+// Set once the thread's cache has been destroyed; buffers released after
+// that (by other thread_local destructors) go straight to the shared lists.
+thread_local bool threadCacheGone = false;
+} // namespace
+
+struct PacketPool::ThreadCache {
+  uint8_t *buffers[kClasses][kCacheSize];
+  size_t count[kClasses] = {};
+
+  ~ThreadCache() {
+    threadCacheGone = true;
+    for (size_t sizeClass = 0; sizeClass < kClasses; ++sizeClass) {
+      instance().giveBack(sizeClass, buffers[sizeClass], count[sizeClass]);
+    }
+  }
+};
+
+PacketPool &PacketPool::instance() {
+  static PacketPool *pool = new PacketPool();
+  return *pool;
+}
+
+PacketPool::ThreadCache *PacketPool::threadCache() {
+  if (threadCacheGone) {
+    return nullptr;
+  }
+  thread_local ThreadCache cache;
+  return &cache;
+}
+
+uint8_t *PacketPool::allocate(size_t sizeClass) {
+  uint8_t *block = new uint8_t[kTagSize + kClassSize[sizeClass]];
+  block[0] = static_cast<uint8_t>(sizeClass);
+  return block + kTagSize;
+}
+
+uint8_t *PacketPool::acquire(size_t size) {
+  const size_t sizeClass = size > kBufferSize ? 1 : 0;
+  ThreadCache *cache = threadCache();
+  if (cache && cache->count[sizeClass] > 0) {
+    return cache->buffers[sizeClass][--cache->count[sizeClass]];
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint8_t *> &idle = idle_[sizeClass];
+    if (!idle.empty()) {
+      // Refill the cache with a batch and hand out one more.
+      const size_t take = cache ? std::min(kBatch, idle.size() - 1) : 0;
+      if (take > 0) {
+        std::copy(idle.end() - static_cast<std::ptrdiff_t>(take), idle.end(),
+                  cache->buffers[sizeClass]);
+        idle.resize(idle.size() - take);
+        cache->count[sizeClass] = take;
+      }
+      uint8_t *buffer = idle.back();
+      idle.pop_back();
+      return buffer;
+    }
+  }
+  return allocate(sizeClass);
+}
+
+void PacketPool::release(uint8_t *buffer) {
+  if (!buffer) {
+    return;
+  }
+  const size_t sizeClass = (buffer - kTagSize)[0];
+  ThreadCache *cache = threadCache();
+  if (!cache) {
+    giveBack(sizeClass, &buffer, 1);
+    return;
+  }
+  size_t &count = cache->count[sizeClass];
+  if (count == kCacheSize) {
+    count -= kBatch;
+    giveBack(sizeClass, cache->buffers[sizeClass] + count, kBatch);
+  }
+  cache->buffers[sizeClass][count++] = buffer;
+}
+
+void PacketPool::giveBack(size_t sizeClass, uint8_t *const *buffers,
+                          size_t count) {
+  size_t kept = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint8_t *> &idle = idle_[sizeClass];
+    kept = std::min(count, kMaxIdle[sizeClass] - std::min(kMaxIdle[sizeClass],
+                                                          idle.size()));
+    idle.insert(idle.end(), buffers, buffers + kept);
+  }
+  for (size_t i = kept; i < count; ++i) {
+    delete[](buffers[i] - kTagSize);
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Fixed-size packet buffers recycled across threads. A TUN read lands in
+// one, and on the connection data plane the same buffer becomes the Steam
+// message, returned here by Steam's free callback once it has been sent.
+// Two sizes: standard, and jumbo for TUN frames above a 1500-ish MTU.
+// Each thread keeps a small cache of its own and trades with the shared
+// idle lists kBatch buffers at a time, so the TUN queues and Steam's free
+// callback take the mutex once per batch rather than once per packet.
+class PacketPool {
+public:
+  static constexpr size_t kBufferSize = 4096;
+  static constexpr size_t kJumboBufferSize = 16384;
+
+  // Process-wide and never destroyed: Steam may release messages late.
+  static PacketPool &instance();
+
+  // A buffer of at least size bytes (at most kJumboBufferSize).
+  uint8_t *acquire(size_t size = kBufferSize);
+  void release(uint8_t *buffer);
+
+private:
+  PacketPool() = default;
+
+  // Each buffer is preceded by a tag naming its size class; the tag keeps
+  // the buffer itself 16-byte aligned.
+  static constexpr size_t kTagSize = 16;
+  static constexpr size_t kClasses = 2;
+  static constexpr size_t kClassSize[kClasses] = {kBufferSize,
+                                                  kJumboBufferSize};
+  static constexpr size_t kMaxIdle[kClasses] = {4096, 256};
+  static constexpr size_t kCacheSize = 64;
+  static constexpr size_t kBatch = 32;
+
+  struct ThreadCache;
+  // Null once the calling thread's cache is gone (thread exit).
+  static ThreadCache *threadCache();
+  static uint8_t *allocate(size_t sizeClass);
+  // Move count buffers to the shared idle list, freeing what does not fit.
+  void giveBack(size_t sizeClass, uint8_t *const *buffers, size_t count);
+
+  std::vector<uint8_t *> idle_[kClasses];
+  std::mutex mutex_;
+};
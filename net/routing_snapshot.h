@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vpn_protocol.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Immutable copy of the routing table sorted by IP. Writers build a new one
+// on every change and publish it through an atomic shared_ptr; packet
+// threads and the GUI read whichever version they loaded without locking.
+struct RoutingSnapshot {
+  // Lookup data kept apart from the names so a search touches few lines.
+  struct Hop {
+    uint32_t ipAddress;
+    CSteamID steamID;
+    bool isLocal;
+  };
+
+  std::vector<Hop> hops;           // sorted by ipAddress
+  std::vector<RouteEntry> entries; // same order as hops
+
+  const Hop *find(uint32_t ipAddress) const {
+    auto it = std::lower_bound(
+        hops.begin(), hops.end(), ipAddress,
+        [](const Hop &hop, uint32_t ip) { return hop.ipAddress < ip; });
+    return it != hops.end() && it->ipAddress == ipAddress ? &*it : nullptr;
+  }
+  bool contains(uint32_t ipAddress) const {
+    return find(ipAddress) != nullptr;
+  }
+};
+
+using RoutingSnapshotPtr = std::shared_ptr<const RoutingSnapshot>;
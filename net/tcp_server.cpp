@@ -86,7 +86,10 @@ void TCPServer::start_accept() {
             // Low latency between local TCP and Steam tunnel
             boost::system::error_code ec;
             socket->set_option(tcp::no_delay(true), ec);
-            auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(manager_->getConnection());
+            // The tunnel stays on the connection it was opened on, even if the
+            // manager migrates to another path while it is open.
+            HSteamNetConnection conn = manager_->getConnection();
+            auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(conn);
             std::string id = multiplexManager->addClient(socket);
             int currentCount = 0;
             {
@@ -95,7 +98,7 @@ void TCPServer::start_accept() {
                 currentCount = static_cast<int>(clients_.size());
             }
             notifyClientCount(currentCount);
-            start_read(socket, id);
+            start_read(socket, id, conn);
         }
         if (running_) {
             start_accept();
@@ -103,23 +106,23 @@ void TCPServer::start_accept() {
     });
 }
 
-void TCPServer::start_read(std::shared_ptr<tcp::socket> socket, std::string id) {
+void TCPServer::start_read(std::shared_ptr<tcp::socket> socket, std::string id, HSteamNetConnection conn) {
     auto buffer = std::make_shared<std::vector<char>>(1048576);
-    socket->async_read_some(boost::asio::buffer(*buffer), [this, socket, buffer, id](const boost::system::error_code& error, std::size_t bytes_transferred) {
+    socket->async_read_some(boost::asio::buffer(*buffer), [this, socket, buffer, id, conn](const boost::system::error_code& error, std::size_t bytes_transferred) {
         if (!error) {
             if (manager_->isConnected()) {
-                auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(manager_->getConnection());
+                auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(conn);
                 multiplexManager->sendTunnelPacket(id, buffer->data(), bytes_transferred, 0);
             } else {
                 std::cout << "Not connected to Steam, skipping forward" << std::endl;
             }
             sendToAll(buffer->data(), bytes_transferred, socket);
-            start_read(socket, id);
+            start_read(socket, id, conn);
         } else {
             std::cout << "TCP client " << id << " disconnected or error: " << error.message() << std::endl;
             // Send disconnect packet
             if (manager_->isConnected()) {
-                auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(manager_->getConnection());
+                auto multiplexManager = manager_->getMessageHandler()->getMultiplexManager(conn);
                 multiplexManager->sendTunnelPacket(id, nullptr, 0, 1);
                 // Remove client
                 multiplexManager->removeClient(id);
@@ -32,7 +32,7 @@ public:
 
 private:
     void start_accept();
-    void start_read(std::shared_ptr<tcp::socket> socket, std::string id);
+    void start_read(std::shared_ptr<tcp::socket> socket, std::string id, HSteamNetConnection conn);
     void notifyClientCount(int count);
 
     int port_;
@@ -0,0 +1,49 @@
+#include "token_bucket.h"
+#include <algorithm>
+
+namespace {
+// Burst: 100 ms at the configured rate, but never less than a few packets.
+constexpr double kBurstSeconds = 0.1;
+constexpr double kMinBurstBytes = 16 * 1024;
+
+double burstFor(uint64_t rateBytesPerSec) {
+  return std::max(kMinBurstBytes,
+                  static_cast<double>(rateBytesPerSec) * kBurstSeconds);
+}
+} // namespace
+
+void TokenBucket::refill(uint64_t rateBytesPerSec, Clock::time_point now) {
+  const double burst = burstFor(rateBytesPerSec);
+  if (refilled_ == Clock::time_point{}) {
+    tokens_ = burst;
+  } else if (now > refilled_) {
+    const double elapsed =
+        std::chrono::duration<double>(now - refilled_).count();
+    tokens_ = std::min(
+        burst, tokens_ + elapsed * static_cast<double>(rateBytesPerSec));
+  }
+  refilled_ = now;
+}
+
+bool TokenBucket::allow(uint64_t rateBytesPerSec, Clock::time_point now) {
+  if (rateBytesPerSec == 0) {
+    // Start full if a limit is set later.
+    refilled_ = Clock::time_point{};
+    return true;
+  }
+  refill(rateBytesPerSec, now);
+  return tokens_ > 0.0;
+}
+
+void TokenBucket::consume(size_t bytes) {
+  tokens_ -= static_cast<double>(bytes);
+}
+
+bool TokenBucket::take(size_t bytes, uint64_t rateBytesPerSec,
+                       Clock::time_point now) {
+  if (!allow(rateBytesPerSec, now)) {
+    return false;
+  }
+  consume(bytes);
+  return true;
+}
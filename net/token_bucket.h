@@ -0,0 +1,26 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Byte token bucket refilled lazily from the clock. The rate is passed on
+// each call so it can be changed at any time; 0 means unlimited. A packet
+// may take the bucket into debt, so packets larger than the burst are
+// never starved. Not thread-safe: one user at a time.
+class TokenBucket {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Whether anything may be sent now at rateBytesPerSec.
+  bool allow(uint64_t rateBytesPerSec, Clock::time_point now);
+  void consume(size_t bytes);
+  // allow() and consume() in one, for policing: false means drop.
+  bool take(size_t bytes, uint64_t rateBytesPerSec, Clock::time_point now);
+
+private:
+  void refill(uint64_t rateBytesPerSec, Clock::time_point now);
+
+  double tokens_ = 0.0;
+  Clock::time_point refilled_{}; // epoch: never used, starts full
+};
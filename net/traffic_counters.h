@@ -0,0 +1,51 @@
+#pragma once
+
+#include "vpn_protocol.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Message types are small integers; anything past the last slot is folded
+// into it.
+constexpr size_t kVpnMessageTypeSlots = 32;
+
+inline size_t messageTypeSlot(VpnMessageType type) {
+  return std::min<size_t>(static_cast<uint8_t>(type),
+                          kVpnMessageTypeSlots - 1);
+}
+
+// Traffic counters owned by one writer thread. Each block sits on its own
+// cache line(s) so writers never share one; readers sum every block.
+struct alignas(64) TrafficCounters {
+  std::atomic<uint64_t> packetsSent{0};
+  std::atomic<uint64_t> bytesSent{0};
+  std::atomic<uint64_t> packetsReceived{0};
+  std::atomic<uint64_t> bytesReceived{0};
+  std::atomic<uint64_t> packetsDropped{0};
+  std::atomic<uint64_t> compactPacketsSent{0};
+  std::atomic<uint64_t> headerBytesSaved{0};
+  std::atomic<uint64_t> mssClamped{0};
+  std::atomic<uint64_t> pmtuRejected{0};
+  std::atomic<uint64_t> rateLimited{0};
+  std::atomic<uint64_t> fecParitySent{0};
+  std::atomic<uint64_t> fecParityBytes{0};
+  std::atomic<uint64_t> fecRecovered{0};
+  std::atomic<uint64_t> fecLost{0};
+  std::atomic<uint64_t> bundlesSent{0};
+  std::atomic<uint64_t> bundledPackets{0};
+  std::atomic<uint64_t> messagesSegmented{0};
+  std::atomic<uint64_t> segmentsSent{0};
+  std::atomic<uint64_t> messagesReassembled{0};
+  std::atomic<uint64_t> reassemblyFailures{0};
+  std::array<std::atomic<uint64_t>, kVpnMessageTypeSlots> sentByType{};
+  std::array<std::atomic<uint64_t>, kVpnMessageTypeSlots> receivedByType{};
+};
+
+// Increment for a counter with a single writer: a relaxed load/store pair,
+// avoiding the locked read-modify-write of fetch_add.
+inline void bumpCounter(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+}
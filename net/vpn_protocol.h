@@ -1,6 +1,6 @@
 #pragma once
 
-#include <array>
+#include "vpn_wire.h"
 #include <chrono>
 #include <cstdint>
 #include <steam_api.h>
@@ -16,60 +16,6 @@ constexpr int64_t LEASE_TIME_MS = 120000;
 constexpr int64_t LEASE_EXPIRY_MS = 360000;
 constexpr int64_t HEARTBEAT_EXPIRY_MS = 180000;
 
-// Node ID
-constexpr size_t NODE_ID_SIZE = 32;
-using NodeID = std::array<uint8_t, NODE_ID_SIZE>;
-
-enum class VpnMessageType : uint8_t {
-  IP_PACKET = 1,
-  ROUTE_UPDATE = 3,
-  PROBE_REQUEST = 10,
-  PROBE_RESPONSE = 11,
-  ADDRESS_ANNOUNCE = 12,
-  FORCED_RELEASE = 13,
-  HEARTBEAT = 14,
-  HEARTBEAT_ACK = 15,
-  SESSION_HELLO = 20
-};
-
-#pragma pack(push, 1)
-struct VpnMessageHeader {
-  VpnMessageType type;
-  uint16_t length;
-};
-
-struct VpnPacketWrapper {
-  NodeID senderNodeId;
-  uint32_t sourceIP; // network byte order
-};
-
-struct ProbeRequestPayload {
-  uint32_t ipAddress;
-  NodeID nodeId;
-};
-
-struct ProbeResponsePayload {
-  uint32_t ipAddress;
-  NodeID nodeId;
-  int64_t lastHeartbeatMs;
-};
-
-struct AddressAnnouncePayload {
-  uint32_t ipAddress;
-  NodeID nodeId;
-};
-
-struct ForcedReleasePayload {
-  uint32_t ipAddress;
-  NodeID winnerNodeId;
-};
-
-struct HeartbeatPayload {
-  uint32_t ipAddress;
-  NodeID nodeId;
-  int64_t timestampMs;
-};
-#pragma pack(pop)
 
 struct NodeInfo {
   NodeID nodeId;
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// On-the-wire VPN message formats. Kept free of Steam types so the packet
+// helpers (bundling, segmentation, FEC) build and test on their own.
+
+// Node ID
+constexpr size_t NODE_ID_SIZE = 32;
+using NodeID = std::array<uint8_t, NODE_ID_SIZE>;
+
+enum class VpnMessageType : uint8_t {
+  IP_PACKET = 1,
+  ROUTE_UPDATE = 3,
+  PROBE_REQUEST = 10,
+  PROBE_RESPONSE = 11,
+  ADDRESS_ANNOUNCE = 12,
+  FORCED_RELEASE = 13,
+  HEARTBEAT = 14,
+  HEARTBEAT_ACK = 15,
+  IP_PACKET_COMPACT = 16,
+  SESSION_ACK = 17,
+  PMTU_PROBE = 18,
+  PMTU_PROBE_ACK = 19,
+  SESSION_HELLO = 20,
+  FEC_PARITY = 21,
+  IP_PACKET_BUNDLE = 22,
+  IP_PACKET_SEGMENT = 23
+};
+
+#pragma pack(push, 1)
+struct VpnMessageHeader {
+  VpnMessageType type;
+  uint16_t length;
+};
+
+struct VpnPacketWrapper {
+  NodeID senderNodeId;
+  uint32_t sourceIP; // network byte order
+};
+
+struct ProbeRequestPayload {
+  uint32_t ipAddress;
+  NodeID nodeId;
+};
+
+struct ProbeResponsePayload {
+  uint32_t ipAddress;
+  NodeID nodeId;
+  int64_t lastHeartbeatMs;
+};
+
+struct AddressAnnouncePayload {
+  uint32_t ipAddress;
+  NodeID nodeId;
+};
+
+// ADDRESS_ANNOUNCE with the sender's session index appended. Older peers
+// read only the leading AddressAnnouncePayload.
+struct AddressAnnounceSessionPayload {
+  AddressAnnouncePayload announce;
+  uint16_t sessionIndex; // network byte order, 0 = no compact headers
+};
+
+// Prefix of IP_PACKET_COMPACT; the IP packet follows. Stands in for
+// VpnPacketWrapper once the receiver has acknowledged the index: the NodeID
+// comes from the sender's announce and the source IP from the packet.
+struct CompactPacketHeader {
+  uint16_t sessionIndex; // network byte order
+};
+
+// SESSION_ACK: echoes the announced index, or 0 when a compact packet
+// carried an index the receiver does not know.
+struct SessionAckPayload {
+  uint16_t sessionIndex; // network byte order
+};
+
+// SESSION_ACK with the features the acknowledging peer accepts appended.
+// Older peers send and read only the leading SessionAckPayload.
+constexpr uint8_t kSessionFeatureBundles = 0x01;
+constexpr uint8_t kSessionFeatureSegments = 0x02;
+struct SessionAckFeaturesPayload {
+  SessionAckPayload ack;
+  uint8_t features;
+};
+
+// IP_PACKET_BUNDLE: several small IP packets for one receiver in one
+// message. A CompactPacketHeader, then per packet a uint16_t length
+// (network byte order) and the packet. Only sent once the receiver
+// acknowledged the session with kSessionFeatureBundles.
+
+// PMTU_PROBE: padded with zeros up to probeSize message bytes (header
+// included). PMTU_PROBE_ACK echoes it unpadded.
+struct PmtuProbePayload {
+  uint16_t probeSize; // network byte order
+  uint16_t round;     // network byte order
+};
+
+// FEC_PARITY: XOR parity over the last few data messages (IP_PACKET,
+// IP_PACKET_COMPACT, IP_PACKET_BUNDLE, IP_PACKET_SEGMENT) sent to the
+// receiver, each taken whole (header included) and zero-padded to the
+// longest. Followed by count message hashes (FNV-1a, network byte order)
+// naming the group, then the parity bytes. Only messages short enough for
+// the parity to still fit one Steam packet are grouped.
+struct FecParityHeader {
+  uint8_t count;
+  uint8_t reserved;
+  uint16_t lengthXor; // network byte order; XOR of the message lengths
+};
+
+// IP_PACKET_SEGMENT: one piece of an IP_PACKET or IP_PACKET_COMPACT
+// message too large for one Steam packet (a jumbo frame). The pieces, in
+// index order, make up the whole message, header included. Only sent once
+// the receiver acknowledged the session with kSessionFeatureSegments.
+struct SegmentHeader {
+  uint16_t messageId; // network byte order; per sender, wraps
+  uint8_t index;
+  uint8_t count;
+};
+
+struct ForcedReleasePayload {
+  uint32_t ipAddress;
+  NodeID winnerNodeId;
+};
+
+struct HeartbeatPayload {
+  uint32_t ipAddress;
+  NodeID nodeId;
+  int64_t timestampMs;
+};
+#pragma pack(pop)
@@ -0,0 +1,140 @@
+#include "xor_fec.h"
+#include "vpn_wire.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+uint32_t fecMessageHash(const uint8_t *message, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ message[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void XorFecEncoder::setGroupSize(size_t size) {
+  groupSize_ = std::clamp<size_t>(size, 2, kMaxGroupSize);
+}
+
+bool XorFecEncoder::add(const uint8_t *message, size_t length,
+                        Clock::time_point now) {
+  if (hashes_.empty()) {
+    openedAt_ = now;
+  }
+  hashes_.push_back(fecMessageHash(message, length));
+  if (parity_.size() < length) {
+    parity_.resize(length, 0);
+  }
+  for (size_t i = 0; i < length; ++i) {
+    parity_[i] ^= message[i];
+  }
+  lengthXor_ ^= static_cast<uint16_t>(length);
+  return hashes_.size() >= groupSize_;
+}
+
+void XorFecEncoder::finish(std::vector<uint8_t> &out, size_t offset) {
+  FecParityHeader header{};
+  header.count = static_cast<uint8_t>(hashes_.size());
+  header.lengthXor = htons(lengthXor_);
+  out.resize(offset + sizeof(header) + hashes_.size() * 4 + parity_.size());
+  uint8_t *cursor = out.data() + offset;
+  std::memcpy(cursor, &header, sizeof(header));
+  cursor += sizeof(header);
+  for (uint32_t hash : hashes_) {
+    const uint32_t wire = htonl(hash);
+    std::memcpy(cursor, &wire, 4);
+    cursor += 4;
+  }
+  std::memcpy(cursor, parity_.data(), parity_.size());
+  reset();
+}
+
+void XorFecEncoder::reset() {
+  hashes_.clear();
+  parity_.clear();
+  lengthXor_ = 0;
+}
+
+bool XorFecDecoder::remember(const uint8_t *message, size_t length) {
+  const uint32_t hash = fecMessageHash(message, length);
+  for (Recovered &late : recovered_) {
+    if (late.used && late.hash == hash) {
+      late.used = false;
+      return false;
+    }
+  }
+  Slot &slot = slots_[hash & (kSlots - 1)];
+  slot.hash = hash;
+  slot.used = true;
+  slot.message.assign(message, message + length);
+  return true;
+}
+
+XorFecDecoder::Result XorFecDecoder::recover(const uint8_t *payload,
+                                             size_t length,
+                                             std::vector<uint8_t> &out,
+                                             size_t &missing) {
+  missing = 0;
+  FecParityHeader header{};
+  if (length < sizeof(header)) {
+    return Result::Unrecoverable;
+  }
+  std::memcpy(&header, payload, sizeof(header));
+  const size_t hashBytes = static_cast<size_t>(header.count) * 4;
+  if (header.count == 0 || length < sizeof(header) + hashBytes) {
+    return Result::Unrecoverable;
+  }
+  const uint8_t *hashes = payload + sizeof(header);
+  const uint8_t *parity = hashes + hashBytes;
+  const size_t parityLength = length - sizeof(header) - hashBytes;
+
+  uint32_t missingHash = 0;
+  uint16_t lengthXor = ntohs(header.lengthXor);
+  out.assign(parity, parity + parityLength);
+  for (size_t i = 0; i < header.count; ++i) {
+    uint32_t hash = 0;
+    std::memcpy(&hash, hashes + i * 4, 4);
+    hash = ntohl(hash);
+    const Slot &slot = slots_[hash & (kSlots - 1)];
+    if (!slot.used || slot.hash != hash) {
+      missing++;
+      missingHash = hash;
+      continue;
+    }
+    const std::vector<uint8_t> &message = slot.message;
+    if (message.size() > parityLength) {
+      return Result::Unrecoverable;
+    }
+    for (size_t j = 0; j < message.size(); ++j) {
+      out[j] ^= message[j];
+    }
+    lengthXor ^= static_cast<uint16_t>(message.size());
+  }
+  if (missing == 0) {
+    return Result::Complete;
+  }
+  if (missing > 1 || lengthXor > parityLength) {
+    return Result::Unrecoverable;
+  }
+  out.resize(lengthXor);
+  if (fecMessageHash(out.data(), out.size()) != missingHash) {
+    missing = 1;
+    return Result::Unrecoverable;
+  }
+  recovered_[nextRecovered_] = {missingHash, true};
+  nextRecovered_ = (nextRecovered_ + 1) % kMaxRecovered;
+  return Result::Recovered;
+}
+
+void XorFecDecoder::clear() {
+  for (Slot &slot : slots_) {
+    slot.used = false;
+  }
+  recovered_.fill({});
+  nextRecovered_ = 0;
+}
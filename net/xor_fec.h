@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// XOR forward error correction over small groups of unreliable messages.
+// Data messages go out unchanged; after each group the sender adds one
+// FEC_PARITY message naming the group by message hash, from which the
+// receiver can rebuild any single message of the group that went missing.
+// Not thread-safe: one encoder per peer on the send side, one decoder per
+// peer on the receive thread.
+class XorFecEncoder {
+public:
+  using Clock = std::chrono::steady_clock;
+  static constexpr size_t kMaxGroupSize = 16;
+
+  void setGroupSize(size_t size);
+  size_t groupSize() const { return groupSize_; }
+
+  // Fold a message into the open group; true once the group is full.
+  bool add(const uint8_t *message, size_t length, Clock::time_point now);
+  bool open() const { return !hashes_.empty(); }
+  Clock::time_point openedAt() const { return openedAt_; }
+  // Write the FEC_PARITY payload for the open group into out after its
+  // first offset bytes (room for a message header), and start a new one.
+  void finish(std::vector<uint8_t> &out, size_t offset);
+  void reset();
+
+private:
+  size_t groupSize_ = 4;
+  std::vector<uint32_t> hashes_;
+  std::vector<uint8_t> parity_;
+  uint16_t lengthXor_ = 0;
+  Clock::time_point openedAt_{};
+};
+
+class XorFecDecoder {
+public:
+  enum class Result {
+    Complete,     // nothing missing
+    Recovered,    // out holds the missing message
+    Unrecoverable // more than one missing, or malformed
+  };
+
+  // Keep a received data message for later parity. False if it is a late
+  // copy of a message already rebuilt, which should then be dropped.
+  bool remember(const uint8_t *message, size_t length);
+  // missing is set to the number of messages of the group not received.
+  Result recover(const uint8_t *payload, size_t length,
+                 std::vector<uint8_t> &out, size_t &missing);
+  void clear();
+
+private:
+  static constexpr size_t kSlots = 256; // a power of two
+  static constexpr size_t kMaxRecovered = 64;
+
+  struct Slot {
+    uint32_t hash = 0;
+    bool used = false;
+    std::vector<uint8_t> message;
+  };
+  struct Recovered {
+    uint32_t hash = 0;
+    bool used = false;
+  };
+
+  // Direct-mapped by hash: a message evicts whatever shared its slot. Slot
+  // buffers keep their capacity, so once warm remember() never allocates.
+  std::vector<Slot> slots_ = std::vector<Slot>(kSlots);
+  std::array<Recovered, kMaxRecovered> recovered_{};
+  size_t nextRecovered_ = 0;
+};
+
+// FNV-1a over a whole message; names it in a parity group.
+uint32_t fecMessageHash(const uint8_t *message, size_t length);
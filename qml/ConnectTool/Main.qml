@@ -1056,6 +1056,9 @@ ApplicationWindow {
                                                             required property string ip
                                                             required property var ping
                                                             required property string relay
+                                                            required property int sendRate
+                                                            required property int sendCapacity
+                                                            required property int mtu
                                                             required property bool isFriend
                                                             required property bool isSelf
 
@@ -1221,6 +1224,22 @@ ApplicationWindow {
                                                                         horizontalAlignment: Text.AlignRight
                                                                         Layout.alignment: Qt.AlignRight
                                                                     }
+                                                                    Label {
+                                                                        visible: sendRate > 0
+                                                                        text: qsTr("发送 %1 / 容量 %2 KB/s").arg(sendRate).arg(sendCapacity > 0 ? sendCapacity : "-")
+                                                                        color: "#7f8cab"
+                                                                        font.pixelSize: 11
+                                                                        horizontalAlignment: Text.AlignRight
+                                                                        Layout.alignment: Qt.AlignRight
+                                                                    }
+                                                                    Label {
+                                                                        visible: mtu > 0
+                                                                        text: qsTr("MTU %1").arg(mtu)
+                                                                        color: "#7f8cab"
+                                                                        font.pixelSize: 11
+                                                                        horizontalAlignment: Text.AlignRight
+                                                                        Layout.alignment: Qt.AlignRight
+                                                                    }
                                                                 }
                                                             }
                                                         }
@@ -718,6 +718,16 @@ bool Backend::tryInitializeSteam() {
     return false;
   }
 
+  const QString dataDir =
+      QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+  if (!dataDir.isEmpty() && QDir().mkpath(dataDir)) {
+    steamManager_->setTransportCachePath(
+        QDir::toNativeSeparators(
+            QDir(dataDir).filePath(QStringLiteral("transport_cache.txt")))
+            .toLocal8Bit()
+            .toStdString());
+  }
+
   roomManager_ = std::make_unique<SteamRoomManager>(steamManager_.get());
   steamManager_->setRoomManager(roomManager_.get());
   roomManager_->setAdvertisedMode(inTunMode());
@@ -904,6 +914,8 @@ void Backend::ensureServerRunning() {
 void Backend::ensureVpnSetup() {
   if (!vpnManager_) {
     vpnManager_ = std::make_unique<SteamVpnNetworkingManager>();
+    vpnManager_->setConnectionDataPlaneEnabled(
+        qEnvironmentVariableIntValue("CONNECTTOOL_TUN_SOCKETS") != 0);
     if (!vpnManager_->initialize()) {
       qWarning() << tr("Steam VPN 初始化失败。");
       vpnManager_.reset();
@@ -912,6 +924,44 @@ void Backend::ensureVpnSetup() {
   }
   if (!vpnBridge_) {
     vpnBridge_ = std::make_unique<SteamVpnBridge>(vpnManager_.get());
+    const int tunQueues = qEnvironmentVariableIntValue("CONNECTTOOL_TUN_QUEUES");
+    if (tunQueues > 0) {
+      vpnBridge_->setTunQueueCount(tunQueues);
+    }
+    const int delayTargetMs =
+        qEnvironmentVariableIntValue("CONNECTTOOL_TUN_DELAY_TARGET_MS");
+    if (delayTargetMs > 0) {
+      const int delayIntervalMs =
+          qEnvironmentVariableIntValue("CONNECTTOOL_TUN_DELAY_INTERVAL_MS");
+      vpnBridge_->setQueueDelayTarget(
+          delayTargetMs, delayIntervalMs > 0 ? delayIntervalMs : 100);
+    }
+    // Default per-peer caps in KB/s; 0 or unset leaves that one unlimited.
+    auto bytesPerSec = [](const char *name) {
+      return static_cast<uint64_t>(
+                 std::max(0, qEnvironmentVariableIntValue(name))) *
+             1024;
+    };
+    SteamVpnBridge::RateLimits limits;
+    limits.egressBytesPerSec = bytesPerSec("CONNECTTOOL_TUN_PEER_EGRESS_KBPS");
+    limits.ingressBytesPerSec =
+        bytesPerSec("CONNECTTOOL_TUN_PEER_INGRESS_KBPS");
+    limits.forwardBytesPerSec =
+        bytesPerSec("CONNECTTOOL_TUN_PEER_FORWARD_KBPS");
+    vpnBridge_->setDefaultRateLimits(limits);
+    vpnBridge_->setAggregation(
+        qEnvironmentVariableIntValue("CONNECTTOOL_TUN_NO_BUNDLE") == 0,
+        std::chrono::microseconds(std::max(
+            0, qEnvironmentVariableIntValue("CONNECTTOOL_TUN_BUNDLE_WINDOW_US"))));
+    // FEC threshold as a loss percentage; unset leaves FEC off.
+    const int fecLossPercent =
+        qEnvironmentVariableIntValue("CONNECTTOOL_TUN_FEC_LOSS_PERCENT");
+    if (fecLossPercent > 0) {
+      vpnBridge_->setForwardErrorCorrection(true, fecLossPercent / 100.0);
+    }
+    // Jumbo TUN MTU for healthy direct peers; unset keeps the standard one.
+    vpnBridge_->setJumboMtu(
+        qEnvironmentVariableIntValue("CONNECTTOOL_TUN_JUMBO_MTU"));
     vpnManager_->setVpnBridge(vpnBridge_.get());
   }
   if (roomManager_) {
@@ -2133,11 +2183,16 @@ void Backend::updateMembersList() {
     }
 
     std::unordered_map<uint64_t, uint32_t> ipBySteam;
+    std::unordered_map<uint64_t, int> mtuBySteam;
     if (vpnBridge_) {
-      const auto routes = vpnBridge_->getRoutingTable();
-      for (const auto &kv : routes) {
-        const uint64_t sid = kv.second.steamID.ConvertToUint64();
-        ipBySteam[sid] = kv.second.ipAddress;
+      const RoutingSnapshotPtr routes = vpnBridge_->getRoutingSnapshot();
+      for (const auto &hop : routes->hops) {
+        ipBySteam[hop.steamID.ConvertToUint64()] = hop.ipAddress;
+      }
+      for (const auto &peer : vpnBridge_->getStatistics().peers) {
+        if (peer.pathMtu > 0) {
+          mtuBySteam[peer.steamID.ConvertToUint64()] = peer.pathMtu;
+        }
       }
     }
 
@@ -2170,12 +2225,21 @@ void Backend::updateMembersList() {
         entry.ping = vpnManager_->getPeerPing(memberId);
         entry.relay = QString::fromStdString(
             vpnManager_->getPeerConnectionType(memberId));
+        SendRateController::RateInfo rate;
+        if (vpnManager_->getPeerSendRate(memberId, rate)) {
+          entry.sendRate = rate.rateBytesPerSec / 1024;
+          entry.sendCapacity = rate.capacityBytesPerSec / 1024;
+        }
       }
       auto itIp = ipBySteam.find(memberValue);
       if (itIp != ipBySteam.end()) {
         entry.ip =
             QString::fromStdString(SteamVpnBridge::ipToString(itIp->second));
       }
+      auto itMtu = mtuBySteam.find(memberValue);
+      if (itMtu != mtuBySteam.end()) {
+        entry.mtu = itMtu->second;
+      }
       entries.push_back(std::move(entry));
     }
 
@@ -2262,6 +2326,11 @@ void Backend::updateMembersList() {
               steamManager_ ? steamManager_->getHostPing() : -1;
           entry.ping = fallbackPing > 1 ? fallbackPing : -1;
         }
+        SendRateController::RateInfo rate;
+        if (steamManager_->getSendRate(steamManager_->getConnection(), rate)) {
+          entry.sendRate = rate.rateBytesPerSec / 1024;
+          entry.sendCapacity = rate.capacityBytesPerSec / 1024;
+        }
         if (entry.ping >= 0 && entry.ping < 2) {
           entry.ping = -1;
         }
@@ -2289,6 +2358,11 @@ void Backend::updateMembersList() {
             entry.ping = steamManager_->getConnectionPing(conn);
             entry.relay = QString::fromStdString(
                 steamManager_->getConnectionRelayInfo(conn));
+            SendRateController::RateInfo rate;
+            if (steamManager_->getSendRate(conn, rate)) {
+              entry.sendRate = rate.rateBytesPerSec / 1024;
+              entry.sendCapacity = rate.capacityBytesPerSec / 1024;
+            }
             if (entry.ping >= 0) {
               pingBroadcast.emplace_back(memberValue, entry.ping,
                                          entry.relay.toStdString());
@@ -2339,6 +2413,11 @@ void Backend::updateMembersList() {
       const std::string relayInfo = steamManager_->getConnectionRelayInfo(conn);
       entry.relay =
           relayInfo.empty() ? tr("P2P") : QString::fromStdString(relayInfo);
+      SendRateController::RateInfo rate;
+      if (steamManager_->getSendRate(conn, rate)) {
+        entry.sendRate = rate.rateBytesPerSec / 1024;
+        entry.sendCapacity = rate.capacityBytesPerSec / 1024;
+      }
       if (entry.ping >= 0) {
         pingBroadcast.emplace_back(remoteValue, entry.ping, relayInfo);
       }
@@ -34,6 +34,12 @@ QVariant MembersModel::data(const QModelIndex &index, int role) const {
     return entry.isFriend;
   case IsSelfRole:
     return entry.isSelf;
+  case SendRateRole:
+    return entry.sendRate;
+  case SendCapacityRole:
+    return entry.sendCapacity;
+  case MtuRole:
+    return entry.mtu;
   default:
     return {};
   }
@@ -49,6 +55,9 @@ QHash<int, QByteArray> MembersModel::roleNames() const {
   roles[RelayRole] = "relay";
   roles[IsFriendRole] = "isFriend";
   roles[IsSelfRole] = "isSelf";
+  roles[SendRateRole] = "sendRate";
+  roles[SendCapacityRole] = "sendCapacity";
+  roles[MtuRole] = "mtu";
   return roles;
 }
 
@@ -70,7 +79,10 @@ void MembersModel::setMembers(std::vector<Entry> entries) {
         entries[i].relay != entries_[i].relay ||
         entries[i].isFriend != entries_[i].isFriend ||
         entries[i].isSelf != entries_[i].isSelf ||
-        entries[i].ip != entries_[i].ip) {
+        entries[i].ip != entries_[i].ip ||
+        entries[i].sendRate != entries_[i].sendRate ||
+        entries[i].sendCapacity != entries_[i].sendCapacity ||
+        entries[i].mtu != entries_[i].mtu) {
       changed = true;
       break;
     }
@@ -17,7 +17,10 @@ public:
     RelayRole,
     IsFriendRole,
     IsSelfRole,
-    IpRole
+    IpRole,
+    SendRateRole,
+    SendCapacityRole,
+    MtuRole
   };
 
   struct Entry {
@@ -29,6 +32,9 @@ public:
     bool isFriend = false;
     bool isSelf = false;
     QString ip;
+    int sendRate = -1;     // KB/s applied by the send-rate controller
+    int sendCapacity = -1; // KB/s estimated path capacity
+    int mtu = -1;          // virtual network path MTU to this member
   };
 
   explicit MembersModel(QObject *parent = nullptr);
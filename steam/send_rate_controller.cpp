@@ -0,0 +1,136 @@
+#include "send_rate_controller.h"
+#include <algorithm>
+#include <iostream>
+#include <isteamnetworkingutils.h>
+#include <set>
+
+namespace {
+// Steam's send buffer holding no more than this is draining: its queue
+// time is then the path's own, fit to serve as the base.
+constexpr int kDrainedPendingBytes = 4 * 1200;
+// Less than one packet waiting: the sender is app-limited, and what it
+// delivers says nothing about what the path could carry.
+constexpr int kAppLimitedPendingBytes = 1200;
+} // namespace
+
+SendRateController::SendRateController(ISteamNetworkingSockets *sockets)
+    : sockets_(sockets) {}
+
+void SendRateController::sync(
+    const std::vector<HSteamNetConnection> &connections) {
+  if (!sockets_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  const std::set<HSteamNetConnection> wanted(connections.begin(),
+                                             connections.end());
+  for (auto it = states_.begin(); it != states_.end();) {
+    if (wanted.find(it->first) == wanted.end()) {
+      it = states_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto conn : wanted) {
+    if (conn == k_HSteamNetConnection_Invalid ||
+        states_.find(conn) != states_.end()) {
+      continue;
+    }
+    State &state = states_[conn];
+    apply(conn, state, kInitialRate);
+  }
+}
+
+void SendRateController::update() {
+  if (!sockets_) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (now - lastUpdate_ < std::chrono::milliseconds(200)) {
+    return;
+  }
+  lastUpdate_ = now;
+
+  for (auto &entry : states_) {
+    const HSteamNetConnection conn = entry.first;
+    State &state = entry.second;
+    SteamNetConnectionRealTimeStatus_t status;
+    if (sockets_->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) !=
+            k_EResultOK ||
+        status.m_eState != k_ESteamNetworkingConnectionState_Connected) {
+      continue;
+    }
+
+    const int queueUs = static_cast<int>(status.m_usecQueueTime);
+    const int pending =
+        status.m_cbPendingReliable + status.m_cbPendingUnreliable;
+    state.info.queueTimeUs = queueUs;
+    // Track the uncongested queue time over a sliding 10s window. A lower
+    // sample always counts; once the window is up the base is only renewed
+    // from a draining queue, so a standing one cannot become the baseline.
+    if (state.baseQueueUs < 0 || queueUs < state.baseQueueUs ||
+        (now - state.baseQueueSince > std::chrono::seconds(10) &&
+         pending <= kDrainedPendingBytes)) {
+      state.baseQueueUs = queueUs;
+      state.baseQueueSince = now;
+    }
+
+    const int rate = state.info.rateBytesPerSec;
+    const int delivered = static_cast<int>(status.m_flOutBytesPerSec);
+    const bool lossy = status.m_flConnectionQualityRemote >= 0.0f &&
+                       status.m_flConnectionQualityRemote < 0.97f;
+    const bool queueGrowing = queueUs > state.baseQueueUs + 30000;
+    const bool demand = pending > 0 || delivered > rate * 8 / 10;
+    const bool appLimited = pending < kAppLimitedPendingBytes;
+
+    if (lossy || queueGrowing) {
+      // An app-limited sender only delivers its own load; capping at that
+      // would drag the rate down to the current traffic.
+      if (delivered > 0 && !appLimited) {
+        state.info.capacityBytesPerSec = delivered;
+      }
+      int next = rate * 8 / 10;
+      if (state.info.capacityBytesPerSec > 0) {
+        next = std::min(next, state.info.capacityBytesPerSec * 95 / 100);
+      }
+      next = std::max(next, kMinRate);
+      if (next < rate) {
+        std::cout << "[SteamNet] Send rate backoff on " << conn << ": "
+                  << rate / 1024 << " -> " << next / 1024
+                  << " KB/s (queue=" << queueUs / 1000 << "ms, quality="
+                  << status.m_flConnectionQualityRemote << ")" << std::endl;
+        apply(conn, state, next);
+      }
+    } else if (demand) {
+      state.info.capacityBytesPerSec =
+          std::max(state.info.capacityBytesPerSec, delivered);
+      const int next = std::min(kMaxRate, rate + rate / 4);
+      if (next > rate) {
+        apply(conn, state, next);
+      }
+    }
+  }
+}
+
+bool SendRateController::getRate(HSteamNetConnection conn,
+                                 RateInfo &out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = states_.find(conn);
+  if (it == states_.end()) {
+    return false;
+  }
+  out = it->second.info;
+  return true;
+}
+
+void SendRateController::apply(HSteamNetConnection conn, State &state,
+                               int rate) {
+  if (SteamNetworkingUtils()) {
+    SteamNetworkingUtils()->SetConnectionConfigValueInt32(
+        conn, k_ESteamNetworkingConfig_SendRateMin, rate);
+    SteamNetworkingUtils()->SetConnectionConfigValueInt32(
+        conn, k_ESteamNetworkingConfig_SendRateMax, rate);
+  }
+  state.info.rateBytesPerSec = rate;
+}
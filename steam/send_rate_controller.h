@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <isteamnetworkingsockets.h>
+#include <map>
+#include <mutex>
+#include <steamnetworkingtypes.h>
+#include <vector>
+
+// Per-connection send-rate controller. Probes the rate up while there is
+// demand and backs off when queue time grows or the remote reports loss,
+// pinning SendRateMin/Max on each connection to the chosen value.
+class SendRateController {
+public:
+  struct RateInfo {
+    int rateBytesPerSec = 0;     // rate currently applied to the connection
+    int capacityBytesPerSec = 0; // best delivered rate seen without congestion
+    int queueTimeUs = 0;
+  };
+
+  static constexpr int kInitialRate = 1024 * 1024;
+  static constexpr int kMinRate = 128 * 1024;
+  static constexpr int kMaxRate = 32 * 1024 * 1024;
+
+  explicit SendRateController(ISteamNetworkingSockets *sockets);
+
+  // Track exactly these connections; new ones start at kInitialRate.
+  void sync(const std::vector<HSteamNetConnection> &connections);
+  void update();
+  bool getRate(HSteamNetConnection conn, RateInfo &out) const;
+
+private:
+  struct State {
+    RateInfo info;
+    int baseQueueUs = -1;
+    std::chrono::steady_clock::time_point baseQueueSince;
+  };
+
+  void apply(HSteamNetConnection conn, State &state, int rate);
+
+  ISteamNetworkingSockets *sockets_;
+  std::map<HSteamNetConnection, State> states_;
+  mutable std::mutex mutex_;
+  std::chrono::steady_clock::time_point lastUpdate_;
+};
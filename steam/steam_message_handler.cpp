@@ -35,6 +35,7 @@ void SteamMessageHandler::stop() {
 
 std::shared_ptr<MultiplexManager>
 SteamMessageHandler::getMultiplexManager(HSteamNetConnection conn) {
+  std::lock_guard<std::mutex> lock(multiplexManagersMutex_);
   if (multiplexManagers_.find(conn) == multiplexManagers_.end()) {
     multiplexManagers_[conn] = std::make_shared<MultiplexManager>(
         m_pInterface_, conn, io_context_, g_isHost_, localPort_);
@@ -42,6 +43,12 @@ SteamMessageHandler::getMultiplexManager(HSteamNetConnection conn) {
   return multiplexManagers_[conn];
 }
 
+size_t SteamMessageHandler::tunnelCount(HSteamNetConnection conn) {
+  std::lock_guard<std::mutex> lock(multiplexManagersMutex_);
+  auto it = multiplexManagers_.find(conn);
+  return it != multiplexManagers_.end() ? it->second->clientCount() : 0;
+}
+
 void SteamMessageHandler::startAsyncPoll() {
   if (!running_)
     return;
@@ -61,16 +68,16 @@ void SteamMessageHandler::startAsyncPoll() {
     int numMsgs =
         m_pInterface_->ReceiveMessagesOnConnection(conn, pIncomingMsgs, 256);
     totalMessages += numMsgs;
+    std::shared_ptr<MultiplexManager> multiplexManager;
+    if (numMsgs > 0) {
+      multiplexManager = getMultiplexManager(conn);
+    }
     for (int i = 0; i < numMsgs; ++i) {
       ISteamNetworkingMessage *pIncomingMsg = pIncomingMsgs[i];
       const char *data = (const char *)pIncomingMsg->m_pData;
       size_t size = pIncomingMsg->m_cbSize;
       // Handle tunnel packets with multiplexing
-      if (multiplexManagers_.find(conn) == multiplexManagers_.end()) {
-        multiplexManagers_[conn] = std::make_shared<MultiplexManager>(
-            m_pInterface_, conn, io_context_, g_isHost_, localPort_);
-      }
-      multiplexManagers_[conn]->handleTunnelPacket(data, size);
+      multiplexManager->handleTunnelPacket(data, size);
       pIncomingMsg->Release();
     }
   }
@@ -25,6 +25,8 @@ public:
 
   std::shared_ptr<MultiplexManager>
   getMultiplexManager(HSteamNetConnection conn);
+  // Tunnels open on conn, without creating a manager for it.
+  size_t tunnelCount(HSteamNetConnection conn);
 
 private:
   void startAsyncPoll();
@@ -38,6 +40,7 @@ private:
 
   std::map<HSteamNetConnection, std::shared_ptr<MultiplexManager>>
       multiplexManagers_;
+  std::mutex multiplexManagersMutex_;
 
   std::unique_ptr<boost::asio::steady_timer> timer_;
   bool running_;
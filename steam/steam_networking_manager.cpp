@@ -18,6 +18,7 @@ void SteamNetworkingManager::OnSteamNetConnectionStatusChanged(
 
 SteamNetworkingManager::SteamNetworkingManager()
     : m_pInterface(nullptr), hListenSock(k_HSteamListenSocket_Invalid),
+      hRaceListenSock(k_HSteamListenSocket_Invalid),
       g_isHost(false), g_isClient(false), g_isConnected(false),
       g_hConnection(k_HSteamNetConnection_Invalid), g_hostSteamID(),
       hostPing_(0), g_retryCount(0), g_currentVirtualPort(0),
@@ -71,8 +72,9 @@ bool SteamNetworkingManager::initialize() {
       k_ESteamNetworkingConfig_Global, 0, k_ESteamNetworkingConfig_Int32,
       &recvBufferMsgs);
 
-  // Cap send rate to a conservative value to keep reliable window stable
-  int32 sendRate = 1024 * 1024; // ~1000 KB/s
+  // Starting send rate for new connections; SendRateController then adapts
+  // each connection to its measured capacity.
+  int32 sendRate = SendRateController::kInitialRate;
   SteamNetworkingUtils()->SetConfigValue(
       k_ESteamNetworkingConfig_SendRateMin, k_ESteamNetworkingConfig_Global, 0,
       k_ESteamNetworkingConfig_Int32, &sendRate);
@@ -137,6 +139,7 @@ bool SteamNetworkingManager::initialize() {
       OnSteamNetConnectionStatusChanged);
 
   m_pInterface = SteamNetworkingSockets();
+  rateController_ = std::make_unique<SendRateController>(m_pInterface);
 
   // Check if callbacks are registered
   std::cout << "Steam Networking Manager initialized successfully" << std::endl;
@@ -151,6 +154,9 @@ void SteamNetworkingManager::shutdown() {
   if (hListenSock != k_HSteamListenSocket_Invalid) {
     m_pInterface->CloseListenSocket(hListenSock);
   }
+  if (hRaceListenSock != k_HSteamListenSocket_Invalid) {
+    m_pInterface->CloseListenSocket(hRaceListenSock);
+  }
   SteamAPI_Shutdown();
 }
 
@@ -175,12 +181,35 @@ bool SteamNetworkingManager::connectToHostInternal(
     }
   }
 
+  g_hConnection = openConnection(hostSteamID, 0, relayOnly);
+  if (g_hConnection != k_HSteamNetConnection_Invalid) {
+    connectAttemptStart_ = std::chrono::steady_clock::now();
+    return true;
+  }
+  return false;
+}
+
+HSteamNetConnection
+SteamNetworkingManager::openConnection(const CSteamID &hostSteamID,
+                                       int virtualPort, bool relayOnly) {
   SteamNetworkingIdentity identity;
   identity.SetSteamID(hostSteamID);
 
   SteamNetworkingConfigValue_t options[2];
   int optionCount = 0;
 
+  // SDRClient_ForceRelayCluster only exists as a global value: whatever is
+  // set applies to every connection's relay selection, including the SDR
+  // fallback of an ICE attempt racing this one. It is set for the planned
+  // relay-only dial alone, and lifted once that dial connects or fails.
+  const SteamNetworkingPOPID forcedPop =
+      relayOnly && SteamNetworkingUtils() ? plannedRelayPop_ : 0;
+  if (forcedPop != 0) {
+    setForcedRelayCluster(forcedPop);
+    std::cout << "[SteamNet] Forcing relay cluster "
+              << popIdToString(forcedPop) << std::endl;
+  }
+
   if (relayOnly) {
     int32 disableIce = 0;
     options[optionCount].SetInt32(
@@ -193,18 +222,27 @@ bool SteamNetworkingManager::connectToHostInternal(
     ++optionCount;
   }
 
-  g_hConnection = m_pInterface->ConnectP2P(
-      identity, 0, optionCount, optionCount > 0 ? options : nullptr);
+  const HSteamNetConnection conn = m_pInterface->ConnectP2P(
+      identity, virtualPort, optionCount, optionCount > 0 ? options : nullptr);
+  if (forcedPop != 0) {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (conn != k_HSteamNetConnection_Invalid) {
+      forcedRelayConn_ = conn;
+      forcedRelayPop_ = forcedPop;
+    } else if (forcedRelayConn_ == k_HSteamNetConnection_Invalid) {
+      setForcedRelayCluster(0);
+    }
+  }
 
-  if (g_hConnection != k_HSteamNetConnection_Invalid) {
-    connectAttemptStart_ = std::chrono::steady_clock::now();
+  if (conn != k_HSteamNetConnection_Invalid) {
     std::cout << "Attempting to connect to host "
-              << hostSteamID.ConvertToUint64() << " with virtual port " << 0;
+              << hostSteamID.ConvertToUint64() << " with virtual port "
+              << virtualPort;
     if (relayOnly) {
       std::cout << " (relay only)";
     }
     std::cout << std::endl;
-    return true;
+    return conn;
   }
 
   std::cerr << "Failed to initiate connection";
@@ -212,7 +250,241 @@ bool SteamNetworkingManager::connectToHostInternal(
     std::cerr << " via relay";
   }
   std::cerr << std::endl;
-  return false;
+  return k_HSteamNetConnection_Invalid;
+}
+
+void SteamNetworkingManager::startRelayRace(const CSteamID &hostSteamID) {
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    raceActive_ = true;
+    raceIceConn_ = g_hConnection;
+    raceStart_ = std::chrono::steady_clock::now();
+    raceIceReady_ = {};
+    raceRelayReady_ = {};
+    // The relay path is already being tried; keep the slow-ICE fallback in
+    // update() out of the way until the race settles.
+    relayFallbackTried_ = true;
+  }
+
+  const HSteamNetConnection relayConn =
+      openConnection(hostSteamID, RELAY_RACE_VIRTUAL_PORT, true);
+
+  std::lock_guard<std::mutex> lock(connectionsMutex);
+  if (!raceActive_) {
+    // The ICE attempt failed while we were dialing.
+    if (relayConn != k_HSteamNetConnection_Invalid) {
+      m_pInterface->CloseConnection(relayConn, 0, "Race abandoned", false);
+    }
+    return;
+  }
+  if (relayConn == k_HSteamNetConnection_Invalid) {
+    resetRaceLocked();
+    relayFallbackTried_ = false;
+    return;
+  }
+  raceRelayConn_ = relayConn;
+}
+
+bool SteamNetworkingManager::isRaceContender(HSteamNetConnection conn) const {
+  return raceActive_ && conn != k_HSteamNetConnection_Invalid &&
+         (conn == raceIceConn_ || conn == raceRelayConn_);
+}
+
+void SteamNetworkingManager::onRaceContenderConnected(HSteamNetConnection conn) {
+  const auto now = std::chrono::steady_clock::now();
+  const bool relay = conn == raceRelayConn_;
+  const bool first = raceIceReady_.time_since_epoch().count() == 0 &&
+                     raceRelayReady_.time_since_epoch().count() == 0;
+  (relay ? raceRelayReady_ : raceIceReady_) = now;
+
+  int ping = -1;
+  SteamNetConnectionRealTimeStatus_t status;
+  if (m_pInterface->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) ==
+      k_EResultOK) {
+    ping = status.m_nPing;
+  }
+  std::cout << "[SteamNet] Race: " << (relay ? "relay" : "ICE")
+            << " path ready, time-to-first-byte="
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   now - raceStart_)
+                   .count()
+            << "ms, ping=" << ping << "ms" << std::endl;
+
+  if (first) {
+    if (g_hConnection != conn) {
+      std::cout << "[SteamNet] Race: using " << (relay ? "relay" : "ICE")
+                << " path first" << std::endl;
+    }
+    g_hConnection = conn;
+    g_isConnected = true;
+    if (ping >= 0) {
+      hostPing_ = ping;
+    }
+  }
+}
+
+void SteamNetworkingManager::onRaceContenderLost(HSteamNetConnection conn) {
+  const bool relay = conn == raceRelayConn_;
+  std::cout << "[SteamNet] Race: " << (relay ? "relay" : "ICE")
+            << " attempt lost" << std::endl;
+  m_pInterface->CloseConnection(conn, 0, nullptr, false);
+  auto it = std::find(connections.begin(), connections.end(), conn);
+  if (it != connections.end()) {
+    connections.erase(it);
+  }
+  (relay ? raceRelayConn_ : raceIceConn_) = k_HSteamNetConnection_Invalid;
+  (relay ? raceRelayReady_ : raceIceReady_) = {};
+
+  const HSteamNetConnection survivor = relay ? raceIceConn_ : raceRelayConn_;
+  if (g_hConnection == conn) {
+    g_hConnection = survivor;
+    g_isConnected = survivor != k_HSteamNetConnection_Invalid;
+    hostPing_ = 0;
+  }
+  if (survivor != k_HSteamNetConnection_Invalid) {
+    return;
+  }
+
+  // Both attempts are gone; hand over to the regular relay-only retry on the
+  // default port (older hosts do not listen on the race port).
+  resetRaceLocked();
+  if (joinedFromCache_ && g_hostSteamID.IsValid()) {
+    transportCache_.invalidate(g_hostSteamID.ConvertToUint64());
+    joinedFromCache_ = false;
+  }
+  connectAttemptStart_ = {};
+  if (g_isClient && g_hostSteamID.IsValid()) {
+    relayFallbackTried_ = false;
+    relayFallbackPending_ = true;
+  }
+}
+
+void SteamNetworkingManager::updateRaceLocked(
+    std::chrono::steady_clock::time_point now,
+    std::vector<HSteamNetConnection> &toClose) {
+  if (drainingConn_ != k_HSteamNetConnection_Invalid) {
+    // Tunnels opened before the migration stay on this connection until
+    // they close, however quiet they are.
+    SteamNetConnectionRealTimeStatus_t status;
+    const bool idle =
+        (!messageHandler_ || messageHandler_->tunnelCount(drainingConn_) == 0) &&
+        (m_pInterface->GetConnectionRealTimeStatus(drainingConn_, &status, 0,
+                                                   nullptr) != k_EResultOK ||
+         status.m_flInBytesPerSec + status.m_flOutBytesPerSec < 256.0f);
+    if (!idle) {
+      drainingIdleSince_ = {};
+    } else if (drainingIdleSince_.time_since_epoch().count() == 0) {
+      drainingIdleSince_ = now;
+    } else if (now - drainingIdleSince_ > std::chrono::seconds(10)) {
+      std::cout << "[SteamNet] Closing drained connection " << drainingConn_
+                << std::endl;
+      toClose.push_back(drainingConn_);
+      auto it = std::find(connections.begin(), connections.end(), drainingConn_);
+      if (it != connections.end()) {
+        connections.erase(it);
+      }
+      drainingConn_ = k_HSteamNetConnection_Invalid;
+      drainingIdleSince_ = {};
+    }
+  }
+
+  if (!raceActive_) {
+    return;
+  }
+  const bool iceReady = raceIceReady_.time_since_epoch().count() != 0;
+  const bool relayReady = raceRelayReady_.time_since_epoch().count() != 0;
+  if (!iceReady && !relayReady) {
+    return;
+  }
+  const auto firstReady = !iceReady    ? raceRelayReady_
+                          : !relayReady ? raceIceReady_
+                                        : std::min(raceIceReady_, raceRelayReady_);
+  const auto lastReady = std::max(raceIceReady_, raceRelayReady_);
+  // Let both pings settle for a couple of seconds; give the slower attempt at
+  // most 10s after the first one connected.
+  const bool settled = (iceReady && relayReady &&
+                        now - lastReady > std::chrono::seconds(2)) ||
+                       now - firstReady > std::chrono::seconds(10);
+  if (!settled) {
+    return;
+  }
+
+  const int icePing = iceReady ? getConnectionPing(raceIceConn_) : -1;
+  const int relayPing = relayReady ? getConnectionPing(raceRelayConn_) : -1;
+  HSteamNetConnection chosen = raceIceConn_;
+  if (!iceReady || (relayReady && relayPing > 0 && icePing > 0 &&
+                    relayPing + 15 < icePing)) {
+    chosen = raceRelayConn_;
+  }
+  const HSteamNetConnection loser =
+      chosen == raceIceConn_ ? raceRelayConn_ : raceIceConn_;
+  const bool chosenRelay = chosen == raceRelayConn_;
+  std::cout << "[SteamNet] Race settled: ICE=" << icePing
+            << "ms, relay=" << relayPing << "ms, using "
+            << (chosenRelay ? "relay" : "ICE") << std::endl;
+
+  if (chosen != g_hConnection) {
+    // New streams go to the better path; the old one drains first.
+    std::cout << "[SteamNet] Migrating to " << (chosenRelay ? "relay" : "ICE")
+              << " path" << std::endl;
+    drainingConn_ = g_hConnection;
+    drainingIdleSince_ = {};
+    g_hConnection = chosen;
+    hostPing_ = chosenRelay ? relayPing : icePing;
+  } else if (loser != k_HSteamNetConnection_Invalid) {
+    toClose.push_back(loser);
+    auto it = std::find(connections.begin(), connections.end(), loser);
+    if (it != connections.end()) {
+      connections.erase(it);
+    }
+  }
+
+  resetRaceLocked();
+  // Quality-based relay fallback stays available when ICE won.
+  relayFallbackTried_ = chosenRelay;
+  consecutiveBadIceSamples_ = 0;
+  lastIceTimeout_ = {};
+}
+
+void SteamNetworkingManager::resetRaceLocked() {
+  raceActive_ = false;
+  raceIceConn_ = k_HSteamNetConnection_Invalid;
+  raceRelayConn_ = k_HSteamNetConnection_Invalid;
+  raceStart_ = {};
+  raceIceReady_ = {};
+  raceRelayReady_ = {};
+}
+
+void SteamNetworkingManager::releaseForcedRelayClusterLocked(bool connected) {
+  if (forcedRelayConn_ == k_HSteamNetConnection_Invalid) {
+    return;
+  }
+  SteamNetConnectionInfo_t info;
+  if (connected && m_pInterface &&
+      m_pInterface->GetConnectionInfo(forcedRelayConn_, &info)) {
+    if (info.m_idPOPRelay == forcedRelayPop_) {
+      std::cout << "[SteamNet] Relay cluster " << popIdToString(forcedRelayPop_)
+                << " in use" << std::endl;
+    } else {
+      std::cout << "[SteamNet] Relay cluster " << popIdToString(forcedRelayPop_)
+                << " was forced, but SDR chose "
+                << popIdToString(info.m_idPOPRelay) << std::endl;
+    }
+  }
+  setForcedRelayCluster(0);
+  forcedRelayConn_ = k_HSteamNetConnection_Invalid;
+  forcedRelayPop_ = 0;
+}
+
+void SteamNetworkingManager::setForcedRelayCluster(SteamNetworkingPOPID pop) {
+  if (!SteamNetworkingUtils()) {
+    return;
+  }
+  const std::string cluster = pop != 0 ? popIdToString(pop) : std::string();
+  SteamNetworkingUtils()->SetConfigValue(
+      k_ESteamNetworkingConfig_SDRClient_ForceRelayCluster,
+      k_ESteamNetworkingConfig_Global, 0, k_ESteamNetworkingConfig_String,
+      cluster.c_str());
 }
 
 bool SteamNetworkingManager::joinHost(uint64 hostID) {
@@ -223,8 +495,43 @@ bool SteamNetworkingManager::joinHost(uint64 hostID) {
   relayFallbackTried_ = false;
   consecutiveBadIceSamples_ = 0;
   lastIceTimeout_ = {};
+  {
+    // Drop leftovers from a previous race; g_hConnection is closed by
+    // connectToHostInternal.
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (auto conn : {raceIceConn_, raceRelayConn_, drainingConn_}) {
+      if (conn != k_HSteamNetConnection_Invalid && conn != g_hConnection) {
+        m_pInterface->CloseConnection(conn, 0, "Rejoining host", false);
+        connections.erase(
+            std::remove(connections.begin(), connections.end(), conn),
+            connections.end());
+      }
+    }
+    resetRaceLocked();
+    drainingConn_ = k_HSteamNetConnection_Invalid;
+  }
+
+  TransportCache::Entry cached;
+  joinedFromCache_ = transportCache_.lookup(hostID, cached);
+  retryWithoutCache_ = false;
+  if (joinedFromCache_) {
+    std::cout << "[SteamNet] Cached transport for host: "
+              << (cached.relay ? "relay" : "ICE") << ", rtt=" << cached.rttMs
+              << "ms, pop=" << cached.popId << std::endl;
+    if (cached.relay) {
+      // ICE did not work to this host last time; skip straight to relay.
+      applyTransportPreference(-1, cached.rttMs);
+      relayFallbackTried_ = true;
+      return connectToHostInternal(hostSteamID, true);
+    }
+    applyTransportPreference(cached.rttMs, -1);
+  }
 
-  return connectToHostInternal(hostSteamID, false);
+  if (!connectToHostInternal(hostSteamID, false)) {
+    return false;
+  }
+  startRelayRace(hostSteamID);
+  return true;
 }
 
 void SteamNetworkingManager::disconnect() {
@@ -242,12 +549,18 @@ void SteamNetworkingManager::disconnect() {
     m_pInterface->CloseConnection(conn, 0, nullptr, false);
   }
   connections.clear();
+  resetRaceLocked();
+  drainingConn_ = k_HSteamNetConnection_Invalid;
 
   // Close listen socket
   if (hListenSock != k_HSteamListenSocket_Invalid) {
     m_pInterface->CloseListenSocket(hListenSock);
     hListenSock = k_HSteamListenSocket_Invalid;
   }
+  if (hRaceListenSock != k_HSteamListenSocket_Invalid) {
+    m_pInterface->CloseListenSocket(hRaceListenSock);
+    hRaceListenSock = k_HSteamListenSocket_Invalid;
+  }
 
   // Reset state
   g_isHost = false;
@@ -259,6 +572,14 @@ void SteamNetworkingManager::disconnect() {
   consecutiveBadIceSamples_ = 0;
   lastRelayFallback_ = {};
   lastIceTimeout_ = {};
+  joinedFromCache_ = false;
+  retryWithoutCache_ = false;
+  predictedDirectMs_ = -1;
+  predictedRelayMs_ = -1;
+  plannedRelayPop_ = 0;
+  releaseForcedRelayClusterLocked(false);
+  cacheCandidateConn_ = k_HSteamNetConnection_Invalid;
+  cacheRecordedConn_ = k_HSteamNetConnection_Invalid;
 
   std::cout << "Disconnected from network" << std::endl;
 }
@@ -296,6 +617,10 @@ void SteamNetworkingManager::closeConnectionToPeer(const CSteamID &peer) {
     }
     ++it;
   }
+  if (peer == g_hostSteamID) {
+    resetRaceLocked();
+    drainingConn_ = k_HSteamNetConnection_Invalid;
+  }
 }
 
 void SteamNetworkingManager::setMessageHandlerDependencies(
@@ -324,8 +649,10 @@ void SteamNetworkingManager::stopMessageHandler() {
 
 void SteamNetworkingManager::update() {
   bool shouldRetryRelay = false;
+  bool shouldRejoin = false;
   CSteamID retryTarget;
   HSteamNetConnection connectionToClose = k_HSteamNetConnection_Invalid;
+  std::vector<HSteamNetConnection> raceClosed;
 
   {
     std::lock_guard<std::mutex> lock(connectionsMutex);
@@ -413,6 +740,78 @@ void SteamNetworkingManager::update() {
       }
     }
 
+    updateRaceLocked(std::chrono::steady_clock::now(), raceClosed);
+
+    // Catches a forced dial that was closed locally, or that settled before
+    // openConnection() recorded it.
+    if (forcedRelayConn_ != k_HSteamNetConnection_Invalid) {
+      SteamNetConnectionRealTimeStatus_t status;
+      if (m_pInterface->GetConnectionRealTimeStatus(forcedRelayConn_, &status,
+                                                    0, nullptr) !=
+          k_EResultOK) {
+        releaseForcedRelayClusterLocked(false);
+      } else if (status.m_eState ==
+                 k_ESteamNetworkingConnectionState_Connected) {
+        releaseForcedRelayClusterLocked(true);
+      } else if (status.m_eState ==
+                     k_ESteamNetworkingConnectionState_ClosedByPeer ||
+                 status.m_eState ==
+                     k_ESteamNetworkingConnectionState_ProblemDetectedLocally) {
+        releaseForcedRelayClusterLocked(false);
+      }
+    }
+
+    if (g_isClient && !raceActive_ &&
+        g_hConnection != k_HSteamNetConnection_Invalid &&
+        g_hConnection != cacheRecordedConn_) {
+      SteamNetConnectionRealTimeStatus_t status;
+      SteamNetConnectionInfo_t info;
+      const auto now = std::chrono::steady_clock::now();
+      if (m_pInterface->GetConnectionRealTimeStatus(g_hConnection, &status, 0,
+                                                    nullptr) == k_EResultOK &&
+          status.m_eState == k_ESteamNetworkingConnectionState_Connected) {
+        if (cacheCandidateConn_ != g_hConnection) {
+          cacheCandidateConn_ = g_hConnection;
+          cacheCandidateSince_ = now;
+        } else if (now - cacheCandidateSince_ > std::chrono::seconds(5) &&
+                   status.m_nPing > 0 &&
+                   m_pInterface->GetConnectionInfo(g_hConnection, &info)) {
+          TransportCache::Entry entry;
+          entry.relay =
+              (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed) != 0;
+          entry.rttMs = status.m_nPing;
+          entry.popId = info.m_idPOPRelay;
+          entry.quality = status.m_flConnectionQualityLocal;
+          transportCache_.record(g_hostSteamID.ConvertToUint64(), entry);
+          cacheRecordedConn_ = g_hConnection;
+          std::cout << "[SteamNet] Cached transport for "
+                    << g_hostSteamID.ConvertToUint64() << ": "
+                    << (entry.relay ? "relay" : "ICE") << ", rtt="
+                    << entry.rttMs << "ms" << std::endl;
+          if (entry.relay) {
+            std::cout << "[SteamNet] Relay RTT predicted=" << predictedRelayMs_
+                      << "ms via " << popIdToString(plannedRelayPop_)
+                      << ", achieved=" << entry.rttMs << "ms via "
+                      << popIdToString(entry.popId);
+            if (plannedRelayPop_ != 0 && entry.popId != plannedRelayPop_) {
+              std::cout << " (not the planned relay)";
+            }
+            std::cout << std::endl;
+          } else {
+            std::cout << "[SteamNet] Direct RTT predicted="
+                      << predictedDirectMs_ << "ms, achieved=" << entry.rttMs
+                      << "ms" << std::endl;
+          }
+        }
+      }
+    }
+
+    if (retryWithoutCache_ && g_isClient && g_hostSteamID.IsValid()) {
+      retryWithoutCache_ = false;
+      shouldRejoin = true;
+      retryTarget = g_hostSteamID;
+    }
+
     if (relayFallbackPending_ && !relayFallbackTried_ && g_isClient &&
         g_hostSteamID.IsValid()) {
       // Tear down the stuck ICE attempt so we can try relay-only immediately.
@@ -434,22 +833,55 @@ void SteamNetworkingManager::update() {
     m_pInterface->CloseConnection(
         connectionToClose, 0, "Retry via relay after ICE stall", false);
   }
+  for (auto conn : raceClosed) {
+    m_pInterface->CloseConnection(conn, 0, "Lost connect race", false);
+  }
+
+  if (rateController_) {
+    std::vector<HSteamNetConnection> tracked;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex);
+      tracked = connections;
+      if (g_hConnection != k_HSteamNetConnection_Invalid) {
+        tracked.push_back(g_hConnection);
+      }
+    }
+    rateController_->sync(tracked);
+    rateController_->update();
+  }
+
+  if (shouldRejoin) {
+    std::cout << "[SteamNet] Cached transport failed, rejoining from scratch"
+              << std::endl;
+    joinHost(retryTarget.ConvertToUint64());
+    return;
+  }
 
   if (shouldRetryRelay) {
     std::cout << "[SteamNet] ICE failed, retrying via relay only"
               << std::endl;
+    if (joinedFromCache_) {
+      transportCache_.invalidate(retryTarget.ConvertToUint64());
+      joinedFromCache_ = false;
+    }
     connectToHostInternal(retryTarget, true);
   }
 }
 
 int SteamNetworkingManager::getConnectionPing(HSteamNetConnection conn) const {
   SteamNetConnectionRealTimeStatus_t status;
-  if (m_pInterface->GetConnectionRealTimeStatus(conn, &status, 0, nullptr)) {
+  if (m_pInterface->GetConnectionRealTimeStatus(conn, &status, 0, nullptr) ==
+      k_EResultOK) {
     return status.m_nPing;
   }
   return 0;
 }
 
+bool SteamNetworkingManager::getSendRate(
+    HSteamNetConnection conn, SendRateController::RateInfo &out) const {
+  return rateController_ && rateController_->getRate(conn, out);
+}
+
 std::string
 SteamNetworkingManager::getConnectionRelayInfo(HSteamNetConnection conn) const {
   SteamNetConnectionInfo_t info;
@@ -490,6 +922,106 @@ int SteamNetworkingManager::estimateRelayPingMs() const {
   return best * 2;
 }
 
+std::string
+SteamNetworkingManager::describeLocalPopPings(int maxEntries) const {
+  if (!SteamNetworkingUtils()) {
+    return {};
+  }
+  const int popCount = SteamNetworkingUtils()->GetPOPCount();
+  if (popCount <= 0) {
+    return {};
+  }
+  std::vector<SteamNetworkingPOPID> pops(popCount);
+  const int filled = SteamNetworkingUtils()->GetPOPList(pops.data(), popCount);
+  std::vector<std::pair<int, SteamNetworkingPOPID>> pings;
+  for (int i = 0; i < filled; ++i) {
+    SteamNetworkingPOPID via = 0;
+    const int ping = SteamNetworkingUtils()->GetPingToDataCenter(pops[i], &via);
+    if (ping >= 0) {
+      pings.emplace_back(ping, pops[i]);
+    }
+  }
+  std::sort(pings.begin(), pings.end());
+  if (static_cast<int>(pings.size()) > maxEntries) {
+    pings.resize(maxEntries);
+  }
+  std::string out;
+  for (const auto &entry : pings) {
+    if (!out.empty()) {
+      out.push_back(',');
+    }
+    out += std::to_string(entry.second);
+    out.push_back(':');
+    out += std::to_string(entry.first);
+  }
+  return out;
+}
+
+int SteamNetworkingManager::planRelay(const std::string &remotePopPings,
+                                      SteamNetworkingPOPID &bestPop) const {
+  bestPop = 0;
+  if (!SteamNetworkingUtils()) {
+    return -1;
+  }
+  int best = std::numeric_limits<int>::max();
+  size_t pos = 0;
+  while (pos < remotePopPings.size()) {
+    size_t end = remotePopPings.find(',', pos);
+    if (end == std::string::npos) {
+      end = remotePopPings.size();
+    }
+    const std::string item = remotePopPings.substr(pos, end - pos);
+    pos = end + 1;
+    const size_t colon = item.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    try {
+      const auto pop = static_cast<SteamNetworkingPOPID>(
+          std::stoul(item.substr(0, colon)));
+      const int remotePing = std::stoi(item.substr(colon + 1));
+      SteamNetworkingPOPID via = 0;
+      const int localPing = SteamNetworkingUtils()->GetPingToDataCenter(pop, &via);
+      if (localPing < 0 || remotePing < 0) {
+        continue;
+      }
+      if (localPing + remotePing < best) {
+        best = localPing + remotePing;
+        bestPop = pop;
+      }
+    } catch (...) {
+      continue;
+    }
+  }
+  return best == std::numeric_limits<int>::max() ? -1 : best;
+}
+
+void SteamNetworkingManager::setTransportPlan(int predictedDirectMs,
+                                              int predictedRelayMs,
+                                              SteamNetworkingPOPID relayPop) {
+  predictedDirectMs_ = predictedDirectMs;
+  predictedRelayMs_ = predictedRelayMs;
+  plannedRelayPop_ = relayPop;
+  std::cout << "[SteamNet] Transport plan: direct≈" << predictedDirectMs
+            << "ms, relay≈" << predictedRelayMs << "ms via "
+            << (relayPop != 0 ? popIdToString(relayPop) : std::string("auto"))
+            << std::endl;
+}
+
+std::string SteamNetworkingManager::popIdToString(SteamNetworkingPOPID pop) {
+  if (pop == 0) {
+    return "-";
+  }
+  // Same packing as the SDK's GetSteamNetworkingLocationPOPStringFromID.
+  char code[5];
+  code[0] = static_cast<char>(pop >> 16);
+  code[1] = static_cast<char>(pop >> 8);
+  code[2] = static_cast<char>(pop);
+  code[3] = static_cast<char>(pop >> 24);
+  code[4] = '\0';
+  return code;
+}
+
 void SteamNetworkingManager::applyTransportPreference(int directPingMs,
                                                       int relayPingMs) {
   if (!SteamNetworkingUtils()) {
@@ -534,8 +1066,25 @@ void SteamNetworkingManager::handleConnectionStatusChanged(
     std::lock_guard<std::mutex> lock(connectionsMutex);
     std::cout << "Connection status changed: " << pInfo->m_info.m_eState
               << " for connection " << pInfo->m_hConn << std::endl;
+    if (pInfo->m_hConn == forcedRelayConn_) {
+      const ESteamNetworkingConnectionState state = pInfo->m_info.m_eState;
+      if (state == k_ESteamNetworkingConnectionState_Connected) {
+        releaseForcedRelayClusterLocked(true);
+      } else if (state == k_ESteamNetworkingConnectionState_ClosedByPeer ||
+                 state ==
+                     k_ESteamNetworkingConnectionState_ProblemDetectedLocally ||
+                 state == k_ESteamNetworkingConnectionState_None) {
+        releaseForcedRelayClusterLocked(false);
+      }
+    }
+    const bool raceContender = isRaceContender(pInfo->m_hConn);
+    // Outgoing attempts made while racing are siblings, not duplicates.
+    const bool racingOutgoing =
+        raceActive_ &&
+        pInfo->m_info.m_hListenSocket == k_HSteamListenSocket_Invalid;
     if (pInfo->m_info.m_eState ==
-        k_ESteamNetworkingConnectionState_ProblemDetectedLocally) {
+            k_ESteamNetworkingConnectionState_ProblemDetectedLocally &&
+        !raceContender) {
       std::cout << "Connection failed: " << pInfo->m_info.m_szEndDebug
                 << std::endl;
       const bool failedWhileConnecting =
@@ -553,8 +1102,15 @@ void SteamNetworkingManager::handleConnectionStatusChanged(
                     std::strstr(debug, "Timed out attempting to connect") !=
                         nullptr);
 
-      if (g_isClient && !relayFallbackTried_ && g_hostSteamID.IsValid() &&
-          (failedWhileConnecting || endToEndTimeout || natTraversalFailed)) {
+      if (g_isClient && joinedFromCache_ && failedWhileConnecting &&
+          pInfo->m_hConn == g_hConnection && g_hostSteamID.IsValid()) {
+        transportCache_.invalidate(g_hostSteamID.ConvertToUint64());
+        joinedFromCache_ = false;
+        retryWithoutCache_ = true;
+      } else if (g_isClient && !relayFallbackTried_ &&
+                 g_hostSteamID.IsValid() &&
+                 (failedWhileConnecting || endToEndTimeout ||
+                  natTraversalFailed)) {
         relayFallbackPending_ = true;
         std::cout << "[SteamNet] Queued relay-only retry after ICE failure"
                   << std::endl;
@@ -562,20 +1118,35 @@ void SteamNetworkingManager::handleConnectionStatusChanged(
         leaveLobby = true;
       }
     }
-    if (pInfo->m_eOldState == k_ESteamNetworkingConnectionState_None &&
-        pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connecting) {
+    if (raceContender &&
+        pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connected) {
+      onRaceContenderConnected(pInfo->m_hConn);
+    } else if (raceContender &&
+               (pInfo->m_info.m_eState ==
+                    k_ESteamNetworkingConnectionState_ClosedByPeer ||
+                pInfo->m_info.m_eState ==
+                    k_ESteamNetworkingConnectionState_ProblemDetectedLocally)) {
+      std::cout << "Race attempt failed: " << pInfo->m_info.m_szEndDebug
+                << std::endl;
+      onRaceContenderLost(pInfo->m_hConn);
+    } else if (pInfo->m_eOldState == k_ESteamNetworkingConnectionState_None &&
+               pInfo->m_info.m_eState ==
+                   k_ESteamNetworkingConnectionState_Connecting) {
       // Proactively close duplicate connections to the same peer to avoid
       // Steam's internal "Duplicate P2P connection" assertion.
       CSteamID peer = pInfo->m_info.m_identityRemote.GetSteamID();
-      if (peer.IsValid()) {
+      if (peer.IsValid() && !racingOutgoing) {
         for (auto it = connections.begin(); it != connections.end();) {
           if (*it == pInfo->m_hConn) {
             ++it;
             continue;
           }
+          // A client racing ICE against relay reaches us once per listen
+          // socket; only same-socket connections are stale duplicates.
           SteamNetConnectionInfo_t info;
           if (m_pInterface->GetConnectionInfo(*it, &info) &&
-              info.m_identityRemote.GetSteamID() == peer) {
+              info.m_identityRemote.GetSteamID() == peer &&
+              info.m_hListenSocket == pInfo->m_info.m_hListenSocket) {
             std::cout << "[SteamNet] Closing duplicate host connection to "
                       << peer.ConvertToUint64() << std::endl;
             m_pInterface->CloseConnection(*it, 0,
@@ -605,7 +1176,9 @@ void SteamNetworkingManager::handleConnectionStatusChanged(
 
       m_pInterface->AcceptConnection(pInfo->m_hConn);
       connections.push_back(pInfo->m_hConn);
-      g_hConnection = pInfo->m_hConn;
+      if (!racingOutgoing || g_hConnection == k_HSteamNetConnection_Invalid) {
+        g_hConnection = pInfo->m_hConn;
+      }
       g_isConnected = true;
       std::cout << "Accepted incoming connection from "
                 << pInfo->m_info.m_identityRemote.GetSteamID().ConvertToUint64()
@@ -637,6 +1210,18 @@ void SteamNetworkingManager::handleConnectionStatusChanged(
                   << "ms, relay=" << (info.m_idPOPRelay != 0 ? "yes" : "no")
                   << std::endl;
       }
+    } else if (pInfo->m_hConn == drainingConn_ &&
+               (pInfo->m_info.m_eState ==
+                    k_ESteamNetworkingConnectionState_ClosedByPeer ||
+                pInfo->m_info.m_eState ==
+                    k_ESteamNetworkingConnectionState_ProblemDetectedLocally)) {
+      m_pInterface->CloseConnection(pInfo->m_hConn, 0, nullptr, false);
+      auto it =
+          std::find(connections.begin(), connections.end(), pInfo->m_hConn);
+      if (it != connections.end()) {
+        connections.erase(it);
+      }
+      drainingConn_ = k_HSteamNetConnection_Invalid;
     } else if (pInfo->m_info.m_eState ==
                    k_ESteamNetworkingConnectionState_ClosedByPeer ||
                pInfo->m_info.m_eState ==
@@ -1,7 +1,9 @@
 #ifndef STEAM_NETWORKING_MANAGER_H
 #define STEAM_NETWORKING_MANAGER_H
 
+#include "send_rate_controller.h"
 #include "steam_message_handler.h"
+#include "transport_cache.h"
 #include <isteamnetworkingsockets.h>
 #include <isteamnetworkingutils.h>
 #include <map>
@@ -27,6 +29,10 @@ struct UserInfo {
 
 class SteamNetworkingManager {
 public:
+  // Hosts also listen here so a joining client can race a relay-only attempt
+  // against the normal ICE attempt on virtual port 0.
+  static constexpr int RELAY_RACE_VIRTUAL_PORT = 1;
+
   static SteamNetworkingManager *instance;
   SteamNetworkingManager();
   ~SteamNetworkingManager();
@@ -49,12 +55,24 @@ public:
   void closeConnectionToPeer(const CSteamID &peer);
   int getHostPing() const { return hostPing_; }
   int getConnectionPing(HSteamNetConnection conn) const;
+  bool getSendRate(HSteamNetConnection conn,
+                   SendRateController::RateInfo &out) const;
   HSteamNetConnection getConnection() const { return g_hConnection; }
   ISteamNetworkingSockets *getInterface() const { return m_pInterface; }
   std::string getConnectionRelayInfo(HSteamNetConnection conn) const;
   int estimateRelayPingMs() const;
+  // "pop:ms,..." for our lowest-latency POPs, published by the host so
+  // clients can pick the relay cluster with the best combined latency.
+  std::string describeLocalPopPings(int maxEntries) const;
+  int planRelay(const std::string &remotePopPings,
+                SteamNetworkingPOPID &bestPop) const;
+  void setTransportPlan(int predictedDirectMs, int predictedRelayMs,
+                        SteamNetworkingPOPID relayPop);
   void applyTransportPreference(int directPingMs, int relayPingMs);
   void setRoomManager(SteamRoomManager *roomManager) { roomManager_ = roomManager; }
+  void setTransportCachePath(const std::string &path) {
+    transportCache_.load(path);
+  }
 
   // For SteamRoomManager access
   std::unique_ptr<TCPServer> *&getServer() { return server_; }
@@ -62,6 +80,7 @@ public:
   int getBindPort() const { return localBindPort_ ? *localBindPort_ : 8888; }
   boost::asio::io_context *&getIOContext() { return io_context_; }
   HSteamListenSocket &getListenSock() { return hListenSock; }
+  HSteamListenSocket &getRaceListenSock() { return hRaceListenSock; }
   ISteamNetworkingSockets *getInterface() { return m_pInterface; }
   bool &getIsHost() { return g_isHost; }
 
@@ -83,12 +102,27 @@ public:
 
 private:
   bool connectToHostInternal(const CSteamID &hostSteamID, bool relayOnly);
+  HSteamNetConnection openConnection(const CSteamID &hostSteamID,
+                                     int virtualPort, bool relayOnly);
+  void startRelayRace(const CSteamID &hostSteamID);
+  bool isRaceContender(HSteamNetConnection conn) const;
+  void onRaceContenderConnected(HSteamNetConnection conn);
+  void onRaceContenderLost(HSteamNetConnection conn);
+  void updateRaceLocked(std::chrono::steady_clock::time_point now,
+                        std::vector<HSteamNetConnection> &toClose);
+  void resetRaceLocked();
+  // Lift the relay cluster override once its dial settles; connected
+  // reports whether SDR actually used the forced POP.
+  void releaseForcedRelayClusterLocked(bool connected);
+  static void setForcedRelayCluster(SteamNetworkingPOPID pop);
+  static std::string popIdToString(SteamNetworkingPOPID pop);
 
   // Steam API
   ISteamNetworkingSockets *m_pInterface;
 
   // Hosting
   HSteamListenSocket hListenSock;
+  HSteamListenSocket hRaceListenSock;
   bool g_isHost;
   bool g_isClient;
   bool g_isConnected;
@@ -99,6 +133,7 @@ private:
   std::vector<HSteamNetConnection> connections;
   std::mutex connectionsMutex;
   int hostPing_; // Ping to host (for clients) or average ping (for host)
+  std::unique_ptr<SendRateController> rateController_;
 
   // Connection config
   int g_retryCount;
@@ -120,6 +155,38 @@ private:
   std::chrono::steady_clock::time_point lastIceTimeout_;
   std::chrono::steady_clock::time_point connectAttemptStart_;
 
+  // Connect-time race: g_hConnection points at whichever contender is active.
+  // After migrating, new tunnels open on the new path; the previous one is
+  // kept until the tunnels opened on it have closed and it has gone idle.
+  bool raceActive_ = false;
+  HSteamNetConnection raceIceConn_ = k_HSteamNetConnection_Invalid;
+  HSteamNetConnection raceRelayConn_ = k_HSteamNetConnection_Invalid;
+  std::chrono::steady_clock::time_point raceStart_;
+  std::chrono::steady_clock::time_point raceIceReady_;
+  std::chrono::steady_clock::time_point raceRelayReady_;
+  HSteamNetConnection drainingConn_ = k_HSteamNetConnection_Invalid;
+  std::chrono::steady_clock::time_point drainingIdleSince_;
+
+  // Predictions from the lobby ping data, compared with the achieved RTT once
+  // the connection settles. The planned POP is forced on relay-only attempts.
+  int predictedDirectMs_ = -1;
+  int predictedRelayMs_ = -1;
+  SteamNetworkingPOPID plannedRelayPop_ = 0;
+  // SDR picks the relay during route negotiation, after ConnectP2P returns,
+  // so the global override stays until this dial connects or fails.
+  HSteamNetConnection forcedRelayConn_ = k_HSteamNetConnection_Invalid;
+  SteamNetworkingPOPID forcedRelayPop_ = 0;
+
+  // Per-host path memory across sessions. A connection is recorded once it
+  // has stayed up for a few seconds; a cached choice that fails is dropped
+  // and the join is retried from scratch.
+  TransportCache transportCache_;
+  bool joinedFromCache_ = false;
+  bool retryWithoutCache_ = false;
+  HSteamNetConnection cacheCandidateConn_ = k_HSteamNetConnection_Invalid;
+  HSteamNetConnection cacheRecordedConn_ = k_HSteamNetConnection_Invalid;
+  std::chrono::steady_clock::time_point cacheCandidateSince_;
+
   // Callback
   static void OnSteamNetConnectionStatusChanged(
       SteamNetConnectionStatusChangedCallback_t *pInfo);
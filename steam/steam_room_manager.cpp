@@ -12,6 +12,7 @@ constexpr const char *kLobbyKeyName = "ct_name";
 constexpr const char *kLobbyKeyHostName = "ct_host_name";
 constexpr const char *kLobbyKeyHostId = "ct_host_id";
 constexpr const char *kLobbyKeyPingLocation = "ct_ping_loc";
+constexpr const char *kLobbyKeyPopPings = "ct_pop_pings";
 constexpr const char *kLobbyKeyTag = "ct_tag";
 constexpr const char *kLobbyKeyPinned = "ct_pin";
 constexpr const char *kLobbyTagValue = "1";
@@ -504,6 +505,9 @@ bool SteamRoomManager::startHosting() {
       networkingManager_->getInterface()->CreateListenSocketP2P(0, 0, nullptr);
 
   if (networkingManager_->getListenSock() != k_HSteamListenSocket_Invalid) {
+    networkingManager_->getRaceListenSock() =
+        networkingManager_->getInterface()->CreateListenSocketP2P(
+            SteamNetworkingManager::RELAY_RACE_VIRTUAL_PORT, 0, nullptr);
     networkingManager_->getIsHost() = true;
     std::cout << "Created listen socket for hosting game room" << std::endl;
     return true;
@@ -520,6 +524,11 @@ void SteamRoomManager::stopHosting() {
         networkingManager_->getListenSock());
     networkingManager_->getListenSock() = k_HSteamListenSocket_Invalid;
   }
+  if (networkingManager_->getRaceListenSock() != k_HSteamListenSocket_Invalid) {
+    networkingManager_->getInterface()->CloseListenSocket(
+        networkingManager_->getRaceListenSock());
+    networkingManager_->getRaceListenSock() = k_HSteamListenSocket_Invalid;
+  }
   leaveLobby();
   networkingManager_->getIsHost() = false;
 }
@@ -637,6 +646,11 @@ void SteamRoomManager::refreshLobbyMetadata() {
         local, buffer, sizeof(buffer));
     SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyPingLocation,
                                      buffer);
+    const std::string popPings = networkingManager_->describeLocalPopPings(16);
+    if (!popPings.empty()) {
+      SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyPopPings,
+                                       popPings.c_str());
+    }
   }
   const bool wantsTun = advertisedWantsTun_;
   SteamMatchmaking()->SetLobbyData(currentLobby, kLobbyKeyMode,
@@ -669,7 +683,19 @@ void SteamRoomManager::decideTransportForCurrentLobby() {
                                                                      remote);
   }
 
-  const int relayPing = networkingManager_->estimateRelayPingMs();
+  // Pick the relay cluster with the lowest local + host latency; fall back to
+  // the symmetric estimate when the host did not publish POP pings.
+  SteamNetworkingPOPID relayPop = 0;
+  int relayPing = -1;
+  const char *popPingsStr =
+      SteamMatchmaking()->GetLobbyData(currentLobby, kLobbyKeyPopPings);
+  if (popPingsStr && popPingsStr[0] != '\0') {
+    relayPing = networkingManager_->planRelay(popPingsStr, relayPop);
+  }
+  if (relayPing < 0) {
+    relayPing = networkingManager_->estimateRelayPingMs();
+  }
+  networkingManager_->setTransportPlan(directPing, relayPing, relayPop);
   networkingManager_->applyTransportPreference(directPing, relayPing);
 }
 
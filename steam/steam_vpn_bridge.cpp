@@ -1,9 +1,13 @@
 #include "steam_vpn_bridge.h"
 #include "steam_vpn_networking_manager.h"
+#include "../net/icmp_feedback.h"
+#include "../net/mss_clamp.h"
 #include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <random>
 #include <thread>
 #include <steam_api.h>
 
@@ -14,18 +18,89 @@
 #include <arpa/inet.h>
 #endif
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 namespace {
 constexpr const char *kDefaultTunName = "SteamVPN";
 constexpr const char *kDefaultSubnet = "10.0.0.0";
 constexpr const char *kDefaultSubnetMask = "255.0.0.0";
 constexpr int kDefaultMtu = 1400;
+// Above this the TUN MTU counts as jumbo; jumbo frames go only to peers
+// on direct paths losing less than kJumboMaxLoss of what we send.
+constexpr int kMaxStandardMtu = 1500;
+constexpr int kMaxJumboMtu = 9000;
+constexpr double kJumboMaxLoss = 0.01;
+constexpr size_t kTunBatchSize = 32;
+constexpr int kMaxTunQueues = 4;
+constexpr int64_t kFullWrapperIntervalMs = 1000;
+constexpr int64_t kSessionResyncIntervalMs = 1000;
+// Application bytes Steam carries in one datagram on an ICE path, and on a
+// relayed one (SDR adds its own headers). Conservative: anything larger is
+// split into fragments that all have to arrive.
+constexpr size_t kDirectMessageBudget = 1200;
+constexpr size_t kRelayMessageBudget = 1100;
+constexpr size_t kIpTcpHeaderBytes = 40;
+constexpr int64_t kPathRecheckMs = 5000;
+// Smallest path MTU we believe in, whatever Steam or the probes say.
+constexpr size_t kMinPathMtu = 576;
+// PMTU probe message sizes (header included), capped at MTU + headroom.
+constexpr size_t kProbeSizes[] = {1500, 1400, 1300, 1200, 1100, 1000, 600};
+constexpr int64_t kProbeIntervalMs = 30000;
+constexpr int64_t kProbeTimeoutMs = 3000;
+constexpr int64_t kPathMaintenanceIntervalMs = 1000;
+// Steam is fed about one delay target's worth of bytes at its current send
+// rate, within these bounds; the rest waits in the flow scheduler. Queue 0
+// retries every kEgressRetryMs while anything is held.
+constexpr int64_t kEgressMinSteamBacklogBytes = 4 * 1500;
+constexpr int64_t kEgressMaxSteamBacklogBytes = 32 * 1024;
+constexpr int64_t kEgressRetryMs = 2;
+// How often queue 0 asks Steam for each peer's send queue.
+constexpr int64_t kSendQueueSampleMs = 2;
+constexpr int64_t kMinAggregationWindowUs = 100;
+constexpr int kDefaultDelayTargetMs = 5;
+// FEC: parity every kFecGroupSize data messages (kFecHeavyGroupSize once
+// loss passes twice the threshold), or sooner if a group stays open for
+// kFecGroupWindowMs. Off again below half the threshold. The receiver
+// keeps history while parity arrived within kFecReceiveIdleMs.
+constexpr double kDefaultFecLossThreshold = 0.02;
+constexpr size_t kFecGroupSize = 8;
+constexpr size_t kFecHeavyGroupSize = 4;
+constexpr int64_t kFecGroupWindowMs = 20;
+constexpr int64_t kFecReceiveIdleMs = 5000;
+// Parity is as long as the longest message of its group plus this. Only
+// messages that leave room for it are grouped, so parity fits one packet.
+constexpr size_t kFecParityOverhead = sizeof(VpnMessageHeader) +
+                                      sizeof(FecParityHeader) +
+                                      4 * XorFecEncoder::kMaxGroupSize;
+constexpr int kDefaultDelayIntervalMs = 100;
+constexpr size_t kCompactFrameHeader =
+    sizeof(VpnMessageHeader) + sizeof(CompactPacketHeader);
+
+int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int defaultTunQueueCount() {
+  const int cores = static_cast<int>(std::thread::hardware_concurrency());
+  return std::clamp(cores / 2, 1, kMaxTunQueues);
+}
 } // namespace
 
 SteamVpnBridge::SteamVpnBridge(SteamVpnNetworkingManager *steamManager)
-    : steamManager_(steamManager), running_(false), baseIP_(0), subnetMask_(0),
-      localIP_(0) {
-  std::memset(&stats_, 0, sizeof(stats_));
-}
+    : steamManager_(steamManager), running_(false),
+      tunQueueCount_(defaultTunQueueCount()),
+      delayTargetMs_(kDefaultDelayTargetMs),
+      delayIntervalMs_(kDefaultDelayIntervalMs), aggregationEnabled_(true),
+      aggregationWindowUs_(0), fecEnabled_(false),
+      fecLossThreshold_(kDefaultFecLossThreshold),
+      routes_(std::make_shared<RoutingSnapshot>()), baseIP_(0), subnetMask_(0),
+      localIP_(0) {}
 
 SteamVpnBridge::~SteamVpnBridge() { stop(); }
 
@@ -43,13 +118,30 @@ bool SteamVpnBridge::start(const std::string &tunDeviceName,
     return false;
   }
 
-  const int mtuToUse = mtu > 0 ? mtu : kDefaultMtu;
+  const int mtuToUse =
+      std::min(std::max(mtu > 0 ? mtu : kDefaultMtu, jumboMtu_), kMaxJumboMtu);
+  mtu_ = mtuToUse;
+  jumbo_ = mtuToUse > kMaxStandardMtu;
+  tunMaxPacket_ = std::max(kTunMaxPacket, static_cast<size_t>(mtuToUse));
+  if (jumbo_) {
+    std::cout << "[SteamVPN] Jumbo MTU " << mtuToUse
+              << " for healthy direct peers" << std::endl;
+  }
 
+  // Threads of an earlier session must be gone before the queues are
+  // rebuilt; stop() has normally joined them already.
+  joinTunQueues();
+  joinTunWriter();
   tunDevice_ = tun::create_tun();
   if (!tunDevice_) {
     std::cerr << "Failed to create TUN device" << std::endl;
     return false;
   }
+  if (tunQueueCount_ > 1 && !tunDevice_->set_queue_count(tunQueueCount_)) {
+    std::cout << "[SteamVPN] Multi-queue TUN unsupported on this platform"
+              << std::endl;
+  }
+  tunDevice_->set_offload(true);
   if (!tunDevice_->open(tunDeviceName.empty() ? kDefaultTunName : tunDeviceName,
                         mtuToUse)) {
     std::cerr << "Failed to open TUN device: " << tunDevice_->get_last_error()
@@ -66,6 +158,13 @@ bool SteamVpnBridge::start(const std::string &tunDeviceName,
       stringToIp(subnetMask.empty() ? kDefaultSubnetMask : subnetMask);
 
   const CSteamID mySteamID = SteamUser()->GetSteamID();
+  localSteamID_ = mySteamID;
+  {
+    std::random_device rd;
+    localSessionIndex_ =
+        static_cast<uint16_t>(std::uniform_int_distribution<int>(1, 0xFFFF)(rd));
+  }
+  ipNegotiator_.setSessionIndex(localSessionIndex_);
   ipNegotiator_.initialize(mySteamID, baseIP_, subnetMask_);
   ipNegotiator_.setSendCallback(
       [this](VpnMessageType type, const uint8_t *payload, size_t len,
@@ -80,6 +179,7 @@ bool SteamVpnBridge::start(const std::string &tunDeviceName,
   ipNegotiator_.setSuccessCallback([this](uint32_t ip, const NodeID &nodeId) {
     onNegotiationSuccess(ip, nodeId);
   });
+  ipNegotiator_.setDeadlineChangedCallback([this]() { wakeTunThreads(); });
 
   heartbeatManager_.setSendCallback([this](VpnMessageType type,
                                            const uint8_t *payload, size_t len,
@@ -92,10 +192,26 @@ bool SteamVpnBridge::start(const std::string &tunDeviceName,
   ipNegotiator_.startNegotiation();
   tunDevice_->set_non_blocking(true);
 
+  tunQueues_.clear();
+  const int queueCount = std::max(1, tunDevice_->queue_count());
+  for (int i = 0; i < queueCount; ++i) {
+    auto queue = std::make_unique<TunQueue>();
+    queue->index = i;
+#ifdef __linux__
+    queue->wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    tunQueues_.push_back(std::move(queue));
+  }
+
   running_ = true;
-  tunReadThread_ =
-      std::make_unique<std::thread>(&SteamVpnBridge::tunReadThread, this);
-  std::cout << "Steam VPN bridge started successfully" << std::endl;
+  tunWriteThread_ =
+      std::make_unique<std::thread>(&SteamVpnBridge::tunWriteThread, this);
+  for (auto &queue : tunQueues_) {
+    queue->thread = std::make_unique<std::thread>(
+        &SteamVpnBridge::tunReadThread, this, std::ref(*queue));
+  }
+  std::cout << "Steam VPN bridge started successfully with " << queueCount
+            << " TUN queue(s)" << std::endl;
   return true;
 }
 
@@ -105,16 +221,25 @@ void SteamVpnBridge::stop() {
   }
   running_ = false;
   heartbeatManager_.stop();
+  joinTunQueues();
+  joinTunWriter();
   if (tunDevice_) {
-    tunDevice_->close(); // wake blocking reads
-  }
-  if (tunReadThread_ && tunReadThread_->joinable()) {
-    tunReadThread_->join();
+    tunDevice_->close();
   }
   {
     std::lock_guard<std::mutex> lock(routingMutex_);
     routingTable_.clear();
+    publishRoutesLocked();
+  }
+  {
+    // Compact-header state belongs to this session's index.
+    std::lock_guard<std::mutex> lock(peerContextsMutex_);
+    peerContexts_.clear();
+    publishPeerContextsLocked();
+    sessionUsage_.clear();
   }
+  egressBackloggedPeers_ = 0;
+  multicastFilter_.clear();
   ipNegotiator_.reset();
   heartbeatManager_.reset();
   localIP_ = 0;
@@ -135,111 +260,784 @@ std::string SteamVpnBridge::getTunDeviceName() const {
   return {};
 }
 
-std::map<uint32_t, RouteEntry> SteamVpnBridge::getRoutingTable() const {
-  std::lock_guard<std::mutex> lock(routingMutex_);
-  return routingTable_;
+RoutingSnapshotPtr SteamVpnBridge::getRoutingSnapshot() const {
+  return loadRoutes();
+}
+
+RoutingSnapshotPtr SteamVpnBridge::loadRoutes() const {
+  return std::atomic_load(&routes_);
 }
 
-void SteamVpnBridge::tunReadThread() {
-  std::cout << "TUN read thread started" << std::endl;
-  uint8_t buffer[2048];
-  auto lastTimeoutCheck = std::chrono::steady_clock::now();
+void SteamVpnBridge::publishRoutesLocked() {
+  auto snapshot = std::make_shared<RoutingSnapshot>();
+  snapshot->hops.reserve(routingTable_.size());
+  snapshot->entries.reserve(routingTable_.size());
+  for (const auto &kv : routingTable_) {
+    snapshot->hops.push_back(
+        {kv.first, kv.second.steamID, kv.second.isLocal});
+    snapshot->entries.push_back(kv.second);
+  }
+  std::atomic_store(&routes_, RoutingSnapshotPtr(std::move(snapshot)));
+}
+
+void SteamVpnBridge::setTunQueueCount(int queues) {
+  tunQueueCount_ = std::clamp(queues, 1, kMaxTunQueues);
+}
+
+void SteamVpnBridge::setJumboMtu(int mtu) {
+  jumboMtu_ = std::clamp(mtu, 0, kMaxJumboMtu);
+}
+
+void SteamVpnBridge::setQueueDelayTarget(int targetMs, int intervalMs) {
+  targetMs = std::max(1, targetMs);
+  delayTargetMs_ = targetMs;
+  delayIntervalMs_ = std::max(targetMs, intervalMs);
+}
+
+void SteamVpnBridge::joinTunQueues() {
+  wakeTunThreads();
+  for (auto &queue : tunQueues_) {
+    if (queue->thread && queue->thread->joinable()) {
+      queue->thread->join();
+    }
+    queue->thread.reset();
+#ifdef __linux__
+    if (queue->wakeFd >= 0) {
+      ::close(queue->wakeFd);
+      queue->wakeFd = -1;
+    }
+#endif
+  }
+}
+
+uint8_t *SteamVpnBridge::acquireFrame() const {
+  return PacketPool::instance().acquire(kTunFrameHeadroom + tunMaxPacket_);
+}
+
+void SteamVpnBridge::tunReadThread(TunQueue &queue) {
+  std::cout << "TUN read thread " << queue.index << " started" << std::endl;
+  queue.batch.resize(kTunBatchSize);
+  for (TunFrame &frame : queue.batch) {
+    frame.data = acquireFrame();
+  }
 
   while (running_) {
-    const int bytesRead =
-        tunDevice_ ? tunDevice_->read(buffer, sizeof(buffer)) : -1;
-    if (bytesRead > 0 && steamManager_) {
-      const uint32_t destIP = extractDestIP(buffer, bytesRead);
-      const uint32_t srcIP = extractSourceIP(buffer, bytesRead);
-      uint8_t
-          vpnPacket[2048 + sizeof(VpnMessageHeader) + sizeof(VpnPacketWrapper)];
-      auto *header = reinterpret_cast<VpnMessageHeader *>(vpnPacket);
-      header->type = VpnMessageType::IP_PACKET;
+    // Drain whatever the kernel has queued, up to one batch, reading each
+    // packet straight behind the header room of its frame.
+    size_t count = 0;
+    while (count < queue.batch.size() && tunDevice_) {
+      TunFrame &frame = queue.batch[count];
+      const int bytesRead = tunDevice_->read_queue(
+          queue.index, frame.data + kTunFrameHeadroom, tunMaxPacket_);
+      if (bytesRead <= 0) {
+        break;
+      }
+      frame.ipLength = static_cast<size_t>(bytesRead);
+      ++count;
+    }
+    if (count > 0) {
+      bumpCounter(queue.packetsRead, count);
+      if (steamManager_) {
+        processTunBatch(queue, count);
+      }
+    } else {
+      waitForTunActivity(queue);
+    }
+
+    // Probe deadlines and path MTU rounds are driven from queue 0 only.
+    if (queue.index == 0) {
+      if (std::chrono::steady_clock::now() >= ipNegotiator_.nextDeadline()) {
+        ipNegotiator_.checkTimeout();
+      }
+      maintainPathMtu();
+      sampleSendQueues();
+      if (egressBackloggedPeers_.load(std::memory_order_relaxed) > 0) {
+        drainBackloggedEgress(queue);
+      }
+    }
+  }
+  for (TunFrame &frame : queue.batch) {
+    PacketPool::instance().release(frame.data);
+    frame.data = nullptr;
+  }
+  std::cout << "TUN read thread " << queue.index << " stopped" << std::endl;
+}
 
+void SteamVpnBridge::processTunBatch(TunQueue &queue, size_t count) {
+  const int sendFlags =
+      k_nSteamNetworkingSend_UnreliableNoNagle | k_nSteamNetworkingSend_NoDelay;
+  const NodeID localNodeId = ipNegotiator_.getLocalNodeID();
+
+  queue.unicast.clear();
+  queue.loopback.clear();
+  queue.broadcast.clear();
+  {
+    const RoutingSnapshotPtr routes = loadRoutes();
+    for (size_t i = 0; i < count; ++i) {
+      TunFrame &frame = queue.batch[i];
+      const uint8_t *ip = frame.data + kTunFrameHeadroom;
+      bumpCounter(queue.bytesRead, frame.ipLength);
+      const uint32_t destIP = extractDestIP(ip, frame.ipLength);
+
+      auto *header = reinterpret_cast<VpnMessageHeader *>(frame.data);
+      header->type = VpnMessageType::IP_PACKET;
+      header->length = htons(
+          static_cast<uint16_t>(sizeof(VpnPacketWrapper) + frame.ipLength));
       auto *wrapper = reinterpret_cast<VpnPacketWrapper *>(
-          vpnPacket + sizeof(VpnMessageHeader));
-      wrapper->senderNodeId = ipNegotiator_.getLocalNodeID();
-      wrapper->sourceIP = htonl(srcIP);
-
-      const size_t totalPayloadSize =
-          sizeof(VpnPacketWrapper) + static_cast<size_t>(bytesRead);
-      header->length = htons(static_cast<uint16_t>(totalPayloadSize));
-      std::memcpy(vpnPacket + sizeof(VpnMessageHeader) +
-                      sizeof(VpnPacketWrapper),
-                  buffer, static_cast<size_t>(bytesRead));
-      const uint32_t vpnPacketSize =
-          static_cast<uint32_t>(sizeof(VpnMessageHeader) + totalPayloadSize);
+          frame.data + sizeof(VpnMessageHeader));
+      wrapper->senderNodeId = localNodeId;
+      wrapper->sourceIP = htonl(extractSourceIP(ip, frame.ipLength));
 
       if (destIP == localIP_) {
-        // Loopback traffic destined to our own TUN IP back into the stack.
-        tunDevice_->write(buffer, static_cast<size_t>(bytesRead));
-        std::lock_guard<std::mutex> lock(statsMutex_);
-        stats_.packetsReceived++;
-        stats_.bytesReceived += static_cast<uint64_t>(bytesRead);
-        std::cout << "[SteamVPN] Local loopback " << ipToString(srcIP) << " -> "
-                  << ipToString(destIP) << " (" << bytesRead << " bytes)"
-                  << std::endl;
+        queue.loopback.push_back(i);
       } else if (isBroadcastAddress(destIP)) {
-        steamManager_->broadcastMessage(
-            vpnPacket, vpnPacketSize,
-            k_nSteamNetworkingSend_UnreliableNoNagle |
-                k_nSteamNetworkingSend_NoDelay);
-        const auto peers = steamManager_->getPeers();
-        std::lock_guard<std::mutex> lock(statsMutex_);
-        stats_.packetsSent += peers.size();
-        stats_.bytesSent += static_cast<uint64_t>(bytesRead) * peers.size();
-        std::cout << "[SteamVPN] Broadcast " << ipToString(srcIP) << " -> "
-                  << ipToString(destIP) << " to " << peers.size() << " peers ("
-                  << bytesRead << " bytes)" << std::endl;
+        queue.broadcast.push_back(i);
       } else {
-        CSteamID targetSteamID;
-        bool found = false;
-        {
-          std::lock_guard<std::mutex> lock(routingMutex_);
-          auto it = routingTable_.find(destIP);
-          if (it != routingTable_.end() && !it->second.isLocal) {
-            targetSteamID = it->second.steamID;
-            found = true;
-          } else if (it != routingTable_.end() && it->second.isLocal) {
-            // Target is ourselves; loop back.
-            tunDevice_->write(buffer, static_cast<size_t>(bytesRead));
-            std::lock_guard<std::mutex> lock2(statsMutex_);
-            stats_.packetsReceived++;
-            stats_.bytesReceived += static_cast<uint64_t>(bytesRead);
-            std::cout << "[SteamVPN] Route loopback " << ipToString(srcIP)
-                      << " -> " << ipToString(destIP) << " (" << bytesRead
-                      << " bytes)" << std::endl;
-          }
+        const RoutingSnapshot::Hop *hop = routes->find(destIP);
+        if (hop && !hop->isLocal) {
+          queue.unicast.emplace_back(hop->steamID, i);
+        } else if (hop) {
+          queue.loopback.push_back(i);
+        } else {
+          bumpCounter(queue.counters.packetsDropped);
+        }
+      }
+    }
+  }
+
+  TrafficCounters &counters = queue.counters;
+  const size_t ipSlot = messageTypeSlot(VpnMessageType::IP_PACKET);
+  for (size_t i : queue.loopback) {
+    // Traffic for our own TUN IP goes straight back into the stack.
+    const TunFrame &frame = queue.batch[i];
+    const uint8_t *ip = frame.data + kTunFrameHeadroom;
+    // Same flow as the one just read, so the same queue keeps it ordered.
+    tunDevice_->write_queue(queue.index, ip, frame.ipLength);
+    queue.packetsWritten.fetch_add(1, std::memory_order_relaxed);
+    queue.bytesWritten.fetch_add(frame.ipLength, std::memory_order_relaxed);
+    bumpCounter(counters.packetsReceived);
+    bumpCounter(counters.bytesReceived, frame.ipLength);
+    std::cout << "[SteamVPN] Local loopback "
+              << ipToString(extractSourceIP(ip, frame.ipLength)) << " -> "
+              << ipToString(extractDestIP(ip, frame.ipLength)) << " ("
+              << frame.ipLength << " bytes)" << std::endl;
+  }
+
+  if (!queue.loopback.empty()) {
+    tunDevice_->flush();
+  }
+
+  if (!queue.broadcast.empty()) {
+    const auto now = MulticastFilter::Clock::now();
+    const PeerContextsPtr peers = loadPeerContexts();
+    for (size_t i : queue.broadcast) {
+      const TunFrame &frame = queue.batch[i];
+      const uint8_t *ip = frame.data + kTunFrameHeadroom;
+      const uint32_t size =
+          static_cast<uint32_t>(kTunFrameHeadroom + frame.ipLength);
+      // Each copy counts against its recipient's egress limit, like a
+      // unicast packet; a peer over its limit is left out of the fan-out.
+      auto withinEgressLimit = [&](CSteamID peer) {
+        auto it = peers->find(peer);
+        if (it == peers->end()) {
+          return true;
         }
-        if (found) {
-          steamManager_->sendMessageToUser(
-              targetSteamID, vpnPacket, vpnPacketSize,
-              k_nSteamNetworkingSend_UnreliableNoNagle |
-                  k_nSteamNetworkingSend_NoDelay);
-          std::lock_guard<std::mutex> lock(statsMutex_);
-          stats_.packetsSent++;
-          stats_.bytesSent += static_cast<uint64_t>(bytesRead);
-          // std::cout << "[SteamVPN] Sent " << ipToString(srcIP) << " -> "
-          //           << ipToString(destIP) << " (" << bytesRead
-          //           << " bytes) to " << targetSteamID.ConvertToUint64()
-          //           << std::endl;
+        PeerContext &context = *it->second;
+        std::lock_guard<std::mutex> lock(context.egressMutex);
+        if (context.egressBucket.take(
+                frame.ipLength,
+                context.egressLimit.load(std::memory_order_relaxed), now)) {
+          return true;
         }
+        bumpCounter(counters.rateLimited);
+        context.usage->bytesRateLimited.fetch_add(frame.ipLength,
+                                                  std::memory_order_relaxed);
+        return false;
+      };
+      size_t sent = 0;
+      switch (multicastFilter_.classify(ip, frame.ipLength, now)) {
+      case MulticastFilter::Verdict::Drop:
+        bumpCounter(counters.packetsDropped);
+        continue;
+      case MulticastFilter::Verdict::Flood:
+        sent = steamManager_->broadcastMessage(frame.data, size, sendFlags,
+                                               withinEgressLimit);
+        break;
+      case MulticastFilter::Verdict::Subscribed: {
+        const uint32_t group = extractDestIP(ip, frame.ipLength);
+        uint64_t avoided = 0;
+        sent = steamManager_->broadcastMessage(
+            frame.data, size, sendFlags, [&](CSteamID peer) {
+              const bool wanted = multicastFilter_.wantsGroup(peer, group, now);
+              avoided += wanted ? 0 : 1;
+              return wanted && withinEgressLimit(peer);
+            });
+        multicastFilter_.countAvoided(avoided);
+        break;
       }
+      }
+      bumpCounter(counters.packetsSent, sent);
+      bumpCounter(counters.bytesSent, frame.ipLength * sent);
+      bumpCounter(counters.sentByType[ipSlot], sent);
     }
-    if (bytesRead <= 0) {
-      // No packet ready; yield briefly to avoid spinning a full core.
-      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+
+  // Hand each peer's packets to its scheduler, then let it send what the
+  // Steam backlog allows. Stable sort keeps per-peer order for the flows.
+  std::stable_sort(queue.unicast.begin(), queue.unicast.end(),
+                   [](const std::pair<CSteamID, size_t> &a,
+                      const std::pair<CSteamID, size_t> &b) {
+                     return a.first < b.first;
+                   });
+  const auto now = FlowScheduler::Clock::now();
+  for (size_t begin = 0; begin < queue.unicast.size();) {
+    const CSteamID peer = queue.unicast[begin].first;
+    const std::shared_ptr<PeerContext> context = peerContext(peer);
+    size_t end = begin;
+    if (!context) {
+      // A route to a peer that has just left; nothing to send it on.
+      while (end < queue.unicast.size() && queue.unicast[end].first == peer) {
+        ++end;
+      }
+      bumpCounter(counters.packetsDropped, end - begin);
+      begin = end;
+      continue;
+    }
+    const uint16_t mtu = peerMtu(*context);
+    {
+      std::lock_guard<std::mutex> lock(context->egressMutex);
+      for (; end < queue.unicast.size() && queue.unicast[end].first == peer;
+           ++end) {
+        TunFrame &frame = queue.batch[queue.unicast[end].second];
+        uint8_t *ip = frame.data + kTunFrameHeadroom;
+        if (frame.ipLength > mtu &&
+            IcmpFeedback::dontFragment(ip, frame.ipLength)) {
+          rejectOversized(queue, ip, frame.ipLength, mtu);
+          continue;
+        }
+        if (TcpMssClamp::isSyn(ip, frame.ipLength) &&
+            TcpMssClamp::clamp(ip, frame.ipLength,
+                               static_cast<uint16_t>(mtu - kIpTcpHeaderBytes))) {
+          bumpCounter(counters.mssClamped);
+        }
+        // The scheduler owns the buffer from here on.
+        FlowScheduler::Packet packet;
+        packet.buffer = frame.data;
+        packet.ip = ip;
+        packet.ipLength = frame.ipLength;
+        packet.enqueued = now;
+        context->egress.enqueue(packet);
+        frame.data = acquireFrame();
+      }
     }
+    drainEgress(queue, *context);
+    begin = end;
+  }
+}
+
+void SteamVpnBridge::drainEgress(TunQueue &queue, PeerContext &peer) {
+  const int sendFlags =
+      k_nSteamNetworkingSend_UnreliableNoNagle | k_nSteamNetworkingSend_NoDelay;
+  TrafficCounters &counters = queue.counters;
+  std::lock_guard<std::mutex> lock(peer.egressMutex);
+  if (!peer.egress.empty() || peer.bundler.open()) {
+    // Keep the backlog here, where flows can be interleaved and CoDel sees
+    // it, rather than in Steam's FIFO send buffer: pace to Steam's send
+    // rate by letting it hold only about one delay target's worth.
+    const int targetMs = delayTargetMs_.load(std::memory_order_relaxed);
+    peer.egress.setDelayTarget(
+        std::chrono::milliseconds(targetMs),
+        std::chrono::milliseconds(
+            delayIntervalMs_.load(std::memory_order_relaxed)));
+    SteamVpnNetworkingManager::SendQueueStatus steam;
+    steam.pendingBytes = peer.sendPendingBytes.load(std::memory_order_relaxed);
+    steam.queueTimeUsec =
+        peer.sendQueueTimeUsec.load(std::memory_order_relaxed);
+    steam.sendRateBytesPerSec =
+        peer.sendRateBytesPerSec.load(std::memory_order_relaxed);
+    steam.remoteQuality = peer.remoteQuality.load(std::memory_order_relaxed);
+    int64_t budget = kEgressMaxSteamBacklogBytes;
+    if (steam.sendRateBytesPerSec > 0) {
+      budget = std::clamp<int64_t>(
+          static_cast<int64_t>(steam.sendRateBytesPerSec) * targetMs / 1000,
+          kEgressMinSteamBacklogBytes, kEgressMaxSteamBacklogBytes);
+    }
+    int64_t allowance = budget - steam.pendingBytes -
+                        peer.sentSinceSample.load(std::memory_order_relaxed);
+    const auto now = FlowScheduler::Clock::now();
+    const auto steamDelay = std::chrono::microseconds(steam.queueTimeUsec);
+    const uint64_t egressLimit = peer.egressLimit.load(std::memory_order_relaxed);
+    const bool compact = useCompactHeader(peer, steadyNowMs());
+    updateFecState(peer, steam);
+    const bool fec = peer.fecActive.load(std::memory_order_relaxed);
+    // Small packets are packed together once the peer takes bundles; they
+    // are compact by nature, so not while a full wrapper is due.
+    const bool bundling = compact && aggregationEnabled_.load(
+                                         std::memory_order_relaxed) &&
+                          peer.bundlesReady.load(std::memory_order_relaxed);
+    const size_t datagramBudget = messageBudget(peer);
+    const bool segmenting = peer.segmentsReady.load(std::memory_order_relaxed);
+    // While FEC is on, bundles and segments are cut short enough to be
+    // protected; full-size single packets go out unprotected.
+    const size_t fecBudget = datagramBudget > kFecParityOverhead
+                                 ? datagramBudget - kFecParityOverhead
+                                 : 0;
+    const size_t packBudget = fec ? fecBudget : datagramBudget;
+    queue.outgoing.clear();
+    queue.fecParityCount = 0;
+    uint64_t bytes = 0;
+    uint64_t packets = 0;
+    uint64_t compactMessages = 0;
+    uint64_t bundles = 0;
+    uint64_t bundled = 0;
+    uint64_t segmented = 0;
+    uint64_t segments = 0;
 
-    const auto now = std::chrono::steady_clock::now();
-    if (std::chrono::duration_cast<std::chrono::milliseconds>(now -
-                                                              lastTimeoutCheck)
-            .count() >= 50) {
-      lastTimeoutCheck = now;
-      ipNegotiator_.checkTimeout();
+    auto emit = [&](const uint8_t *data, size_t size, uint8_t *buffer) {
+      queue.outgoing.push_back({data, static_cast<uint32_t>(size), buffer});
+      if (fec && size <= fecBudget && peer.fecEncoder.add(data, size, now)) {
+        closeFecGroup(queue, peer);
+      }
+    };
+    // Too large for one Steam packet: sent as segments when the peer
+    // reassembles them, else whole for Steam to fragment. False if split.
+    auto emitPacket = [&](const uint8_t *data, size_t size, uint8_t *buffer) {
+      if (size <= datagramBudget || !segmenting ||
+          !peer.segmenter.split(data, size, packBudget,
+                                [&](uint8_t *segment, size_t segmentSize) {
+                                  emit(segment, segmentSize, segment);
+                                  segments++;
+                                })) {
+        emit(data, size, buffer);
+        return true;
+      }
+      segmented++;
+      PacketPool::instance().release(buffer);
+      return false;
+    };
+    auto emitBundle = [&]() {
+      const size_t count = peer.bundler.packets();
+      const PacketBundler::Message message =
+          peer.bundler.finish(localSessionIndex_);
+      emit(message.data, message.size, message.buffer);
+      if (count > 1) {
+        bundles++;
+        bundled += count;
+      } else {
+        compactMessages++;
+      }
+    };
+
+    FlowScheduler::Packet packet;
+    while (allowance > 0 && peer.egressBucket.allow(egressLimit, now) &&
+           peer.egress.dequeue(packet, now, steamDelay)) {
+      peer.egressBucket.consume(packet.ipLength);
+      bytes += packet.ipLength;
+      packets++;
+      if (bundling && packet.ipLength <= PacketBundler::kMaxPacket) {
+        if (!peer.bundler.fits(packet.ipLength, packBudget)) {
+          emitBundle();
+        }
+        peer.bundler.add(packet.ip, packet.ipLength, packet.priority, now);
+        PacketPool::instance().release(packet.buffer);
+        allowance -= static_cast<int64_t>(packet.ipLength);
+        continue;
+      }
+      // Whatever was bundled before this packet goes first, so a flow
+      // mixing small and large packets keeps its order.
+      if (peer.bundler.open()) {
+        emitBundle();
+      }
+      if (!compact) {
+        emitPacket(packet.buffer, kTunFrameHeadroom + packet.ipLength,
+                   packet.buffer);
+      } else {
+        // Rewrite the tail of the headroom as header + session index; the
+        // full wrapper in front of it is simply not sent.
+        uint8_t *start = packet.buffer + kTunFrameHeadroom - kCompactFrameHeader;
+        VpnMessageHeader header{};
+        header.type = VpnMessageType::IP_PACKET_COMPACT;
+        header.length = htons(static_cast<uint16_t>(
+            sizeof(CompactPacketHeader) + packet.ipLength));
+        CompactPacketHeader compactHeader{};
+        compactHeader.sessionIndex = htons(localSessionIndex_);
+        std::memcpy(start, &header, sizeof(header));
+        std::memcpy(start + sizeof(header), &compactHeader,
+                    sizeof(compactHeader));
+        if (emitPacket(start, kCompactFrameHeader + packet.ipLength,
+                       packet.buffer)) {
+          compactMessages++;
+        }
+      }
+      allowance -= static_cast<int64_t>(packet.ipLength);
+    }
+    // A partial bundle may wait out the aggregation window, unless it
+    // carries a real-time packet or an ACK.
+    if (peer.bundler.open() &&
+        (peer.bundler.urgent() ||
+         now - peer.bundler.openedAt() >= aggregationWindow())) {
+      emitBundle();
+    }
+
+    if (!queue.outgoing.empty()) {
+      int64_t handedOver = 0;
+      for (const auto &message : queue.outgoing) {
+        handedOver += message.size;
+      }
+      peer.sentSinceSample.fetch_add(handedOver, std::memory_order_relaxed);
+      if (!steamManager_->sendMessagesToUser(peer.steamID,
+                                             queue.outgoing.data(),
+                                             queue.outgoing.size(),
+                                             sendFlags)) {
+        // Copied by the Messages API; the buffers are ours to recycle.
+        for (const auto &message : queue.outgoing) {
+          PacketPool::instance().release(message.pooledBuffer);
+        }
+      }
+    }
+    if (packets > 0) {
+      const uint64_t fullMessages =
+          queue.outgoing.size() - compactMessages - bundles - segments;
+      bumpCounter(counters.packetsSent, packets);
+      bumpCounter(counters.bytesSent, bytes);
+      bumpCounter(counters.compactPacketsSent, compactMessages);
+      bumpCounter(counters.headerBytesSaved,
+                  compactMessages * (kTunFrameHeadroom - kCompactFrameHeader));
+      bumpCounter(counters.bundlesSent, bundles);
+      bumpCounter(counters.bundledPackets, bundled);
+      bumpCounter(counters.messagesSegmented, segmented);
+      bumpCounter(counters.segmentsSent, segments);
+      bumpCounter(counters.sentByType[messageTypeSlot(
+                      VpnMessageType::IP_PACKET_SEGMENT)],
+                  segments);
+      bumpCounter(
+          counters.sentByType[messageTypeSlot(VpnMessageType::IP_PACKET)],
+          fullMessages);
+      bumpCounter(counters.sentByType[messageTypeSlot(
+                      VpnMessageType::IP_PACKET_COMPACT)],
+                  compactMessages);
+      bumpCounter(counters.sentByType[messageTypeSlot(
+                      VpnMessageType::IP_PACKET_BUNDLE)],
+                  bundles);
+      peer.packetsSent.fetch_add(packets, std::memory_order_relaxed);
+      peer.bytesSent.fetch_add(bytes, std::memory_order_relaxed);
+      peer.usage->bytesSent.fetch_add(bytes, std::memory_order_relaxed);
+    }
+  }
+
+  // A quiet flow still gets parity for its last few packets.
+  if (peer.fecEncoder.open() &&
+      FlowScheduler::Clock::now() - peer.fecEncoder.openedAt() >=
+          std::chrono::milliseconds(kFecGroupWindowMs)) {
+    closeFecGroup(queue, peer);
+  }
+  sendFecParity(queue, peer);
+
+  // Packets left behind, an open bundle or parity group, are seen to by
+  // queue 0 shortly.
+  const bool backlogged = !peer.egress.empty() || peer.bundler.open() ||
+                          peer.fecEncoder.open();
+  peer.bundleDeadlineUs.store(
+      peer.bundler.open()
+          ? std::chrono::duration_cast<std::chrono::microseconds>(
+                (peer.bundler.openedAt() + aggregationWindow())
+                    .time_since_epoch())
+                .count()
+          : 0,
+      std::memory_order_relaxed);
+  if (peer.egressBacklogged.exchange(backlogged) != backlogged) {
+    if (backlogged) {
+      egressBackloggedPeers_.fetch_add(1, std::memory_order_relaxed);
+      wakeTunQueue(0);
+    } else {
+      egressBackloggedPeers_.fetch_sub(1, std::memory_order_relaxed);
     }
   }
-  std::cout << "TUN read thread stopped" << std::endl;
+}
+
+void SteamVpnBridge::updateFecState(
+    PeerContext &peer, const SteamVpnNetworkingManager::SendQueueStatus &steam) {
+  const bool wasActive = peer.fecActive.load(std::memory_order_relaxed);
+  bool active = wasActive;
+  if (!fecEnabled_.load(std::memory_order_relaxed)) {
+    active = false;
+  } else if (steam.remoteQuality >= 0.0f) {
+    const double threshold = fecLossThreshold_.load(std::memory_order_relaxed);
+    const double loss = 1.0 - steam.remoteQuality;
+    if (loss >= threshold) {
+      active = true;
+      peer.fecEncoder.setGroupSize(loss >= 2 * threshold ? kFecHeavyGroupSize
+                                                         : kFecGroupSize);
+    } else if (loss < threshold / 2) {
+      active = false;
+    }
+  }
+  if (active == wasActive) {
+    return;
+  }
+  peer.fecActive.store(active, std::memory_order_relaxed);
+  if (!active) {
+    peer.fecEncoder.reset();
+  }
+  std::cout << "[SteamVPN] FEC " << (active ? "on" : "off") << " for "
+            << peer.steamID.ConvertToUint64() << " (delivery "
+            << static_cast<int>(steam.remoteQuality * 100) << "%)"
+            << std::endl;
+}
+
+void SteamVpnBridge::closeFecGroup(TunQueue &queue, PeerContext &peer) {
+  if (queue.fecParity.size() <= queue.fecParityCount) {
+    queue.fecParity.resize(queue.fecParityCount + 1);
+  }
+  std::vector<uint8_t> &message = queue.fecParity[queue.fecParityCount++];
+  peer.fecEncoder.finish(message, sizeof(VpnMessageHeader));
+  VpnMessageHeader header{};
+  header.type = VpnMessageType::FEC_PARITY;
+  header.length =
+      htons(static_cast<uint16_t>(message.size() - sizeof(VpnMessageHeader)));
+  std::memcpy(message.data(), &header, sizeof(header));
+}
+
+void SteamVpnBridge::sendFecParity(TunQueue &queue, PeerContext &peer) {
+  TrafficCounters &counters = queue.counters;
+  for (size_t i = 0; i < queue.fecParityCount; ++i) {
+    const std::vector<uint8_t> &message = queue.fecParity[i];
+    steamManager_->sendMessageToUser(
+        peer.steamID, message.data(), static_cast<uint32_t>(message.size()),
+        k_nSteamNetworkingSend_UnreliableNoNagle |
+            k_nSteamNetworkingSend_NoDelay);
+    bumpCounter(counters.fecParitySent);
+    bumpCounter(counters.fecParityBytes, message.size());
+    bumpCounter(
+        counters.sentByType[messageTypeSlot(VpnMessageType::FEC_PARITY)]);
+  }
+  queue.fecParityCount = 0;
+}
+
+void SteamVpnBridge::setAggregation(bool enabled,
+                                    std::chrono::microseconds window) {
+  aggregationWindowUs_ =
+      window.count() > 0
+          ? std::max<int64_t>(kMinAggregationWindowUs, window.count())
+          : 0;
+  aggregationEnabled_ = enabled;
+}
+
+FlowScheduler::Clock::duration SteamVpnBridge::aggregationWindow() const {
+  return std::chrono::microseconds(
+      aggregationWindowUs_.load(std::memory_order_relaxed));
+}
+
+void SteamVpnBridge::setForwardErrorCorrection(bool enabled,
+                                               double lossThreshold) {
+  fecLossThreshold_ = std::clamp(lossThreshold, 0.001, 0.5);
+  fecEnabled_ = enabled;
+}
+
+void SteamVpnBridge::sampleSendQueues() {
+  const int64_t now = steadyNowMs();
+  if (!steamManager_ || now < nextSendQueueSampleMs_) {
+    return;
+  }
+  nextSendQueueSampleMs_ = now + kSendQueueSampleMs;
+
+  const PeerContextsPtr peers = loadPeerContexts();
+  for (const auto &kv : *peers) {
+    PeerContext &peer = *kv.second;
+    SteamVpnNetworkingManager::SendQueueStatus steam;
+    steamManager_->getPeerSendQueue(peer.steamID, steam);
+    peer.sendPendingBytes.store(steam.pendingBytes, std::memory_order_relaxed);
+    peer.sendQueueTimeUsec.store(steam.queueTimeUsec,
+                                 std::memory_order_relaxed);
+    peer.sendRateBytesPerSec.store(steam.sendRateBytesPerSec,
+                                   std::memory_order_relaxed);
+    peer.remoteQuality.store(steam.remoteQuality, std::memory_order_relaxed);
+    peer.sentSinceSample.store(0, std::memory_order_relaxed);
+    if (steam.remoteQuality >= 0.0f) {
+      peer.lossy.store(1.0 - steam.remoteQuality > kJumboMaxLoss,
+                       std::memory_order_relaxed);
+    }
+  }
+}
+
+void SteamVpnBridge::drainBackloggedEgress(TunQueue &queue) {
+  const PeerContextsPtr peers = loadPeerContexts();
+  for (const auto &kv : *peers) {
+    if (kv.second->egressBacklogged.load(std::memory_order_relaxed)) {
+      drainEgress(queue, *kv.second);
+    }
+  }
+}
+
+void SteamVpnBridge::waitForTunActivity(TunQueue &queue) {
+#ifdef __linux__
+  const int tunFd =
+      tunDevice_ ? tunDevice_->get_queue_read_fd(queue.index) : -1;
+  if (tunFd >= 0 && queue.wakeFd >= 0) {
+    // Sleep until a packet arrives, stop() or a new probe deadline wakes us,
+    // or the current probe deadline (queue 0: at most the path MTU tick,
+    // the egress retry while packets are held, or the end of a waiting
+    // bundle's aggregation window) expires.
+    const bool backlogged =
+        egressBackloggedPeers_.load(std::memory_order_relaxed) > 0;
+    const int64_t tickMs =
+        backlogged ? kEgressRetryMs : kPathMaintenanceIntervalMs;
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (queue.index == 0) {
+      deadline = std::min(ipNegotiator_.nextDeadline(),
+                          std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(tickMs));
+      if (backlogged) {
+        const PeerContextsPtr peers = loadPeerContexts();
+        for (const auto &kv : *peers) {
+          const int64_t bundleUs =
+              kv.second->bundleDeadlineUs.load(std::memory_order_relaxed);
+          if (bundleUs != 0) {
+            deadline = std::min(deadline,
+                                std::chrono::steady_clock::time_point(
+                                    std::chrono::microseconds(bundleUs)));
+          }
+        }
+      }
+    }
+    // ppoll rather than poll: aggregation windows are finer than 1 ms.
+    timespec timeout{};
+    timespec *timeoutPtr = nullptr;
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      const int64_t remainingNs = std::max<int64_t>(
+          0, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 deadline - std::chrono::steady_clock::now())
+                 .count());
+      timeout.tv_sec = static_cast<time_t>(remainingNs / 1000000000);
+      timeout.tv_nsec = static_cast<long>(remainingNs % 1000000000);
+      timeoutPtr = &timeout;
+    }
+    pollfd fds[2] = {{tunFd, POLLIN, 0}, {queue.wakeFd, POLLIN, 0}};
+    if (::ppoll(fds, 2, timeoutPtr, nullptr) > 0 &&
+        (fds[1].revents & POLLIN)) {
+      uint64_t value = 0;
+      [[maybe_unused]] const ssize_t drained =
+          ::read(queue.wakeFd, &value, sizeof(value));
+    }
+    return;
+  }
+#endif
+  // No pollable handle; yield briefly to avoid spinning a full core.
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+}
+
+void SteamVpnBridge::wakeTunQueue(size_t index) {
+#ifdef __linux__
+  if (index < tunQueues_.size() && tunQueues_[index]->wakeFd >= 0) {
+    const uint64_t one = 1;
+    [[maybe_unused]] const ssize_t written =
+        ::write(tunQueues_[index]->wakeFd, &one, sizeof(one));
+  }
+#else
+  (void)index;
+#endif
+}
+
+void SteamVpnBridge::wakeTunThreads() {
+  for (size_t i = 0; i < tunQueues_.size(); ++i) {
+    wakeTunQueue(i);
+  }
+}
+
+void SteamVpnBridge::writeToTun(const uint8_t *packet, size_t length) {
+  const int queueCount =
+      std::min(tunDevice_->queue_count(), static_cast<int>(tunQueues_.size()));
+  const int index =
+      queueCount > 1 ? static_cast<int>(FlowScheduler::flowHash(packet, length) %
+                                        queueCount)
+                     : 0;
+  tunDevice_->write_queue(index, packet, length);
+  if (index < static_cast<int>(tunQueues_.size())) {
+    TunQueue &queue = *tunQueues_[index];
+    queue.packetsWritten.fetch_add(1, std::memory_order_relaxed);
+    queue.bytesWritten.fetch_add(length, std::memory_order_relaxed);
+  }
+}
+
+bool SteamVpnBridge::enqueueTunWrite(const uint8_t *packet, size_t length,
+                                     uint16_t maxMss) {
+  const bool queued = tunWriteRing_.push([&](std::vector<uint8_t> &slot) {
+    slot.assign(packet, packet + length);
+    if (maxMss != 0 && TcpMssClamp::clamp(slot.data(), slot.size(), maxMss)) {
+      bumpCounter(rxCounters_.mssClamped);
+    }
+  });
+  if (!queued) {
+    tunWriteDrops_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return queued;
+}
+
+void SteamVpnBridge::flushTunWrites() { wakeTunWriter(); }
+
+void SteamVpnBridge::wakeTunWriter() {
+  // Pairs with the fence in tunWriteThread: either the writer sees the new
+  // packets before sleeping or we see it asleep.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (tunWriterSleeping_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(tunWriteMutex_);
+    tunWriteCv_.notify_one();
+  }
+}
+
+void SteamVpnBridge::tunWriteThread() {
+  std::cout << "TUN write thread started" << std::endl;
+  auto write = [this](std::vector<uint8_t> &packet) {
+    writeToTun(packet.data(), packet.size());
+  };
+  while (running_) {
+    bool wrote = false;
+    while (tunWriteRing_.pop(write)) {
+      wrote = true;
+    }
+    if (wrote) {
+      // Ring drained: push out whatever the device held back to coalesce.
+      tunDevice_->flush();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(tunWriteMutex_);
+    tunWriterSleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (tunWriteRing_.empty() && running_) {
+      tunWriteCv_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    tunWriterSleeping_.store(false, std::memory_order_relaxed);
+  }
+  std::cout << "TUN write thread stopped" << std::endl;
+}
+
+void SteamVpnBridge::joinTunWriter() {
+  {
+    std::lock_guard<std::mutex> lock(tunWriteMutex_);
+    tunWriteCv_.notify_one();
+  }
+  if (tunWriteThread_ && tunWriteThread_->joinable()) {
+    tunWriteThread_->join();
+  }
+  tunWriteThread_.reset();
+  // Packets left over belong to the session that just ended.
+  while (tunWriteRing_.pop([](std::vector<uint8_t> &) {})) {
+  }
+}
+
+std::vector<SteamVpnBridge::QueueStatistics>
+SteamVpnBridge::getQueueStatistics() const {
+  std::vector<QueueStatistics> result;
+  for (const auto &queue : tunQueues_) {
+    QueueStatistics stats;
+    stats.packetsRead = queue->packetsRead.load(std::memory_order_relaxed);
+    stats.bytesRead = queue->bytesRead.load(std::memory_order_relaxed);
+    stats.packetsWritten =
+        queue->packetsWritten.load(std::memory_order_relaxed);
+    stats.bytesWritten = queue->bytesWritten.load(std::memory_order_relaxed);
+    result.push_back(stats);
+  }
+  return result;
 }
 
 void SteamVpnBridge::handleVpnMessage(const uint8_t *data, size_t length,
@@ -254,49 +1052,27 @@ void SteamVpnBridge::handleVpnMessage(const uint8_t *data, size_t length,
     return;
   }
   const uint8_t *payload = data + sizeof(VpnMessageHeader);
-  const std::string peerName =
-      SteamFriends() ? SteamFriends()->GetFriendPersonaName(senderSteamID) : "";
-
-  if (header.type == VpnMessageType::IP_PACKET) {
-    if (tunDevice_ && payloadLength > sizeof(VpnPacketWrapper)) {
-      VpnPacketWrapper wrapper{};
-      std::memcpy(&wrapper, payload, sizeof(VpnPacketWrapper));
-      const uint8_t *ipPacket = payload + sizeof(VpnPacketWrapper);
-      const size_t ipPacketLen = payloadLength - sizeof(VpnPacketWrapper);
-      const uint32_t destIP = extractDestIP(ipPacket, ipPacketLen);
-      const uint32_t senderIP = ntohl(wrapper.sourceIP);
-
-      CSteamID conflicting;
-      const uint32_t conflictIP = senderIP != 0 ? senderIP : destIP;
-      if (heartbeatManager_.detectConflict(conflictIP, wrapper.senderNodeId,
-                                           conflicting) &&
-          conflicting != senderSteamID) {
-        sendVpnMessage(VpnMessageType::FORCED_RELEASE, payload, payloadLength,
-                       conflicting, true);
-      }
+  const std::shared_ptr<PeerContext> peer = peerContext(senderSteamID);
+  if (!peer) {
+    return; // not (or no longer) in the lobby
+  }
+  const int64_t nowMs = steadyNowMs();
+  peer->lastSeenMs.store(nowMs, std::memory_order_relaxed);
+  bumpCounter(peer->messagesReceived);
+  bumpCounter(peer->bytesReceived, length);
+  bumpCounter(rxCounters_.receivedByType[messageTypeSlot(header.type)]);
 
-      if (destIP == localIP_ || isBroadcastAddress(destIP)) {
-        tunDevice_->write(ipPacket, ipPacketLen);
-        std::lock_guard<std::mutex> lock(statsMutex_);
-        stats_.packetsReceived++;
-        stats_.bytesReceived += ipPacketLen;
-      } else {
-        CSteamID targetSteamID;
-        bool found = false;
-        {
-          std::lock_guard<std::mutex> lock(routingMutex_);
-          auto it = routingTable_.find(destIP);
-          if (it != routingTable_.end() && !it->second.isLocal) {
-            targetSteamID = it->second.steamID;
-            found = true;
-          }
-        }
-        if (found && targetSteamID != senderSteamID) {
-          sendVpnMessage(VpnMessageType::IP_PACKET, payload, payloadLength,
-                         targetSteamID, false);
-        }
-      }
+  if (header.type == VpnMessageType::IP_PACKET ||
+      header.type == VpnMessageType::IP_PACKET_COMPACT ||
+      header.type == VpnMessageType::IP_PACKET_BUNDLE ||
+      header.type == VpnMessageType::IP_PACKET_SEGMENT) {
+    // While the peer sends parity, keep its data messages to rebuild from.
+    if (nowMs - peer->fecSeenMs < kFecReceiveIdleMs &&
+        !peer->fecDecoder.remember(data,
+                                   sizeof(VpnMessageHeader) + payloadLength)) {
+      return; // arrived after all, but was already rebuilt
     }
+    handleIpMessage(header.type, payload, payloadLength, *peer);
     return;
   }
 
@@ -312,21 +1088,18 @@ void SteamVpnBridge::handleVpnMessage(const uint8_t *data, size_t length,
       offset += 12;
 
       CSteamID csteamID(static_cast<uint64>(steamID));
-      if (SteamUser() && csteamID == SteamUser()->GetSteamID()) {
+      if (csteamID == localSteamID_) {
         continue;
       }
-      {
-        std::lock_guard<std::mutex> lock(routingMutex_);
-        if (routingTable_.find(ipAddress) != routingTable_.end()) {
-          continue;
-        }
+      if (loadRoutes()->contains(ipAddress)) {
+        continue;
       }
       if ((ipAddress & subnetMask_) == (baseIP_ & subnetMask_)) {
-        NodeID nodeId = NodeIdentity::generate(csteamID);
-        updateRoute(nodeId, csteamID, ipAddress,
-                    SteamFriends()
-                        ? SteamFriends()->GetFriendPersonaName(csteamID)
-                        : "");
+        // Members announce themselves; anyone else named here is ignored.
+        const std::shared_ptr<PeerContext> routed = peerContext(csteamID);
+        if (routed) {
+          updateRoute(routed->nodeId, csteamID, ipAddress, peerName(*routed));
+        }
       }
     }
     break;
@@ -352,16 +1125,106 @@ void SteamVpnBridge::handleVpnMessage(const uint8_t *data, size_t length,
       AddressAnnouncePayload announce{};
       std::memcpy(&announce, payload, sizeof(AddressAnnouncePayload));
       const uint32_t announcedIP = ntohl(announce.ipAddress);
-      bool isNewRoute = false;
-      {
-        std::lock_guard<std::mutex> lock(routingMutex_);
-        isNewRoute = routingTable_.find(announcedIP) == routingTable_.end();
-      }
-      ipNegotiator_.handleAddressAnnounce(announce, senderSteamID, peerName);
-      updateRoute(announce.nodeId, senderSteamID, announcedIP, peerName);
+      const bool isNewRoute = !loadRoutes()->contains(announcedIP);
+      const std::string name = peerName(*peer);
+      ipNegotiator_.handleAddressAnnounce(announce, senderSteamID, name);
+      updateRoute(announce.nodeId, senderSteamID, announcedIP, name);
       if (isNewRoute) {
         broadcastRouteUpdate();
       }
+      if (payloadLength >= sizeof(AddressAnnounceSessionPayload)) {
+        AddressAnnounceSessionPayload session{};
+        std::memcpy(&session, payload, sizeof(AddressAnnounceSessionPayload));
+        peer->remoteNodeId = announce.nodeId;
+        peer->remoteSessionIndex = ntohs(session.sessionIndex);
+        if (peer->remoteSessionIndex != 0) {
+          SessionAckFeaturesPayload ack{};
+          ack.ack.sessionIndex = session.sessionIndex;
+          ack.features = kSessionFeatureBundles | kSessionFeatureSegments;
+          sendVpnMessage(VpnMessageType::SESSION_ACK,
+                         reinterpret_cast<const uint8_t *>(&ack), sizeof(ack),
+                         senderSteamID, true);
+        }
+      }
+    }
+    break;
+  }
+  case VpnMessageType::SESSION_ACK: {
+    if (payloadLength >= sizeof(SessionAckPayload)) {
+      SessionAckPayload ack{};
+      std::memcpy(&ack, payload, sizeof(SessionAckPayload));
+      const uint16_t index = ntohs(ack.sessionIndex);
+      if (index != 0 && index == localSessionIndex_) {
+        uint8_t features = 0;
+        if (payloadLength >= sizeof(SessionAckFeaturesPayload)) {
+          std::memcpy(&features,
+                      payload + offsetof(SessionAckFeaturesPayload, features),
+                      sizeof(features));
+        }
+        peer->bundlesReady = (features & kSessionFeatureBundles) != 0;
+        peer->segmentsReady = (features & kSessionFeatureSegments) != 0;
+        if (!peer->compactReady.exchange(true)) {
+          std::cout << "[SteamVPN] Compact IP headers enabled to "
+                    << senderSteamID.ConvertToUint64()
+                    << (peer->bundlesReady ? " (with bundles)" : "")
+                    << std::endl;
+        }
+      } else {
+        // The peer lost (or never had) our index; fall back and re-announce.
+        peer->compactReady = false;
+        peer->bundlesReady = false;
+        peer->segmentsReady = false;
+        ipNegotiator_.sendAddressAnnounceTo(senderSteamID);
+      }
+    }
+    break;
+  }
+  case VpnMessageType::PMTU_PROBE: {
+    if (payloadLength >= sizeof(PmtuProbePayload)) {
+      sendVpnMessage(VpnMessageType::PMTU_PROBE_ACK, payload,
+                     sizeof(PmtuProbePayload), senderSteamID, false);
+    }
+    break;
+  }
+  case VpnMessageType::FEC_PARITY: {
+    // The first parity after a pause only starts the message history.
+    const bool warm = nowMs - peer->fecSeenMs < kFecReceiveIdleMs;
+    peer->fecSeenMs = nowMs;
+    if (!warm) {
+      peer->fecDecoder.clear();
+      break;
+    }
+    static thread_local std::vector<uint8_t> recovered;
+    size_t missing = 0;
+    const XorFecDecoder::Result result =
+        peer->fecDecoder.recover(payload, payloadLength, recovered, missing);
+    if (result == XorFecDecoder::Result::Unrecoverable) {
+      bumpCounter(rxCounters_.fecLost, missing);
+      break;
+    }
+    if (result != XorFecDecoder::Result::Recovered ||
+        recovered.size() < sizeof(VpnMessageHeader)) {
+      break;
+    }
+    VpnMessageHeader inner;
+    std::memcpy(&inner, recovered.data(), sizeof(VpnMessageHeader));
+    const size_t innerLength = ntohs(inner.length);
+    if ((inner.type == VpnMessageType::IP_PACKET ||
+         inner.type == VpnMessageType::IP_PACKET_COMPACT ||
+         inner.type == VpnMessageType::IP_PACKET_BUNDLE ||
+         inner.type == VpnMessageType::IP_PACKET_SEGMENT) &&
+        recovered.size() >= sizeof(VpnMessageHeader) + innerLength) {
+      bumpCounter(rxCounters_.fecRecovered);
+      handleIpMessage(inner.type, recovered.data() + sizeof(VpnMessageHeader),
+                      static_cast<uint16_t>(innerLength), *peer);
+    }
+    break;
+  }
+  case VpnMessageType::PMTU_PROBE_ACK: {
+    if (payloadLength >= sizeof(PmtuProbePayload)) {
+      PmtuProbePayload ack{};
+      std::memcpy(&ack, payload, sizeof(PmtuProbePayload));
+      handlePmtuProbeAck(*peer, ack);
     }
     break;
   }
@@ -377,7 +1240,8 @@ void SteamVpnBridge::handleVpnMessage(const uint8_t *data, size_t length,
     if (payloadLength >= sizeof(HeartbeatPayload)) {
       HeartbeatPayload heartbeat{};
       std::memcpy(&heartbeat, payload, sizeof(HeartbeatPayload));
-      heartbeatManager_.handleHeartbeat(heartbeat, senderSteamID, peerName);
+      heartbeatManager_.handleHeartbeat(heartbeat, senderSteamID,
+                                        peerName(*peer));
     }
     break;
   }
@@ -386,7 +1250,326 @@ void SteamVpnBridge::handleVpnMessage(const uint8_t *data, size_t length,
   }
 }
 
+void SteamVpnBridge::handleIpMessage(VpnMessageType type,
+                                     const uint8_t *payload,
+                                     uint16_t payloadLength,
+                                     PeerContext &peer) {
+  if (type == VpnMessageType::IP_PACKET_SEGMENT) {
+    static thread_local std::vector<uint8_t> message;
+    const uint64_t abandoned = peer.reassembler.abandoned();
+    const bool complete = peer.reassembler.add(
+        payload, payloadLength, std::chrono::steady_clock::now(), message);
+    bumpCounter(rxCounters_.reassemblyFailures,
+                peer.reassembler.abandoned() - abandoned);
+    if (!complete || message.size() < sizeof(VpnMessageHeader)) {
+      return;
+    }
+    VpnMessageHeader inner;
+    std::memcpy(&inner, message.data(), sizeof(VpnMessageHeader));
+    const size_t innerLength = ntohs(inner.length);
+    if ((inner.type == VpnMessageType::IP_PACKET ||
+         inner.type == VpnMessageType::IP_PACKET_COMPACT) &&
+        message.size() >= sizeof(VpnMessageHeader) + innerLength) {
+      bumpCounter(rxCounters_.messagesReassembled);
+      handleIpMessage(inner.type, message.data() + sizeof(VpnMessageHeader),
+                      static_cast<uint16_t>(innerLength), peer);
+    } else {
+      bumpCounter(rxCounters_.packetsDropped);
+    }
+    return;
+  }
+  if (type == VpnMessageType::IP_PACKET) {
+    if (payloadLength > sizeof(VpnPacketWrapper)) {
+      VpnPacketWrapper wrapper{};
+      std::memcpy(&wrapper, payload, sizeof(VpnPacketWrapper));
+      handleIpPacket(payload + sizeof(VpnPacketWrapper),
+                     payloadLength - sizeof(VpnPacketWrapper),
+                     wrapper.senderNodeId, ntohl(wrapper.sourceIP), peer,
+                     payload, payloadLength);
+    }
+    return;
+  }
+  if (payloadLength > sizeof(CompactPacketHeader)) {
+    CompactPacketHeader compact{};
+    std::memcpy(&compact, payload, sizeof(CompactPacketHeader));
+    const uint16_t index = ntohs(compact.sessionIndex);
+    if (index != 0 && index == peer.remoteSessionIndex) {
+      const uint8_t *packets = payload + sizeof(CompactPacketHeader);
+      const size_t packetsLength = payloadLength - sizeof(CompactPacketHeader);
+      auto deliver = [&](const uint8_t *ipPacket, size_t ipPacketLen) {
+        handleIpPacket(ipPacket, ipPacketLen, peer.remoteNodeId,
+                       extractSourceIP(ipPacket, ipPacketLen), peer, nullptr,
+                       0);
+      };
+      if (type != VpnMessageType::IP_PACKET_BUNDLE) {
+        deliver(packets, packetsLength);
+      } else if (!PacketBundler::forEach(packets, packetsLength, deliver)) {
+        bumpCounter(rxCounters_.packetsDropped);
+      }
+    } else {
+      bumpCounter(rxCounters_.packetsDropped);
+      requestSessionResync(peer);
+    }
+  }
+}
+
+void SteamVpnBridge::handleIpPacket(const uint8_t *ipPacket, size_t ipPacketLen,
+                                    const NodeID &senderNodeId,
+                                    uint32_t senderIP, PeerContext &sender,
+                                    const uint8_t *wrapped,
+                                    size_t wrappedLength) {
+  if (!tunDevice_) {
+    return;
+  }
+  // Compact packets carry no wrapper; rebuild it, with the IP_PACKET header
+  // in front like a received message, only when one must be sent on.
+  static thread_local std::vector<uint8_t> rebuilt;
+  auto ensureWrapped = [&]() {
+    if (wrapped) {
+      return;
+    }
+    VpnMessageHeader header{};
+    header.type = VpnMessageType::IP_PACKET;
+    header.length =
+        htons(static_cast<uint16_t>(sizeof(VpnPacketWrapper) + ipPacketLen));
+    VpnPacketWrapper wrapper{};
+    wrapper.senderNodeId = senderNodeId;
+    wrapper.sourceIP = htonl(senderIP);
+    rebuilt.resize(sizeof(VpnMessageHeader) + sizeof(VpnPacketWrapper) +
+                   ipPacketLen);
+    std::memcpy(rebuilt.data(), &header, sizeof(VpnMessageHeader));
+    std::memcpy(rebuilt.data() + sizeof(VpnMessageHeader), &wrapper,
+                sizeof(VpnPacketWrapper));
+    std::memcpy(rebuilt.data() + kTunFrameHeadroom, ipPacket, ipPacketLen);
+    wrapped = rebuilt.data() + sizeof(VpnMessageHeader);
+    wrappedLength = rebuilt.size() - sizeof(VpnMessageHeader);
+  };
+
+  const uint32_t destIP = extractDestIP(ipPacket, ipPacketLen);
+  CSteamID conflicting;
+  const uint32_t conflictIP = senderIP != 0 ? senderIP : destIP;
+  if (heartbeatManager_.detectConflict(conflictIP, senderNodeId,
+                                       conflicting) &&
+      conflicting != sender.steamID) {
+    ensureWrapped();
+    sendVpnMessage(VpnMessageType::FORCED_RELEASE, wrapped, wrappedLength,
+                   conflicting, true);
+  }
+
+  // Over a limit: dropped here, before it costs a TUN write or uplink.
+  const auto now = TokenBucket::Clock::now();
+  auto overLimit = [&](TokenBucket &bucket,
+                       const std::atomic<uint64_t> &limit) {
+    if (bucket.take(ipPacketLen, limit.load(std::memory_order_relaxed),
+                    now)) {
+      return false;
+    }
+    bumpCounter(rxCounters_.rateLimited);
+    bumpCounter(rxCounters_.packetsDropped);
+    // Shared with the TUN queues' egress limit: not single-writer.
+    sender.usage->bytesRateLimited.fetch_add(ipPacketLen,
+                                             std::memory_order_relaxed);
+    return true;
+  };
+
+  if (destIP == localIP_ || isBroadcastAddress(destIP)) {
+    if (overLimit(sender.ingressBucket, sender.ingressLimit)) {
+      return;
+    }
+    if ((destIP >> 28) == 0xE) {
+      multicastFilter_.snoop(sender.steamID, ipPacket, ipPacketLen, now);
+    }
+    const uint16_t maxMss =
+        TcpMssClamp::isSyn(ipPacket, ipPacketLen) ? pathMss(sender) : 0;
+    if (enqueueTunWrite(ipPacket, ipPacketLen, maxMss)) {
+      bumpCounter(rxCounters_.packetsReceived);
+      bumpCounter(rxCounters_.bytesReceived, ipPacketLen);
+      bumpCounter(sender.usage->bytesReceived, ipPacketLen);
+    }
+  } else {
+    const RoutingSnapshotPtr routes = loadRoutes();
+    const RoutingSnapshot::Hop *hop = routes->find(destIP);
+    if (hop && !hop->isLocal && hop->steamID != sender.steamID) {
+      if (overLimit(sender.forwardBucket, sender.forwardLimit)) {
+        return;
+      }
+      ensureWrapped();
+      // Forward the message exactly as received, header and all.
+      steamManager_->sendMessageToUser(
+          hop->steamID, wrapped - sizeof(VpnMessageHeader),
+          static_cast<uint32_t>(sizeof(VpnMessageHeader) + wrappedLength),
+          k_nSteamNetworkingSend_UnreliableNoNagle |
+              k_nSteamNetworkingSend_NoDelay);
+      bumpCounter(rxCounters_.packetsSent);
+      bumpCounter(rxCounters_.bytesSent, ipPacketLen);
+      bumpCounter(
+          rxCounters_.sentByType[messageTypeSlot(VpnMessageType::IP_PACKET)]);
+      bumpCounter(sender.usage->bytesForwarded, ipPacketLen);
+    } else {
+      bumpCounter(rxCounters_.packetsDropped);
+    }
+  }
+}
+
+void SteamVpnBridge::requestSessionResync(PeerContext &peer) {
+  const int64_t now = steadyNowMs();
+  if (now - peer.lastResyncMs < kSessionResyncIntervalMs) {
+    return;
+  }
+  peer.lastResyncMs = now;
+  std::cout << "[SteamVPN] Unknown compact session from "
+            << peer.steamID.ConvertToUint64() << ", asking for re-announce"
+            << std::endl;
+  SessionAckPayload nack{};
+  nack.sessionIndex = 0;
+  sendVpnMessage(VpnMessageType::SESSION_ACK,
+                 reinterpret_cast<const uint8_t *>(&nack), sizeof(nack),
+                 peer.steamID, true);
+}
+
+bool SteamVpnBridge::useCompactHeader(PeerContext &peer, int64_t nowMs) {
+  if (!peer.compactReady.load(std::memory_order_relaxed)) {
+    return false;
+  }
+  // A full wrapper now and then lets the receiver re-check the NodeID.
+  if (nowMs - peer.lastFullWrapperMs.load(std::memory_order_relaxed) >=
+      kFullWrapperIntervalMs) {
+    peer.lastFullWrapperMs.store(nowMs, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+size_t SteamVpnBridge::messageBudget(PeerContext &peer) {
+  // Steam is asked at most every few seconds per peer.
+  const int64_t now = steadyNowMs();
+  if (now - peer.pathCheckedMs.load(std::memory_order_relaxed) >=
+      kPathRecheckMs) {
+    peer.pathCheckedMs.store(now, std::memory_order_relaxed);
+    peer.relayed.store(steamManager_->isPeerRelayed(peer.steamID),
+                       std::memory_order_relaxed);
+    peer.steamMtu.store(steamManager_->getPeerMessageMtu(peer.steamID),
+                        std::memory_order_relaxed);
+  }
+  size_t budget = static_cast<size_t>(
+      std::max(0, peer.steamMtu.load(std::memory_order_relaxed)));
+  if (budget == 0) {
+    budget = peer.relayed.load(std::memory_order_relaxed)
+                 ? kRelayMessageBudget
+                 : kDirectMessageBudget;
+  }
+  const size_t probed = peer.probedSize.load(std::memory_order_relaxed);
+  if (probed != 0) {
+    budget = std::min(budget, probed);
+  }
+  return std::max(budget, kTunFrameHeadroom + kMinPathMtu);
+}
+
+uint16_t SteamVpnBridge::peerMtu(PeerContext &peer) {
+  // Sized for the full wrapper; compact packets then have room to spare.
+  size_t mtu = std::min(messageBudget(peer) - kTunFrameHeadroom,
+                        static_cast<size_t>(mtu_));
+  // Jumbo frames are split over several messages, so they are only worth
+  // it where few of those get lost; elsewhere they fall back to one packet.
+  if (jumbo_ && peer.segmentsReady.load(std::memory_order_relaxed) &&
+      !peer.relayed.load(std::memory_order_relaxed) &&
+      !peer.lossy.load(std::memory_order_relaxed)) {
+    mtu = static_cast<size_t>(mtu_);
+  }
+  peer.pathMtu.store(static_cast<uint16_t>(mtu), std::memory_order_relaxed);
+  return static_cast<uint16_t>(mtu);
+}
+
+uint16_t SteamVpnBridge::pathMss(PeerContext &peer) {
+  return static_cast<uint16_t>(peerMtu(peer) - kIpTcpHeaderBytes);
+}
+
+void SteamVpnBridge::maintainPathMtu() {
+  const int64_t now = steadyNowMs();
+  if (now < nextPathMaintenanceMs_) {
+    return;
+  }
+  nextPathMaintenanceMs_ = now + kPathMaintenanceIntervalMs;
+
+  std::vector<std::shared_ptr<PeerContext>> peers;
+  {
+    std::lock_guard<std::mutex> lock(peerContextsMutex_);
+    peers.reserve(peerContexts_.size());
+    for (const auto &kv : peerContexts_) {
+      peers.push_back(kv.second);
+    }
+  }
+  static thread_local std::vector<uint8_t> probe;
+  for (const auto &peer : peers) {
+    const int64_t sentMs = peer->probeSentMs.load(std::memory_order_relaxed);
+    if (sentMs != 0 && now - sentMs >= kProbeTimeoutMs) {
+      // Nothing back at all says more about the peer than the path; keep
+      // the previous result then.
+      const uint16_t best = peer->probeBest.load(std::memory_order_relaxed);
+      if (best != 0) {
+        if (best != peer->probedSize.load(std::memory_order_relaxed)) {
+          std::cout << "[SteamVPN] Path to " << peer->steamID.ConvertToUint64()
+                    << " carries messages up to " << best << " bytes"
+                    << std::endl;
+        }
+        peer->probedSize.store(best, std::memory_order_relaxed);
+      }
+      peer->probeSentMs.store(0, std::memory_order_relaxed);
+    }
+    if (now - peer->lastProbeRoundMs < kProbeIntervalMs) {
+      continue;
+    }
+    peer->lastProbeRoundMs = now;
+    const uint16_t round = static_cast<uint16_t>(
+        peer->probeRound.load(std::memory_order_relaxed) + 1);
+    peer->probeBest.store(0, std::memory_order_relaxed);
+    peer->probeRound.store(round, std::memory_order_relaxed);
+    peer->probeSentMs.store(now, std::memory_order_relaxed);
+    const size_t largest = kTunFrameHeadroom + static_cast<size_t>(mtu_);
+    bool sentLargest = false;
+    for (size_t size : kProbeSizes) {
+      if (size >= largest) {
+        if (sentLargest) {
+          continue;
+        }
+        size = largest;
+        sentLargest = true;
+      }
+      PmtuProbePayload payload{};
+      payload.probeSize = htons(static_cast<uint16_t>(size));
+      payload.round = htons(round);
+      probe.assign(size - sizeof(VpnMessageHeader), 0);
+      std::memcpy(probe.data(), &payload, sizeof(payload));
+      sendVpnMessage(VpnMessageType::PMTU_PROBE, probe.data(), probe.size(),
+                     peer->steamID, false);
+    }
+  }
+}
+
+void SteamVpnBridge::handlePmtuProbeAck(PeerContext &peer,
+                                        const PmtuProbePayload &ack) {
+  if (ntohs(ack.round) != peer.probeRound.load(std::memory_order_relaxed) ||
+      peer.probeSentMs.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  const uint16_t size = ntohs(ack.probeSize);
+  if (size > peer.probeBest.load(std::memory_order_relaxed)) {
+    peer.probeBest.store(size, std::memory_order_relaxed);
+  }
+}
+
+void SteamVpnBridge::rejectOversized(TunQueue &queue, const uint8_t *packet,
+                                     size_t length, uint16_t mtu) {
+  if (IcmpFeedback::fragmentationNeeded(packet, length, mtu, queue.icmp)) {
+    tunDevice_->write_queue(queue.index, queue.icmp.data(), queue.icmp.size());
+    tunDevice_->flush();
+  }
+  bumpCounter(queue.counters.pmtuRejected);
+  bumpCounter(queue.counters.packetsDropped);
+}
+
 void SteamVpnBridge::onUserJoined(CSteamID steamID) {
+  peerContext(steamID);
   if (ipNegotiator_.getState() == NegotiationState::STABLE) {
     std::cout << "[SteamVPN] New peer joined, sending address/route: "
               << steamID.ConvertToUint64() << std::endl;
@@ -396,29 +1579,272 @@ void SteamVpnBridge::onUserJoined(CSteamID steamID) {
 }
 
 void SteamVpnBridge::onUserLeft(CSteamID steamID) {
-  std::lock_guard<std::mutex> lock(routingMutex_);
-  for (auto it = routingTable_.begin(); it != routingTable_.end();) {
-    if (it->second.steamID == steamID) {
-      heartbeatManager_.unregisterNode(it->second.nodeId);
-      ipNegotiator_.markIPUnused(it->first);
-      it = routingTable_.erase(it);
-    } else {
-      ++it;
+  multicastFilter_.removePeer(steamID);
+  std::shared_ptr<PeerContext> departed;
+  {
+    std::lock_guard<std::mutex> lock(peerContextsMutex_);
+    auto it = peerContexts_.find(steamID);
+    if (it != peerContexts_.end()) {
+      departed = std::move(it->second);
+      peerContexts_.erase(it);
+      publishPeerContextsLocked();
+    }
+  }
+  if (departed) {
+    // Nothing held for the peer can be delivered any more.
+    std::lock_guard<std::mutex> lock(departed->egressMutex);
+    departed->egress.clear();
+    departed->bundler.reset();
+    if (departed->egressBacklogged.exchange(false)) {
+      egressBackloggedPeers_.fetch_sub(1, std::memory_order_relaxed);
     }
   }
+  {
+    std::lock_guard<std::mutex> lock(routingMutex_);
+    for (auto it = routingTable_.begin(); it != routingTable_.end();) {
+      if (it->second.steamID == steamID) {
+        heartbeatManager_.unregisterNode(it->second.nodeId);
+        ipNegotiator_.markIPUnused(it->first);
+        it = routingTable_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    publishRoutesLocked();
+  }
   if (SteamUser() && steamID == SteamUser()->GetSteamID()) {
-    running_ = false;
-    heartbeatManager_.stop();
-    if (tunDevice_) {
-      tunDevice_->close();
+    // Our own leave ends the session. stop() wakes and joins the TUN
+    // threads before the device, and its queues, are closed under them.
+    stop();
+  }
+}
+
+void SteamVpnBridge::onPeerPersonaChanged(CSteamID steamID) {
+  const std::string name =
+      SteamFriends() ? SteamFriends()->GetFriendPersonaName(steamID) : "";
+  {
+    std::lock_guard<std::mutex> lock(peerContextsMutex_);
+    auto it = peerContexts_.find(steamID);
+    if (it == peerContexts_.end()) {
+      return;
     }
-    localIP_ = 0;
+    std::atomic_store(&it->second->name,
+                      std::make_shared<const std::string>(name));
+  }
+  std::lock_guard<std::mutex> lock(routingMutex_);
+  bool renamed = false;
+  for (auto &kv : routingTable_) {
+    if (kv.second.steamID == steamID && kv.second.name != name) {
+      kv.second.name = name;
+      renamed = true;
+    }
+  }
+  if (renamed) {
+    publishRoutesLocked();
   }
 }
 
+std::shared_ptr<SteamVpnBridge::PeerContext>
+SteamVpnBridge::peerContext(CSteamID steamID) {
+  {
+    const PeerContextsPtr peers = loadPeerContexts();
+    auto it = peers->find(steamID);
+    if (it != peers->end()) {
+      return it->second;
+    }
+  }
+  if (!steamManager_ || !steamManager_->isPeer(steamID)) {
+    return nullptr;
+  }
+  // First contact pays for the name lookup and NodeID hash once.
+  auto peer = std::make_shared<PeerContext>();
+  peer->steamID = steamID;
+  peer->nodeId = NodeIdentity::generate(steamID);
+  peer->name = std::make_shared<const std::string>(
+      SteamFriends() ? SteamFriends()->GetFriendPersonaName(steamID) : "");
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  auto it = peerContexts_.find(steamID);
+  if (it != peerContexts_.end()) {
+    return it->second;
+  }
+  // Asked again under the lock: a peer leaves the manager's snapshot before
+  // onUserLeft() runs, so one removed meanwhile is not re-added behind it.
+  if (!steamManager_->isPeer(steamID)) {
+    return nullptr;
+  }
+  std::shared_ptr<PeerUsage> &usage = sessionUsage_[steamID];
+  if (!usage) {
+    usage = std::make_shared<PeerUsage>();
+  }
+  peer->usage = usage;
+  applyRateLimitsLocked(*peer);
+  peerContexts_.emplace(steamID, peer);
+  publishPeerContextsLocked();
+  return peer;
+}
+
+SteamVpnBridge::PeerContextsPtr SteamVpnBridge::loadPeerContexts() const {
+  return std::atomic_load(&peerSnapshot_);
+}
+
+void SteamVpnBridge::publishPeerContextsLocked() {
+  std::atomic_store(&peerSnapshot_, PeerContextsPtr(std::make_shared<
+                                        const PeerContextMap>(peerContexts_)));
+}
+
+void SteamVpnBridge::applyRateLimitsLocked(PeerContext &peer) const {
+  auto it = peerRateLimits_.find(peer.steamID);
+  const RateLimits &limits =
+      it != peerRateLimits_.end() ? it->second : defaultRateLimits_;
+  peer.egressLimit.store(limits.egressBytesPerSec, std::memory_order_relaxed);
+  peer.ingressLimit.store(limits.ingressBytesPerSec,
+                          std::memory_order_relaxed);
+  peer.forwardLimit.store(limits.forwardBytesPerSec,
+                          std::memory_order_relaxed);
+}
+
+void SteamVpnBridge::setDefaultRateLimits(const RateLimits &limits) {
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  defaultRateLimits_ = limits;
+  for (auto &kv : peerContexts_) {
+    applyRateLimitsLocked(*kv.second);
+  }
+}
+
+void SteamVpnBridge::setPeerRateLimits(CSteamID steamID,
+                                       const RateLimits &limits) {
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  peerRateLimits_[steamID] = limits;
+  auto it = peerContexts_.find(steamID);
+  if (it != peerContexts_.end()) {
+    applyRateLimitsLocked(*it->second);
+  }
+}
+
+void SteamVpnBridge::clearPeerRateLimits(CSteamID steamID) {
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  peerRateLimits_.erase(steamID);
+  auto it = peerContexts_.find(steamID);
+  if (it != peerContexts_.end()) {
+    applyRateLimitsLocked(*it->second);
+  }
+}
+
+std::vector<SteamVpnBridge::PeerUsageStatistics>
+SteamVpnBridge::getPeerUsage() const {
+  std::vector<PeerUsageStatistics> result;
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  result.reserve(sessionUsage_.size());
+  for (const auto &kv : sessionUsage_) {
+    const PeerUsage &usage = *kv.second;
+    PeerUsageStatistics entry;
+    entry.steamID = kv.first;
+    entry.bytesSent = usage.bytesSent.load(std::memory_order_relaxed);
+    entry.bytesReceived = usage.bytesReceived.load(std::memory_order_relaxed);
+    entry.bytesForwarded =
+        usage.bytesForwarded.load(std::memory_order_relaxed);
+    entry.bytesRateLimited =
+        usage.bytesRateLimited.load(std::memory_order_relaxed);
+    result.push_back(entry);
+  }
+  return result;
+}
+
+std::string SteamVpnBridge::peerName(const PeerContext &peer) const {
+  return *std::atomic_load(&peer.name);
+}
+
 SteamVpnBridge::Statistics SteamVpnBridge::getStatistics() const {
-  std::lock_guard<std::mutex> lock(statsMutex_);
-  return stats_;
+  Statistics stats;
+  auto add = [&stats](const TrafficCounters &counters) {
+    stats.packetsSent += counters.packetsSent.load(std::memory_order_relaxed);
+    stats.bytesSent += counters.bytesSent.load(std::memory_order_relaxed);
+    stats.packetsReceived +=
+        counters.packetsReceived.load(std::memory_order_relaxed);
+    stats.bytesReceived +=
+        counters.bytesReceived.load(std::memory_order_relaxed);
+    stats.packetsDropped +=
+        counters.packetsDropped.load(std::memory_order_relaxed);
+    stats.compactPacketsSent +=
+        counters.compactPacketsSent.load(std::memory_order_relaxed);
+    stats.headerBytesSaved +=
+        counters.headerBytesSaved.load(std::memory_order_relaxed);
+    stats.mssClamped += counters.mssClamped.load(std::memory_order_relaxed);
+    stats.pmtuRejected +=
+        counters.pmtuRejected.load(std::memory_order_relaxed);
+    stats.rateLimited += counters.rateLimited.load(std::memory_order_relaxed);
+    stats.fecParitySent +=
+        counters.fecParitySent.load(std::memory_order_relaxed);
+    stats.fecParityBytes +=
+        counters.fecParityBytes.load(std::memory_order_relaxed);
+    stats.fecRecovered += counters.fecRecovered.load(std::memory_order_relaxed);
+    stats.fecLost += counters.fecLost.load(std::memory_order_relaxed);
+    stats.bundlesSent += counters.bundlesSent.load(std::memory_order_relaxed);
+    stats.bundledPackets +=
+        counters.bundledPackets.load(std::memory_order_relaxed);
+    stats.messagesSegmented +=
+        counters.messagesSegmented.load(std::memory_order_relaxed);
+    stats.segmentsSent += counters.segmentsSent.load(std::memory_order_relaxed);
+    stats.messagesReassembled +=
+        counters.messagesReassembled.load(std::memory_order_relaxed);
+    stats.reassemblyFailures +=
+        counters.reassemblyFailures.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kVpnMessageTypeSlots; ++i) {
+      stats.messagesSentByType[i] +=
+          counters.sentByType[i].load(std::memory_order_relaxed);
+      stats.messagesReceivedByType[i] +=
+          counters.receivedByType[i].load(std::memory_order_relaxed);
+    }
+  };
+  for (const auto &queue : tunQueues_) {
+    add(queue->counters);
+  }
+  add(rxCounters_);
+  add(controlCounters_);
+
+  const MulticastFilter::Stats filterStats = multicastFilter_.getStats();
+  stats.broadcastsRateLimited = filterStats.rateLimited;
+  stats.broadcastDuplicates = filterStats.duplicates;
+  stats.multicastSendsAvoided = filterStats.peerSendsAvoided;
+  stats.tunWriteQueueDepth = tunWriteRing_.size();
+  stats.tunWriteQueueDrops = tunWriteDrops_.load(std::memory_order_relaxed);
+  stats.packetsDropped += stats.tunWriteQueueDrops;
+
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  stats.peers.reserve(peerContexts_.size());
+  for (const auto &kv : peerContexts_) {
+    const PeerContext &peer = *kv.second;
+    PeerStatistics entry;
+    entry.steamID = peer.steamID;
+    entry.packetsSent = peer.packetsSent.load(std::memory_order_relaxed);
+    entry.bytesSent = peer.bytesSent.load(std::memory_order_relaxed);
+    entry.messagesReceived =
+        peer.messagesReceived.load(std::memory_order_relaxed);
+    entry.bytesReceived = peer.bytesReceived.load(std::memory_order_relaxed);
+    entry.lastSeenMs = peer.lastSeenMs.load(std::memory_order_relaxed);
+    entry.pathMtu = peer.pathMtu.load(std::memory_order_relaxed);
+    entry.fecActive = peer.fecActive.load(std::memory_order_relaxed);
+    stats.peers.push_back(entry);
+    std::lock_guard<std::mutex> egressLock(kv.second->egressMutex);
+    stats.egressQueuedPackets += peer.egress.backlogPackets();
+    stats.egressDrops += peer.egress.drops();
+    stats.egressEcnMarked += peer.egress.ecnMarked();
+  }
+  stats.packetsDropped += stats.egressDrops;
+  return stats;
+}
+
+std::vector<SteamVpnBridge::FlowStatistics>
+SteamVpnBridge::getFlowStatistics() const {
+  std::vector<FlowStatistics> result;
+  std::lock_guard<std::mutex> lock(peerContextsMutex_);
+  for (const auto &kv : peerContexts_) {
+    std::lock_guard<std::mutex> egressLock(kv.second->egressMutex);
+    for (const FlowScheduler::FlowStats &flow : kv.second->egress.flowStats()) {
+      result.push_back({kv.first, flow});
+    }
+  }
+  return result;
 }
 
 void SteamVpnBridge::rebroadcastState() {
@@ -473,7 +1899,7 @@ void SteamVpnBridge::updateRoute(const NodeID &nodeId, CSteamID steamId,
   entry.steamID = steamId;
   entry.ipAddress = ipAddress;
   entry.name = name;
-  entry.isLocal = (SteamUser() && steamId == SteamUser()->GetSteamID());
+  entry.isLocal = steamId == localSteamID_;
   entry.nodeId = nodeId;
 
   {
@@ -486,6 +1912,7 @@ void SteamVpnBridge::updateRoute(const NodeID &nodeId, CSteamID steamId,
       }
     }
     routingTable_[ipAddress] = entry;
+    publishRoutesLocked();
   }
   ipNegotiator_.markIPUsed(ipAddress);
   std::cout << "Route updated: " << ipToString(ipAddress) << " -> " << name
@@ -495,22 +1922,20 @@ void SteamVpnBridge::updateRoute(const NodeID &nodeId, CSteamID steamId,
 void SteamVpnBridge::removeRoute(uint32_t ipAddress) {
   std::lock_guard<std::mutex> lock(routingMutex_);
   routingTable_.erase(ipAddress);
+  publishRoutesLocked();
 }
 
 void SteamVpnBridge::broadcastRouteUpdate() {
   std::vector<uint8_t> message;
   std::vector<uint8_t> routeData;
 
-  {
-    std::lock_guard<std::mutex> lock(routingMutex_);
-    for (const auto &entry : routingTable_) {
-      const uint64_t steamID = entry.second.steamID.ConvertToUint64();
-      const uint32_t ipAddress = htonl(entry.second.ipAddress);
-      const size_t offset = routeData.size();
-      routeData.resize(offset + 12);
-      std::memcpy(routeData.data() + offset, &steamID, 8);
-      std::memcpy(routeData.data() + offset + 8, &ipAddress, 4);
-    }
+  for (const auto &hop : loadRoutes()->hops) {
+    const uint64_t steamID = hop.steamID.ConvertToUint64();
+    const uint32_t ipAddress = htonl(hop.ipAddress);
+    const size_t offset = routeData.size();
+    routeData.resize(offset + 12);
+    std::memcpy(routeData.data() + offset, &steamID, 8);
+    std::memcpy(routeData.data() + offset + 8, &ipAddress, 4);
   }
 
   VpnMessageHeader header{};
@@ -533,16 +1958,13 @@ void SteamVpnBridge::broadcastRouteUpdate() {
 void SteamVpnBridge::sendRouteUpdateTo(CSteamID targetSteamID) {
   std::vector<uint8_t> message;
   std::vector<uint8_t> routeData;
-  {
-    std::lock_guard<std::mutex> lock(routingMutex_);
-    for (const auto &entry : routingTable_) {
-      const uint64_t steamID = entry.second.steamID.ConvertToUint64();
-      const uint32_t ipAddress = htonl(entry.second.ipAddress);
-      const size_t offset = routeData.size();
-      routeData.resize(offset + 12);
-      std::memcpy(routeData.data() + offset, &steamID, 8);
-      std::memcpy(routeData.data() + offset + 8, &ipAddress, 4);
-    }
+  for (const auto &hop : loadRoutes()->hops) {
+    const uint64_t steamID = hop.steamID.ConvertToUint64();
+    const uint32_t ipAddress = htonl(hop.ipAddress);
+    const size_t offset = routeData.size();
+    routeData.resize(offset + 12);
+    std::memcpy(routeData.data() + offset, &steamID, 8);
+    std::memcpy(routeData.data() + offset + 8, &ipAddress, 4);
   }
 
   VpnMessageHeader header{};
@@ -569,7 +1991,7 @@ void SteamVpnBridge::sendVpnMessage(VpnMessageType type, const uint8_t *payload,
   if (!steamManager_) {
     return;
   }
-  std::vector<uint8_t> message;
+  static thread_local std::vector<uint8_t> message;
   VpnMessageHeader header{};
   header.type = type;
   header.length = htons(static_cast<uint16_t>(payloadLength));
@@ -582,6 +2004,10 @@ void SteamVpnBridge::sendVpnMessage(VpnMessageType type, const uint8_t *payload,
   const int flags = reliable ? k_nSteamNetworkingSend_Reliable
                              : (k_nSteamNetworkingSend_UnreliableNoNagle |
                                 k_nSteamNetworkingSend_NoDelay);
+  if (type != VpnMessageType::IP_PACKET) {
+    controlCounters_.sentByType[messageTypeSlot(type)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
   steamManager_->sendMessageToUser(targetSteamID, message.data(),
                                    static_cast<uint32_t>(message.size()),
                                    flags);
@@ -593,7 +2019,7 @@ void SteamVpnBridge::broadcastVpnMessage(VpnMessageType type,
   if (!steamManager_) {
     return;
   }
-  std::vector<uint8_t> message;
+  static thread_local std::vector<uint8_t> message;
   VpnMessageHeader header{};
   header.type = type;
   header.length = htons(static_cast<uint16_t>(payloadLength));
@@ -606,6 +2032,8 @@ void SteamVpnBridge::broadcastVpnMessage(VpnMessageType type,
   const int flags = reliable ? k_nSteamNetworkingSend_Reliable
                              : (k_nSteamNetworkingSend_UnreliableNoNagle |
                                 k_nSteamNetworkingSend_NoDelay);
+  controlCounters_.sentByType[messageTypeSlot(type)].fetch_add(
+      1, std::memory_order_relaxed);
   steamManager_->broadcastMessage(message.data(),
                                   static_cast<uint32_t>(message.size()), flags);
 }
@@ -1,10 +1,24 @@
 #pragma once
 
+#include "../net/flow_scheduler.h"
 #include "../net/heartbeat_manager.h"
 #include "../net/ip_negotiator.h"
+#include "../net/message_segmenter.h"
+#include "../net/mpsc_ring.h"
+#include "../net/multicast_filter.h"
+#include "../net/packet_bundler.h"
+#include "../net/packet_pool.h"
+#include "../net/routing_snapshot.h"
+#include "../net/token_bucket.h"
+#include "../net/traffic_counters.h"
 #include "../net/vpn_protocol.h"
+#include "../net/xor_fec.h"
 #include "../tun/tun_interface.h"
+#include "steam_vpn_networking_manager.h"
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -12,8 +26,6 @@
 #include <thread>
 #include <vector>
 
-class SteamVpnNetworkingManager;
-
 class SteamVpnBridge {
 public:
   SteamVpnBridge(SteamVpnNetworkingManager *steamManager);
@@ -28,27 +40,346 @@ public:
 
   std::string getLocalIP() const;
   std::string getTunDeviceName() const;
-  std::map<uint32_t, RouteEntry> getRoutingTable() const;
+  // Current routing table; cheap to take, never changes once returned.
+  RoutingSnapshotPtr getRoutingSnapshot() const;
 
   void handleVpnMessage(const uint8_t *data, size_t length,
                         CSteamID senderSteamID);
+  // Wake the TUN writer for packets queued by handleVpnMessage; call after
+  // each batch of incoming messages.
+  void flushTunWrites();
   void onUserJoined(CSteamID steamID);
   void onUserLeft(CSteamID steamID);
+  // Refresh the cached persona name of a peer and its routes.
+  void onPeerPersonaChanged(CSteamID steamID);
   // Force-send our current address/route to all peers (used after reconnect).
   void rebroadcastState();
   static std::string ipToString(uint32_t ip);
 
+  struct PeerStatistics {
+    CSteamID steamID;
+    uint64_t packetsSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t messagesReceived = 0;
+    uint64_t bytesReceived = 0;
+    int64_t lastSeenMs = 0; // steady_clock, 0 if never heard from
+    int pathMtu = 0;        // 0 until first computed
+    bool fecActive = false; // we send it parity
+  };
   struct Statistics {
     uint64_t packetsSent = 0;
     uint64_t packetsReceived = 0;
     uint64_t bytesSent = 0;
     uint64_t bytesReceived = 0;
     uint64_t packetsDropped = 0;
+    // IP packets sent with the compact header, and wrapper bytes not sent.
+    uint64_t compactPacketsSent = 0;
+    uint64_t headerBytesSaved = 0;
+    // TCP SYN/SYN-ACKs whose MSS option was lowered to fit the peer's path.
+    uint64_t mssClamped = 0;
+    // DF packets over the peer's path MTU answered with ICMP frag-needed.
+    uint64_t pmtuRejected = 0;
+    // Broadcast/multicast filtering (also counted in packetsDropped).
+    uint64_t broadcastsRateLimited = 0;
+    uint64_t broadcastDuplicates = 0;
+    uint64_t multicastSendsAvoided = 0;
+    // Received packets waiting for the TUN writer, and those dropped
+    // because the ring was full.
+    uint64_t tunWriteQueueDepth = 0;
+    uint64_t tunWriteQueueDrops = 0;
+    // Packets held by the per-peer egress schedulers, and those they shed.
+    uint64_t egressQueuedPackets = 0;
+    uint64_t egressDrops = 0;
+    // Packets marked CE instead of dropped by the egress AQM.
+    uint64_t egressEcnMarked = 0;
+    // Received packets over a peer's ingress/forward limit (also counted
+    // in packetsDropped).
+    uint64_t rateLimited = 0;
+    // Forward error correction: parity messages and bytes sent (the
+    // overhead), and received messages rebuilt from parity or lost anyway.
+    uint64_t fecParitySent = 0;
+    uint64_t fecParityBytes = 0;
+    uint64_t fecRecovered = 0;
+    uint64_t fecLost = 0;
+    // IP_PACKET_BUNDLE messages sent and the IP packets they carried.
+    uint64_t bundlesSent = 0;
+    uint64_t bundledPackets = 0;
+    // Messages too large for one Steam packet sent as IP_PACKET_SEGMENTs,
+    // and received ones put back together or given up on.
+    uint64_t messagesSegmented = 0;
+    uint64_t segmentsSent = 0;
+    uint64_t messagesReassembled = 0;
+    uint64_t reassemblyFailures = 0;
+    // Indexed by messageTypeSlot(VpnMessageType).
+    std::array<uint64_t, kVpnMessageTypeSlots> messagesSentByType{};
+    std::array<uint64_t, kVpnMessageTypeSlots> messagesReceivedByType{};
+    std::vector<PeerStatistics> peers;
   };
+  // Sums the per-thread counters; cheap enough for a GUI tick.
   Statistics getStatistics() const;
 
+  // Per-queue TUN counters. The kernel spreads reads across queues by flow;
+  // writes are steered by the same 5-tuple so a flow keeps one queue.
+  struct QueueStatistics {
+    uint64_t packetsRead = 0;
+    uint64_t bytesRead = 0;
+    uint64_t packetsWritten = 0;
+    uint64_t bytesWritten = 0;
+  };
+  std::vector<QueueStatistics> getQueueStatistics() const;
+
+  // Flows seen by each peer's egress scheduler.
+  struct FlowStatistics {
+    CSteamID steamID;
+    FlowScheduler::FlowStats flow;
+  };
+  std::vector<FlowStatistics> getFlowStatistics() const;
+  // TUN queues (one worker thread each) to request on the next start().
+  void setTunQueueCount(int queues);
+  // CoDel target and interval for unicast egress, counting the delay in
+  // Steam's send queue. Takes effect immediately.
+  void setQueueDelayTarget(int targetMs, int intervalMs);
+
+  // Per-peer bandwidth caps in bytes per second; 0 means unlimited.
+  // egress: our TUN traffic to the peer, held back and paced.
+  // ingress: the peer's traffic for our TUN, dropped when over.
+  // forward: the peer's traffic we relay to others, dropped when over.
+  struct RateLimits {
+    uint64_t egressBytesPerSec = 0;
+    uint64_t ingressBytesPerSec = 0;
+    uint64_t forwardBytesPerSec = 0;
+  };
+  // Limits for every peer without its own; take effect immediately.
+  void setDefaultRateLimits(const RateLimits &limits);
+  void setPeerRateLimits(CSteamID steamID, const RateLimits &limits);
+  void clearPeerRateLimits(CSteamID steamID);
+
+  // IP bytes exchanged with each peer since start(), kept when it leaves
+  // and rejoins.
+  struct PeerUsageStatistics {
+    CSteamID steamID;
+    uint64_t bytesSent = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t bytesForwarded = 0;   // relayed on to other peers
+    uint64_t bytesRateLimited = 0; // dropped by its ingress, forward or
+                                   // egress limit
+  };
+  std::vector<PeerUsageStatistics> getPeerUsage() const;
+
+  // Pack small unicast packets for the same peer into one Steam message.
+  // Packets read together are always packed; a partial bundle may also
+  // wait up to window for more, unless it holds a real-time packet or a
+  // pure ACK. Non-zero windows are raised to at least 100 us, about what
+  // the kernel's timer slack allows queue 0 to wake for.
+  void setAggregation(bool enabled,
+                      std::chrono::microseconds window =
+                          std::chrono::microseconds(0));
+
+  // TUN MTU to use from the next start() on, above the standard one (up
+  // to 9000; 0 turns it off). Only healthy direct peers that reassemble
+  // segments get packets that large, split over several Steam messages;
+  // for the rest the path MTU stays what fits one Steam packet.
+  void setJumboMtu(int mtu);
+
+  // Opt-in XOR parity on unicast TUN traffic, switched on per peer while
+  // Steam reports more than lossThreshold of our packets to it lost.
+  void setForwardErrorCorrection(bool enabled, double lossThreshold = 0.02);
+
 private:
-  void tunReadThread();
+  // One TUN packet in a PacketPool buffer with room in front for the VPN
+  // header and wrapper, so the Steam message is built in place. A buffer
+  // handed to Steam is replaced by a fresh one.
+  static constexpr size_t kTunFrameHeadroom =
+      sizeof(VpnMessageHeader) + sizeof(VpnPacketWrapper);
+  static constexpr size_t kTunMaxPacket = 2048;
+  static constexpr size_t kTunMaxJumboPacket = 9216;
+  static_assert(kTunFrameHeadroom + kTunMaxPacket <= PacketPool::kBufferSize,
+                "TUN frame must fit a pool buffer");
+  static_assert(kTunFrameHeadroom + kTunMaxJumboPacket <=
+                    PacketPool::kJumboBufferSize,
+                "jumbo TUN frame must fit a jumbo pool buffer");
+  struct TunFrame {
+    uint8_t *data = nullptr;
+    size_t ipLength = 0;
+  };
+
+  // One TUN queue with its worker thread and read-side scratch.
+  struct TunQueue {
+    int index = 0;
+    int wakeFd = -1; // eventfd for stop/deadline wakeups (Linux)
+    std::unique_ptr<std::thread> thread;
+    std::vector<TunFrame> batch;
+    std::vector<std::pair<CSteamID, size_t>> unicast;
+    std::vector<size_t> loopback;
+    std::vector<size_t> broadcast;
+    std::vector<SteamVpnNetworkingManager::OutgoingMessage> outgoing;
+    std::vector<uint8_t> icmp;
+    std::vector<std::vector<uint8_t>> fecParity; // built, not yet sent
+    size_t fecParityCount = 0;
+    TrafficCounters counters; // written by this queue's thread only
+    std::atomic<uint64_t> packetsRead{0};
+    std::atomic<uint64_t> bytesRead{0};
+    std::atomic<uint64_t> packetsWritten{0};
+    std::atomic<uint64_t> bytesWritten{0};
+  };
+
+  // Session byte accounting for one peer; outlives its PeerContext.
+  struct PeerUsage {
+    std::atomic<uint64_t> bytesSent{0};     // any TUN queue
+    std::atomic<uint64_t> bytesReceived{0}; // receive thread only
+    std::atomic<uint64_t> bytesForwarded{0}; // receive thread only
+    std::atomic<uint64_t> bytesRateLimited{0}; // receive thread and TUN queues
+  };
+
+  // Per-peer state cached off the Steam friend APIs and NodeID hashing so
+  // the receive path never calls either. Created for lobby members only, on
+  // join or their first message, renamed by PersonaStateChange_t, dropped
+  // when the peer leaves.
+  struct PeerContext {
+    CSteamID steamID;
+    NodeID nodeId{};
+    // Replaced whole on rename (std::atomic_load/atomic_store).
+    std::shared_ptr<const std::string> name;
+    std::atomic<int64_t> lastSeenMs{0}; // steady_clock
+    std::atomic<uint64_t> messagesReceived{0}; // receive thread only
+    std::atomic<uint64_t> bytesReceived{0};
+    std::atomic<uint64_t> packetsSent{0}; // any TUN queue
+    std::atomic<uint64_t> bytesSent{0};
+
+    // Compact IP headers. Send side: the peer acknowledged our session
+    // index. Receive side (receive thread only): the index and NodeID it
+    // announced, and when we last asked it to re-announce.
+    std::atomic<bool> compactReady{false};
+    std::atomic<bool> bundlesReady{false}; // it acked kSessionFeatureBundles
+    std::atomic<bool> segmentsReady{false}; // ... kSessionFeatureSegments
+    std::atomic<int64_t> lastFullWrapperMs{0};
+    uint16_t remoteSessionIndex = 0;
+    NodeID remoteNodeId{};
+    int64_t lastResyncMs = 0;
+
+    // Path size. relayed and steamMtu (0 = unknown) come from Steam and are
+    // refreshed every few seconds; probedSize is the largest PMTU_PROBE the
+    // peer acknowledged in the last finished round (0 = unknown). Rounds
+    // are run by queue 0's thread and acknowledged on the receive thread.
+    std::atomic<bool> relayed{true};
+    std::atomic<int> steamMtu{0};
+    std::atomic<int64_t> pathCheckedMs{0};
+    std::atomic<uint16_t> probedSize{0};
+    std::atomic<uint16_t> probeBest{0};
+    std::atomic<uint16_t> probeRound{0};
+    std::atomic<int64_t> probeSentMs{0}; // 0: no round outstanding
+    int64_t lastProbeRoundMs = 0;         // queue 0 only
+    std::atomic<uint16_t> pathMtu{0};     // last value of peerMtu()
+    std::atomic<bool> lossy{false};       // too lossy for jumbo frames
+
+    // Unicast packets from the TUN queues wait here until Steam's own
+    // send backlog for the peer drains. egressBacklogged is set while
+    // packets are left over for queue 0 to retry.
+    std::mutex egressMutex;
+    FlowScheduler egress;
+    std::atomic<bool> egressBacklogged{false};
+    // Steam's send queue towards the peer (SendQueueStatus fields), sampled
+    // by queue 0 so the drain never calls into Steam. sentSinceSample counts
+    // the bytes handed to Steam since, which the sample does not show yet.
+    std::atomic<int> sendPendingBytes{0};
+    std::atomic<int64_t> sendQueueTimeUsec{0};
+    std::atomic<int> sendRateBytesPerSec{0};
+    std::atomic<float> remoteQuality{-1.0f};
+    std::atomic<int64_t> sentSinceSample{0};
+
+    // Rate limits in force (RateLimits fields) and their buckets. The
+    // egress bucket is used under egressMutex, the others by the receive
+    // thread only.
+    std::atomic<uint64_t> egressLimit{0};
+    std::atomic<uint64_t> ingressLimit{0};
+    std::atomic<uint64_t> forwardLimit{0};
+    TokenBucket egressBucket;
+    TokenBucket ingressBucket;
+    TokenBucket forwardBucket;
+    std::shared_ptr<PeerUsage> usage;
+    PacketBundler bundler; // under egressMutex
+    // When the open bundle's aggregation window ends, in steady_clock
+    // microseconds; 0 while none waits. Queue 0 sleeps no longer than this.
+    std::atomic<int64_t> bundleDeadlineUs{0};
+    MessageSegmenter segmenter; // under egressMutex
+    MessageReassembler reassembler; // receive thread only
+
+    // FEC. The encoder is used under egressMutex; fecActive says whether
+    // it is fed. The decoder and fecSeenMs (last parity received) belong
+    // to the receive thread.
+    std::atomic<bool> fecActive{false};
+    XorFecEncoder fecEncoder;
+    XorFecDecoder fecDecoder;
+    int64_t fecSeenMs = INT64_MIN / 2;
+  };
+  using PeerContextMap = std::map<CSteamID, std::shared_ptr<PeerContext>>;
+  using PeerContextsPtr = std::shared_ptr<const PeerContextMap>;
+  // The context of a lobby member, created on first use; null for anyone
+  // else (a departed peer, a SteamID merely named in a route update).
+  std::shared_ptr<PeerContext> peerContext(CSteamID steamID);
+  PeerContextsPtr loadPeerContexts() const;
+  // Rebuild and publish peerSnapshot_ from peerContexts_;
+  // peerContextsMutex_ held.
+  void publishPeerContextsLocked();
+  std::string peerName(const PeerContext &peer) const;
+  // Copy the limits that apply to peer into it; peerContextsMutex_ held.
+  void applyRateLimitsLocked(PeerContext &peer) const;
+
+  // Payload of a received IP_PACKET or IP_PACKET_COMPACT message.
+  void handleIpMessage(VpnMessageType type, const uint8_t *payload,
+                       uint16_t payloadLength, PeerContext &peer);
+  // wrapped, if set, is the payload of the received IP_PACKET message: its
+  // header sits right in front, so the message can be forwarded as is.
+  void handleIpPacket(const uint8_t *ipPacket, size_t ipPacketLen,
+                      const NodeID &senderNodeId, uint32_t senderIP,
+                      PeerContext &sender, const uint8_t *wrapped,
+                      size_t wrappedLength);
+  void requestSessionResync(PeerContext &peer);
+  bool useCompactHeader(PeerContext &peer, int64_t nowMs);
+  // Largest message that fits one Steam packet on peer's path.
+  size_t messageBudget(PeerContext &peer);
+  // Largest IP packet to send peer (what fits one Steam packet, or the
+  // jumbo TUN MTU on a path that takes it), and the TCP MSS that goes with
+  // it.
+  uint16_t peerMtu(PeerContext &peer);
+  uint16_t pathMss(PeerContext &peer);
+  // Finish and start PMTU probe rounds; queue 0's thread, about once a second.
+  void maintainPathMtu();
+  // Refresh every peer's send queue sample; queue 0's thread, every few ms.
+  void sampleSendQueues();
+  void handlePmtuProbeAck(PeerContext &peer, const PmtuProbePayload &ack);
+  // Drop a DF packet larger than mtu and answer it with an ICMP
+  // "fragmentation needed" through the queue it came from.
+  void rejectOversized(TunQueue &queue, const uint8_t *packet, size_t length,
+                       uint16_t mtu);
+
+  // A pool buffer for one TUN frame at the current MTU.
+  uint8_t *acquireFrame() const;
+  void tunReadThread(TunQueue &queue);
+  void processTunBatch(TunQueue &queue, size_t count);
+  // Send what peer's scheduler holds, as far as the Steam backlog allows.
+  void drainEgress(TunQueue &queue, PeerContext &peer);
+  void drainBackloggedEgress(TunQueue &queue);
+  FlowScheduler::Clock::duration aggregationWindow() const;
+  // Switch parity for peer on or off from Steam's delivery figure.
+  void updateFecState(PeerContext &peer,
+                      const SteamVpnNetworkingManager::SendQueueStatus &steam);
+  // Seal peer's parity group into queue's pending list; send the list.
+  void closeFecGroup(TunQueue &queue, PeerContext &peer);
+  void sendFecParity(TunQueue &queue, PeerContext &peer);
+  void waitForTunActivity(TunQueue &queue);
+  void wakeTunQueue(size_t index);
+  void wakeTunThreads();
+  void joinTunQueues();
+  void writeToTun(const uint8_t *packet, size_t length);
+  // Receive side: hand a packet to the TUN writer thread, never blocking.
+  // False (and counted) if the ring is full.
+  // Clamps the MSS of a SYN to maxMss on the way if it is nonzero.
+  bool enqueueTunWrite(const uint8_t *packet, size_t length,
+                       uint16_t maxMss = 0);
+  void tunWriteThread();
+  void wakeTunWriter();
+  void joinTunWriter();
 
   static uint32_t stringToIp(const std::string &ipStr);
   static uint32_t extractDestIP(const uint8_t *packet, size_t length);
@@ -66,23 +397,68 @@ private:
   void updateRoute(const NodeID &nodeId, CSteamID steamId, uint32_t ipAddress,
                    const std::string &name);
   void removeRoute(uint32_t ipAddress);
+  RoutingSnapshotPtr loadRoutes() const;
+  // Rebuild and publish routes_ from routingTable_; routingMutex_ held.
+  void publishRoutesLocked();
   void broadcastRouteUpdate();
   void sendRouteUpdateTo(CSteamID targetSteamID);
 
   SteamVpnNetworkingManager *steamManager_;
   std::unique_ptr<tun::TunInterface> tunDevice_;
   std::atomic<bool> running_;
-  std::unique_ptr<std::thread> tunReadThread_;
+  int tunQueueCount_;
+  std::vector<std::unique_ptr<TunQueue>> tunQueues_;
+  std::atomic<int> egressBackloggedPeers_{0};
+  std::atomic<int> delayTargetMs_;
+  std::atomic<int> delayIntervalMs_;
+  std::atomic<bool> aggregationEnabled_;
+  std::atomic<int64_t> aggregationWindowUs_;
+  std::atomic<bool> fecEnabled_;
+  std::atomic<double> fecLossThreshold_;
+
+  // Packets from Steam bound for the TUN device. The receive thread only
+  // enqueues; the writer thread does the (possibly slow) device writes.
+  static constexpr size_t kTunWriteRingSize = 1024;
+  MpscRing<std::vector<uint8_t>> tunWriteRing_{kTunWriteRingSize};
+  std::unique_ptr<std::thread> tunWriteThread_;
+  std::mutex tunWriteMutex_;
+  std::condition_variable tunWriteCv_;
+  std::atomic<bool> tunWriterSleeping_{false};
+  std::atomic<uint64_t> tunWriteDrops_{0};
 
+  // Writers edit routingTable_ under routingMutex_ and republish; readers
+  // only touch routes_ (std::atomic_load/atomic_store).
   std::map<uint32_t, RouteEntry> routingTable_;
   mutable std::mutex routingMutex_;
+  RoutingSnapshotPtr routes_;
+
+  // Same scheme as the routes: writers edit peerContexts_ under
+  // peerContextsMutex_ and republish, the packet path only reads
+  // peerSnapshot_.
+  PeerContextMap peerContexts_;
+  PeerContextsPtr peerSnapshot_ = std::make_shared<const PeerContextMap>();
+  // Also guarded by peerContextsMutex_.
+  std::map<CSteamID, std::shared_ptr<PeerUsage>> sessionUsage_;
+  RateLimits defaultRateLimits_;
+  std::map<CSteamID, RateLimits> peerRateLimits_;
+  mutable std::mutex peerContextsMutex_;
+  CSteamID localSteamID_;
+  uint16_t localSessionIndex_ = 0;
 
   uint32_t baseIP_;
   uint32_t subnetMask_;
   uint32_t localIP_;
+  int mtu_ = 0;
+  int jumboMtu_ = 0;                  // requested; applied by start()
+  bool jumbo_ = false;                // mtu_ is a jumbo MTU
+  size_t tunMaxPacket_ = kTunMaxPacket;
+  int64_t nextPathMaintenanceMs_ = 0; // queue 0 only
+  int64_t nextSendQueueSampleMs_ = 0; // queue 0 only
+
+  TrafficCounters rxCounters_;      // Steam receive thread only
+  TrafficCounters controlCounters_; // control sends from any thread
 
-  Statistics stats_;
-  mutable std::mutex statsMutex_;
+  MulticastFilter multicastFilter_;
 
   IpNegotiator ipNegotiator_;
   HeartbeatManager heartbeatManager_;
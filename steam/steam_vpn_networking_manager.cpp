@@ -1,13 +1,47 @@
 #include "steam_vpn_networking_manager.h"
 #include "steam_vpn_bridge.h"
 #include "vpn_message_handler.h"
+#include "../net/packet_pool.h"
 #include "../net/vpn_protocol.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <vector>
 #include <steam_api.h>
 #include <isteamnetworkingutils.h>
 
+SteamVpnNetworkingManager *SteamVpnNetworkingManager::instance_ = nullptr;
+
+namespace {
+// One broadcast payload shared by every message fanned out from it. Each
+// message holds a reference in m_nUserData; Steam calls
+// releaseSharedPayload once per message after sending (or failing to).
+struct SharedPayload {
+  std::atomic<int> refs{0};
+  std::vector<uint8_t> bytes;
+};
+
+void releaseSharedPayload(SteamNetworkingMessage_t *msg) {
+  auto *payload = reinterpret_cast<SharedPayload *>(msg->m_nUserData);
+  if (payload->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete payload;
+  }
+}
+
+void releasePooledBuffer(SteamNetworkingMessage_t *msg) {
+  PacketPool::instance().release(reinterpret_cast<uint8_t *>(msg->m_nUserData));
+}
+} // namespace
+
+void SteamVpnNetworkingManager::OnConnectionStatusChanged(
+    SteamNetConnectionStatusChangedCallback_t *pInfo) {
+  if (instance_) {
+    instance_->handleConnectionStatusChanged(pInfo);
+  }
+}
+
 SteamVpnNetworkingManager::SteamVpnNetworkingManager()
     : messagesInterface_(nullptr), messageHandler_(nullptr),
       vpnBridge_(nullptr) {}
@@ -40,7 +74,9 @@ bool SteamVpnNetworkingManager::initialize() {
       k_ESteamNetworkingConfig_Global, 0, k_ESteamNetworkingConfig_Int32,
       &recvBufferMsgs);
 
-  int32 sendRate = 1024 * 1024;
+  // Messages sessions keep this fixed rate; data plane connections are
+  // adapted per connection by SendRateController.
+  int32 sendRate = SendRateController::kInitialRate;
   SteamNetworkingUtils()->SetConfigValue(
       k_ESteamNetworkingConfig_SendRateMin, k_ESteamNetworkingConfig_Global, 0,
       k_ESteamNetworkingConfig_Int32, &sendRate);
@@ -76,6 +112,34 @@ bool SteamVpnNetworkingManager::initialize() {
   }
 
   messageHandler_ = new VpnMessageHandler(messagesInterface_, this);
+
+  if (connectionDataPlane_) {
+    socketsInterface_ = SteamNetworkingSockets();
+    if (socketsInterface_) {
+      instance_ = this;
+      pollGroup_ = socketsInterface_->CreatePollGroup();
+      // Route status changes for our connections to this manager instead of
+      // the global handler owned by SteamNetworkingManager.
+      SteamNetworkingConfigValue_t option;
+      option.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged,
+                    reinterpret_cast<void *>(
+                        &SteamVpnNetworkingManager::OnConnectionStatusChanged));
+      listenSocket_ =
+          socketsInterface_->CreateListenSocketP2P(VPN_VIRTUAL_PORT, 1, &option);
+    }
+    if (pollGroup_ == k_HSteamNetPollGroup_Invalid ||
+        listenSocket_ == k_HSteamListenSocket_Invalid) {
+      std::cerr << "[SteamVPN] Connection data plane unavailable, using "
+                   "ISteamNetworkingMessages only"
+                << std::endl;
+      connectionDataPlane_ = false;
+    } else {
+      messageHandler_->setPollGroup(socketsInterface_, pollGroup_);
+      rateController_ = std::make_unique<SendRateController>(socketsInterface_);
+      std::cout << "[SteamVPN] Connection data plane listening on virtual port "
+                << VPN_VIRTUAL_PORT << std::endl;
+    }
+  }
   return true;
 }
 
@@ -91,6 +155,29 @@ void SteamVpnNetworkingManager::shutdown() {
     }
     peers_.clear();
   }
+  if (socketsInterface_) {
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex_);
+      for (const auto &entry : peerConnections_) {
+        socketsInterface_->CloseConnection(entry.second.handle, 0, "Shutdown",
+                                           false);
+      }
+      peerConnections_.clear();
+      lastDialAttempt_.clear();
+    }
+    if (listenSocket_ != k_HSteamListenSocket_Invalid) {
+      socketsInterface_->CloseListenSocket(listenSocket_);
+      listenSocket_ = k_HSteamListenSocket_Invalid;
+    }
+    if (pollGroup_ != k_HSteamNetPollGroup_Invalid) {
+      socketsInterface_->DestroyPollGroup(pollGroup_);
+      pollGroup_ = k_HSteamNetPollGroup_Invalid;
+    }
+  }
+  publishPeers();
+  if (instance_ == this) {
+    instance_ = nullptr;
+  }
   hostSteamID_ = CSteamID();
 }
 
@@ -100,25 +187,204 @@ bool SteamVpnNetworkingManager::sendMessageToUser(CSteamID peerID,
   if (!messagesInterface_) {
     return false;
   }
-  SteamNetworkingIdentity identity;
-  identity.SetSteamID(peerID);
-  const EResult result = messagesInterface_->SendMessageToUser(
-      identity, data, size, flags, VPN_CHANNEL);
-  return result == k_EResultOK;
+  return sendOnPath(peerID, connectedHandleFor(peerID), data, size, flags);
 }
 
-void SteamVpnNetworkingManager::broadcastMessage(const void *data,
-                                                 uint32_t size, int flags) {
+bool SteamVpnNetworkingManager::sendMessagesToUser(
+    CSteamID peerID, const OutgoingMessage *messages, size_t count,
+    int flags) {
+  if (!messagesInterface_ || count == 0) {
+    return false;
+  }
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  ISteamNetworkingUtils *utils = SteamNetworkingUtils();
+  if (conn == k_HSteamNetConnection_Invalid || !utils) {
+    // The Messages API has no batched send.
+    for (size_t i = 0; i < count; ++i) {
+      sendOnPath(peerID, conn, messages[i].data, messages[i].size, flags);
+    }
+    return false;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<SteamNetworkingMessage_t *> batch;
+  batch.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    const OutgoingMessage &message = messages[i];
+    SteamNetworkingMessage_t *msg =
+        utils->AllocateMessage(message.pooledBuffer
+                                   ? 0
+                                   : static_cast<int>(message.size));
+    if (!msg) {
+      PacketPool::instance().release(message.pooledBuffer);
+      continue;
+    }
+    if (message.pooledBuffer) {
+      msg->m_pData = const_cast<void *>(message.data);
+      msg->m_cbSize = static_cast<int>(message.size);
+      msg->m_pfnFreeData = &releasePooledBuffer;
+      msg->m_nUserData = reinterpret_cast<int64>(message.pooledBuffer);
+    } else {
+      std::memcpy(msg->m_pData, message.data, message.size);
+    }
+    msg->m_conn = conn;
+    msg->m_nFlags = flags & ~k_nSteamNetworkingSend_AutoRestartBrokenSession;
+    batch.push_back(msg);
+  }
+  socketsInterface_->SendMessages(static_cast<int>(batch.size()), batch.data(),
+                                  nullptr);
+  const uint64_t elapsedNs = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+  connectionSends_.fetch_add(batch.size(), std::memory_order_relaxed);
+  connectionSendNs_.fetch_add(elapsedNs, std::memory_order_relaxed);
+  return true;
+}
+
+size_t SteamVpnNetworkingManager::broadcastMessage(
+    const void *data, uint32_t size, int flags,
+    const std::function<bool(CSteamID)> &filter) {
   if (!messagesInterface_) {
-    return;
+    return 0;
   }
-  std::lock_guard<std::mutex> lock(peersMutex_);
-  for (const auto &peerID : peers_) {
+  const PeerSnapshotPtr peers = loadPeers();
+  ISteamNetworkingUtils *utils = SteamNetworkingUtils();
+  std::vector<SteamNetworkingMessage_t *> batch;
+  SharedPayload *payload = nullptr;
+  size_t sent = 0;
+  for (const PeerPath &path : *peers) {
+    if (filter && !filter(path.steamID)) {
+      continue;
+    }
+    ++sent;
+    if (path.conn == k_HSteamNetConnection_Invalid || !utils) {
+      // The Messages API copies on every send and has no batched form.
+      sendOnPath(path.steamID, k_HSteamNetConnection_Invalid, data, size,
+                 flags);
+      continue;
+    }
+    SteamNetworkingMessage_t *msg = utils->AllocateMessage(0);
+    if (!msg) {
+      continue;
+    }
+    if (!payload) {
+      payload = new SharedPayload;
+      payload->bytes.assign(static_cast<const uint8_t *>(data),
+                            static_cast<const uint8_t *>(data) + size);
+      batch.reserve(peers->size());
+    }
+    msg->m_pData = payload->bytes.data();
+    msg->m_cbSize = static_cast<int>(size);
+    msg->m_pfnFreeData = &releaseSharedPayload;
+    msg->m_nUserData = reinterpret_cast<int64>(payload);
+    msg->m_conn = path.conn;
+    msg->m_nFlags = flags & ~k_nSteamNetworkingSend_AutoRestartBrokenSession;
+    batch.push_back(msg);
+  }
+  if (batch.empty()) {
+    delete payload;
+    return sent;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  payload->refs.store(static_cast<int>(batch.size()),
+                      std::memory_order_relaxed);
+  socketsInterface_->SendMessages(static_cast<int>(batch.size()), batch.data(),
+                                  nullptr);
+  const uint64_t elapsedNs = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+  connectionSends_.fetch_add(batch.size(), std::memory_order_relaxed);
+  connectionSendNs_.fetch_add(elapsedNs, std::memory_order_relaxed);
+  return sent;
+}
+
+bool SteamVpnNetworkingManager::sendOnPath(CSteamID peerID,
+                                           HSteamNetConnection conn,
+                                           const void *data, uint32_t size,
+                                           int flags) {
+  const auto start = std::chrono::steady_clock::now();
+  EResult result = k_EResultFail;
+  if (conn != k_HSteamNetConnection_Invalid) {
+    // AutoRestartBrokenSession only means something to the Messages API.
+    result = socketsInterface_->SendMessageToConnection(
+        conn, data, size, flags & ~k_nSteamNetworkingSend_AutoRestartBrokenSession,
+        nullptr);
+  } else {
     SteamNetworkingIdentity identity;
     identity.SetSteamID(peerID);
-    messagesInterface_->SendMessageToUser(identity, data, size, flags,
-                                          VPN_CHANNEL);
+    result = messagesInterface_->SendMessageToUser(identity, data, size, flags,
+                                                   VPN_CHANNEL);
   }
+  const uint64_t elapsedNs = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+  if (conn != k_HSteamNetConnection_Invalid) {
+    connectionSends_.fetch_add(1, std::memory_order_relaxed);
+    connectionSendNs_.fetch_add(elapsedNs, std::memory_order_relaxed);
+  } else {
+    messagesSends_.fetch_add(1, std::memory_order_relaxed);
+    messagesSendNs_.fetch_add(elapsedNs, std::memory_order_relaxed);
+  }
+  return result == k_EResultOK;
+}
+
+SteamVpnNetworkingManager::PeerSnapshotPtr
+SteamVpnNetworkingManager::loadPeers() const {
+  return std::atomic_load(&peerSnapshot_);
+}
+
+void SteamVpnNetworkingManager::publishPeers() {
+  auto snapshot = std::make_shared<std::vector<PeerPath>>();
+  {
+    std::lock_guard<std::mutex> peersLock(peersMutex_);
+    std::lock_guard<std::mutex> connectionsLock(connectionsMutex_);
+    snapshot->reserve(peers_.size());
+    for (const auto &peerID : peers_) {
+      PeerPath path{peerID, k_HSteamNetConnection_Invalid};
+      auto it = peerConnections_.find(peerID);
+      if (connectionDataPlane_ && it != peerConnections_.end() &&
+          it->second.connected) {
+        path.conn = it->second.handle;
+      }
+      snapshot->push_back(path);
+    }
+  }
+  std::atomic_store(&peerSnapshot_,
+                    PeerSnapshotPtr(std::move(snapshot)));
+}
+
+HSteamNetConnection
+SteamVpnNetworkingManager::connectedHandleFor(CSteamID peerID) const {
+  if (!connectionDataPlane_) {
+    return k_HSteamNetConnection_Invalid;
+  }
+  std::lock_guard<std::mutex> lock(connectionsMutex_);
+  auto it = peerConnections_.find(peerID);
+  if (it != peerConnections_.end() && it->second.connected) {
+    return it->second.handle;
+  }
+  return k_HSteamNetConnection_Invalid;
+}
+
+bool SteamVpnNetworkingManager::getPeerSendRate(
+    CSteamID peerID, SendRateController::RateInfo &out) const {
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  return rateController_ && conn != k_HSteamNetConnection_Invalid &&
+         rateController_->getRate(conn, out);
+}
+
+SteamVpnNetworkingManager::DataPlaneStats
+SteamVpnNetworkingManager::getDataPlaneStats() const {
+  DataPlaneStats stats;
+  stats.messagesSends = messagesSends_.load(std::memory_order_relaxed);
+  stats.messagesSendNs = messagesSendNs_.load(std::memory_order_relaxed);
+  stats.connectionSends = connectionSends_.load(std::memory_order_relaxed);
+  stats.connectionSendNs = connectionSendNs_.load(std::memory_order_relaxed);
+  return stats;
 }
 
 void SteamVpnNetworkingManager::addPeer(CSteamID peerID) {
@@ -128,11 +394,11 @@ void SteamVpnNetworkingManager::addPeer(CSteamID peerID) {
   if (SteamUser() && peerID == SteamUser()->GetSteamID()) {
     return;
   }
-  bool isNew = false;
   {
     std::lock_guard<std::mutex> lock(peersMutex_);
-    isNew = peers_.insert(peerID).second;
+    peers_.insert(peerID);
   }
+  publishPeers();
   // Force a fresh session even if we already know this peer, so reconnects
   // after a leave/rejoin can renegotiate cleanly.
   SteamNetworkingIdentity identity;
@@ -154,6 +420,10 @@ void SteamVpnNetworkingManager::addPeer(CSteamID peerID) {
               << peerID.ConvertToUint64() << ", result: " << result
               << std::endl;
   }
+  if (connectionDataPlane_ && initiatesConnectionTo(peerID) &&
+      connectedHandleFor(peerID) == k_HSteamNetConnection_Invalid) {
+    connectPeer(peerID);
+  }
   if (vpnBridge_) {
     vpnBridge_->onUserJoined(peerID);
   }
@@ -171,6 +441,8 @@ void SteamVpnNetworkingManager::removePeer(CSteamID peerID) {
     if (messagesInterface_) {
       messagesInterface_->CloseSessionWithUser(identity);
     }
+    closePeerConnection(peerID);
+    publishPeers();
     if (vpnBridge_) {
       vpnBridge_->onUserLeft(peerID);
     }
@@ -178,18 +450,27 @@ void SteamVpnNetworkingManager::removePeer(CSteamID peerID) {
 }
 
 void SteamVpnNetworkingManager::clearPeers() {
-  std::lock_guard<std::mutex> lock(peersMutex_);
-  for (const auto &peerID : peers_) {
+  std::set<CSteamID> removed;
+  {
+    std::lock_guard<std::mutex> lock(peersMutex_);
+    removed.swap(peers_);
+  }
+  for (const auto &peerID : removed) {
     SteamNetworkingIdentity identity;
     identity.SetSteamID(peerID);
     if (messagesInterface_) {
       messagesInterface_->CloseSessionWithUser(identity);
     }
-    if (vpnBridge_) {
+    closePeerConnection(peerID);
+  }
+  // As in removePeer(): the peers leave the snapshot before the bridge
+  // drops their contexts, so no packet can bring one back.
+  publishPeers();
+  if (vpnBridge_) {
+    for (const auto &peerID : removed) {
       vpnBridge_->onUserLeft(peerID);
     }
   }
-  peers_.clear();
 }
 
 void SteamVpnNetworkingManager::syncPeers(
@@ -209,6 +490,9 @@ void SteamVpnNetworkingManager::syncPeers(
       removePeer(peer);
     }
   }
+  if (connectionDataPlane_) {
+    maintainConnections();
+  }
 }
 
 std::set<CSteamID> SteamVpnNetworkingManager::getPeers() const {
@@ -216,10 +500,24 @@ std::set<CSteamID> SteamVpnNetworkingManager::getPeers() const {
   return peers_;
 }
 
+bool SteamVpnNetworkingManager::isPeer(CSteamID peerID) const {
+  const PeerSnapshotPtr peers = loadPeers();
+  return std::any_of(peers->begin(), peers->end(),
+                     [&](const PeerPath &path) { return path.steamID == peerID; });
+}
+
 int SteamVpnNetworkingManager::getPeerPing(CSteamID peerID) const {
   if (!messagesInterface_) {
     return -1;
   }
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  if (conn != k_HSteamNetConnection_Invalid) {
+    SteamNetConnectionRealTimeStatus_t connStatus;
+    if (socketsInterface_->GetConnectionRealTimeStatus(conn, &connStatus, 0,
+                                                       nullptr) == k_EResultOK) {
+      return connStatus.m_nPing;
+    }
+  }
   SteamNetworkingIdentity identity;
   identity.SetSteamID(peerID);
   SteamNetConnectionRealTimeStatus_t status;
@@ -235,6 +533,9 @@ bool SteamVpnNetworkingManager::isPeerConnected(CSteamID peerID) const {
   if (!messagesInterface_) {
     return false;
   }
+  if (connectedHandleFor(peerID) != k_HSteamNetConnection_Invalid) {
+    return true;
+  }
   SteamNetworkingIdentity identity;
   identity.SetSteamID(peerID);
   const ESteamNetworkingConnectionState state =
@@ -247,9 +548,16 @@ SteamVpnNetworkingManager::getPeerConnectionType(CSteamID peerID) const {
   if (!messagesInterface_) {
     return "N/A";
   }
+  SteamNetConnectionInfo_t info;
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  if (conn != k_HSteamNetConnection_Invalid &&
+      socketsInterface_->GetConnectionInfo(conn, &info)) {
+    return (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed)
+               ? "中继"
+               : "直连";
+  }
   SteamNetworkingIdentity identity;
   identity.SetSteamID(peerID);
-  SteamNetConnectionInfo_t info;
   const ESteamNetworkingConnectionState state =
       messagesInterface_->GetSessionConnectionInfo(identity, &info, nullptr);
   if (state == k_ESteamNetworkingConnectionState_Connected) {
@@ -261,6 +569,73 @@ SteamVpnNetworkingManager::getPeerConnectionType(CSteamID peerID) const {
   return "N/A";
 }
 
+bool SteamVpnNetworkingManager::isPeerRelayed(CSteamID peerID) const {
+  if (!messagesInterface_) {
+    return true;
+  }
+  SteamNetConnectionInfo_t info;
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  if (conn != k_HSteamNetConnection_Invalid &&
+      socketsInterface_->GetConnectionInfo(conn, &info)) {
+    return (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed) != 0;
+  }
+  SteamNetworkingIdentity identity;
+  identity.SetSteamID(peerID);
+  if (messagesInterface_->GetSessionConnectionInfo(identity, &info, nullptr) !=
+      k_ESteamNetworkingConnectionState_Connected) {
+    return true;
+  }
+  return (info.m_nFlags & k_nSteamNetworkConnectionInfoFlags_Relayed) != 0;
+}
+
+int SteamVpnNetworkingManager::getPeerMessageMtu(CSteamID peerID) const {
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  ISteamNetworkingUtils *utils = SteamNetworkingUtils();
+  if (conn == k_HSteamNetConnection_Invalid || !utils) {
+    return 0;
+  }
+  int32 dataSize = 0;
+  size_t size = sizeof(dataSize);
+  ESteamNetworkingConfigDataType type;
+  const ESteamNetworkingGetConfigValueResult result = utils->GetConfigValue(
+      k_ESteamNetworkingConfig_MTU_DataSize, k_ESteamNetworkingConfig_Connection,
+      static_cast<intptr_t>(conn), &type, &dataSize, &size);
+  if (result != k_ESteamNetworkingGetConfigValue_OK &&
+      result != k_ESteamNetworkingGetConfigValue_OKInherited) {
+    return 0;
+  }
+  return dataSize;
+}
+
+bool SteamVpnNetworkingManager::getPeerSendQueue(CSteamID peerID,
+                                                 SendQueueStatus &out) const {
+  out = SendQueueStatus{};
+  SteamNetConnectionRealTimeStatus_t status;
+  const HSteamNetConnection conn = connectedHandleFor(peerID);
+  if (conn != k_HSteamNetConnection_Invalid) {
+    if (socketsInterface_->GetConnectionRealTimeStatus(conn, &status, 0,
+                                                       nullptr) != k_EResultOK) {
+      return false;
+    }
+  } else {
+    if (!messagesInterface_) {
+      return false;
+    }
+    SteamNetworkingIdentity identity;
+    identity.SetSteamID(peerID);
+    if (messagesInterface_->GetSessionConnectionInfo(identity, nullptr,
+                                                     &status) !=
+        k_ESteamNetworkingConnectionState_Connected) {
+      return false;
+    }
+  }
+  out.pendingBytes = status.m_cbPendingUnreliable + status.m_cbPendingReliable;
+  out.queueTimeUsec = status.m_usecQueueTime;
+  out.sendRateBytesPerSec = status.m_nSendRateBytesPerSecond;
+  out.remoteQuality = status.m_flConnectionQualityRemote;
+  return true;
+}
+
 void SteamVpnNetworkingManager::startMessageHandler() {
   if (messageHandler_) {
     messageHandler_->start();
@@ -281,13 +656,17 @@ void SteamVpnNetworkingManager::handleIncomingVpnMessage(
   vpnBridge_->handleVpnMessage(data, size, senderSteamID);
 }
 
+void SteamVpnNetworkingManager::flushIncomingVpnMessages() {
+  if (vpnBridge_) {
+    vpnBridge_->flushTunWrites();
+  }
+}
+
 void SteamVpnNetworkingManager::OnSessionRequest(
     SteamNetworkingMessagesSessionRequest_t *pCallback) {
   const CSteamID remoteSteamID = pCallback->m_identityRemote.GetSteamID();
   std::cout << "[SteamVPN] Session request from "
             << remoteSteamID.ConvertToUint64() << std::endl;
-  bool accept = false;
-  accept = true;
   if (messagesInterface_) {
     messagesInterface_->AcceptSessionWithUser(pCallback->m_identityRemote);
     std::cout << "[SteamVPN] Accepted session from known peer" << std::endl;
@@ -302,3 +681,221 @@ void SteamVpnNetworkingManager::OnSessionFailed(
             << pCallback->m_info.m_szEndDebug << std::endl;
   removePeer(remoteSteamID);
 }
+
+void SteamVpnNetworkingManager::OnPersonaStateChange(
+    PersonaStateChange_t *pCallback) {
+  if (vpnBridge_ && (pCallback->m_nChangeFlags & k_EPersonaChangeName)) {
+    vpnBridge_->onPeerPersonaChanged(CSteamID(pCallback->m_ulSteamID));
+  }
+}
+
+bool SteamVpnNetworkingManager::initiatesConnectionTo(CSteamID peerID) const {
+  // Only one side dials so simultaneous ConnectP2P calls don't produce two
+  // connections for the same pair; the lower SteamID is the initiator.
+  return SteamUser() &&
+         SteamUser()->GetSteamID().ConvertToUint64() < peerID.ConvertToUint64();
+}
+
+void SteamVpnNetworkingManager::connectPeer(CSteamID peerID) {
+  if (!socketsInterface_) {
+    return;
+  }
+  closePeerConnection(peerID);
+  SteamNetworkingIdentity identity;
+  identity.SetSteamID(peerID);
+  SteamNetworkingConfigValue_t option;
+  option.SetPtr(k_ESteamNetworkingConfig_Callback_ConnectionStatusChanged,
+                reinterpret_cast<void *>(
+                    &SteamVpnNetworkingManager::OnConnectionStatusChanged));
+  const HSteamNetConnection conn =
+      socketsInterface_->ConnectP2P(identity, VPN_VIRTUAL_PORT, 1, &option);
+  std::lock_guard<std::mutex> lock(connectionsMutex_);
+  lastDialAttempt_[peerID] = std::chrono::steady_clock::now();
+  if (conn == k_HSteamNetConnection_Invalid) {
+    std::cout << "[SteamVPN] ConnectP2P failed for "
+              << peerID.ConvertToUint64() << std::endl;
+    return;
+  }
+  socketsInterface_->SetConnectionPollGroup(conn, pollGroup_);
+  PeerConnection entry;
+  entry.handle = conn;
+  peerConnections_[peerID] = entry;
+  std::cout << "[SteamVPN] Dialing data plane connection to "
+            << peerID.ConvertToUint64() << std::endl;
+}
+
+void SteamVpnNetworkingManager::closePeerConnection(CSteamID peerID) {
+  if (!socketsInterface_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(connectionsMutex_);
+  auto it = peerConnections_.find(peerID);
+  if (it == peerConnections_.end()) {
+    return;
+  }
+  socketsInterface_->CloseConnection(it->second.handle, 0, "Peer removed",
+                                     false);
+  peerConnections_.erase(it);
+}
+
+void SteamVpnNetworkingManager::maintainConnections() {
+  const auto now = std::chrono::steady_clock::now();
+  std::set<CSteamID> peers;
+  {
+    std::lock_guard<std::mutex> lock(peersMutex_);
+    peers = peers_;
+  }
+  std::vector<CSteamID> toDial;
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    for (auto it = lastDialAttempt_.begin(); it != lastDialAttempt_.end();) {
+      if (peers.find(it->first) == peers.end()) {
+        it = lastDialAttempt_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (const auto &peer : peers) {
+      if (!initiatesConnectionTo(peer) ||
+          peerConnections_.find(peer) != peerConnections_.end()) {
+        continue;
+      }
+      auto last = lastDialAttempt_.find(peer);
+      if (last == lastDialAttempt_.end() ||
+          now - last->second > std::chrono::seconds(10)) {
+        toDial.push_back(peer);
+      }
+    }
+  }
+  for (const auto &peer : toDial) {
+    connectPeer(peer);
+  }
+
+  if (rateController_) {
+    std::vector<HSteamNetConnection> connected;
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex_);
+      for (const auto &entry : peerConnections_) {
+        if (entry.second.connected) {
+          connected.push_back(entry.second.handle);
+        }
+      }
+    }
+    rateController_->sync(connected);
+    rateController_->update();
+  }
+
+  if (now - lastStatsLog_ < std::chrono::seconds(30)) {
+    return;
+  }
+  lastStatsLog_ = now;
+  const DataPlaneStats stats = getDataPlaneStats();
+  std::cout << "[SteamVPN] Data plane sends: messages=" << stats.messagesSends
+            << " (avg "
+            << (stats.messagesSends ? stats.messagesSendNs / stats.messagesSends
+                                    : 0)
+            << " ns), sockets=" << stats.connectionSends << " (avg "
+            << (stats.connectionSends
+                    ? stats.connectionSendNs / stats.connectionSends
+                    : 0)
+            << " ns)" << std::endl;
+  for (const auto &peer : peers) {
+    const HSteamNetConnection conn = connectedHandleFor(peer);
+    if (conn == k_HSteamNetConnection_Invalid) {
+      continue;
+    }
+    SteamNetConnectionRealTimeStatus_t connStatus;
+    SteamNetConnectionRealTimeStatus_t sessionStatus;
+    SteamNetworkingIdentity identity;
+    identity.SetSteamID(peer);
+    const int connPing =
+        socketsInterface_->GetConnectionRealTimeStatus(conn, &connStatus, 0,
+                                                       nullptr) == k_EResultOK
+            ? connStatus.m_nPing
+            : -1;
+    const int sessionPing =
+        messagesInterface_->GetSessionConnectionInfo(identity, nullptr,
+                                                     &sessionStatus) ==
+                k_ESteamNetworkingConnectionState_Connected
+            ? sessionStatus.m_nPing
+            : -1;
+    std::cout << "[SteamVPN]   peer " << peer.ConvertToUint64()
+              << " ping sockets=" << connPing << "ms messages=" << sessionPing
+              << "ms" << std::endl;
+  }
+}
+
+void SteamVpnNetworkingManager::handleConnectionStatusChanged(
+    SteamNetConnectionStatusChangedCallback_t *pInfo) {
+  if (!socketsInterface_) {
+    return;
+  }
+  const HSteamNetConnection conn = pInfo->m_hConn;
+  const CSteamID peer = pInfo->m_info.m_identityRemote.GetSteamID();
+  switch (pInfo->m_info.m_eState) {
+  case k_ESteamNetworkingConnectionState_Connecting: {
+    if (pInfo->m_info.m_hListenSocket == k_HSteamListenSocket_Invalid ||
+        pInfo->m_info.m_hListenSocket != listenSocket_) {
+      break; // our own outgoing attempt
+    }
+    if (!isPeer(peer)) {
+      // Only lobby members get a data plane, as on the messages path.
+      socketsInterface_->CloseConnection(conn, 0, "Not a peer", false);
+      std::cout << "[SteamVPN] Rejected data plane connection from non-peer "
+                << peer.ConvertToUint64() << std::endl;
+      break;
+    }
+    if (socketsInterface_->AcceptConnection(conn) != k_EResultOK) {
+      socketsInterface_->CloseConnection(conn, 0, "Accept failed", false);
+      break;
+    }
+    socketsInterface_->SetConnectionPollGroup(conn, pollGroup_);
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    auto it = peerConnections_.find(peer);
+    if (it != peerConnections_.end() && it->second.handle != conn) {
+      socketsInterface_->CloseConnection(it->second.handle, 0,
+                                         "Replace duplicate connection", false);
+    }
+    PeerConnection entry;
+    entry.handle = conn;
+    peerConnections_[peer] = entry;
+    std::cout << "[SteamVPN] Accepted data plane connection from "
+              << peer.ConvertToUint64() << std::endl;
+    break;
+  }
+  case k_ESteamNetworkingConnectionState_Connected: {
+    {
+      std::lock_guard<std::mutex> lock(connectionsMutex_);
+      auto it = peerConnections_.find(peer);
+      if (it == peerConnections_.end() || it->second.handle != conn) {
+        break;
+      }
+      it->second.connected = true;
+    }
+    std::cout << "[SteamVPN] Data plane connected to "
+              << peer.ConvertToUint64() << " ("
+              << ((pInfo->m_info.m_nFlags &
+                   k_nSteamNetworkConnectionInfoFlags_Relayed)
+                      ? "relay"
+                      : "direct")
+              << ")" << std::endl;
+    break;
+  }
+  case k_ESteamNetworkingConnectionState_ClosedByPeer:
+  case k_ESteamNetworkingConnectionState_ProblemDetectedLocally: {
+    std::cout << "[SteamVPN] Data plane connection to "
+              << peer.ConvertToUint64()
+              << " closed: " << pInfo->m_info.m_szEndDebug << std::endl;
+    socketsInterface_->CloseConnection(conn, 0, nullptr, false);
+    std::lock_guard<std::mutex> lock(connectionsMutex_);
+    auto it = peerConnections_.find(peer);
+    if (it != peerConnections_.end() && it->second.handle == conn) {
+      peerConnections_.erase(it);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  publishPeers();
+}
@@ -1,11 +1,19 @@
 #pragma once
 
+#include "send_rate_controller.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <steam_api.h>
 #include <isteamnetworkingmessages.h>
+#include <isteamnetworkingsockets.h>
 #include <steamnetworkingtypes.h>
 #include <string>
+#include <vector>
 
 class VpnMessageHandler;
 class SteamVpnBridge;
@@ -13,6 +21,17 @@ class SteamVpnBridge;
 class SteamVpnNetworkingManager {
 public:
   static constexpr int VPN_CHANNEL = 0;
+  // Virtual port for the connection-oriented data plane. Kept away from 0,
+  // which the TCP mode listen socket uses.
+  static constexpr int VPN_VIRTUAL_PORT = 7;
+
+  // Per-path send cost, used to compare the Messages and Sockets data planes.
+  struct DataPlaneStats {
+    uint64_t messagesSends = 0;
+    uint64_t messagesSendNs = 0;
+    uint64_t connectionSends = 0;
+    uint64_t connectionSendNs = 0;
+  };
 
   SteamVpnNetworkingManager();
   ~SteamVpnNetworkingManager();
@@ -22,35 +41,128 @@ public:
 
   bool sendMessageToUser(CSteamID peerID, const void *data, uint32_t size,
                          int flags);
-  void broadcastMessage(const void *data, uint32_t size, int flags);
+  // Submit several messages to one peer together; uses a single SendMessages
+  // call on the connection data plane.
+  struct OutgoingMessage {
+    const void *data;
+    uint32_t size;
+    // PacketPool buffer that data points into. On the connection data plane
+    // it is sent as is, without a copy.
+    uint8_t *pooledBuffer = nullptr;
+  };
+  // Returns true if Steam took ownership of every pooledBuffer (they must
+  // not be reused); false if the data was copied.
+  bool sendMessagesToUser(CSteamID peerID, const OutgoingMessage *messages,
+                          size_t count, int flags);
+  // Send one payload to every peer, or only those accepted by filter.
+  // Connection data plane peers share a single refcounted copy submitted in
+  // one SendMessages call. Returns the number of peers it went to.
+  size_t broadcastMessage(const void *data, uint32_t size, int flags,
+                          const std::function<bool(CSteamID)> &filter = {});
 
   void addPeer(CSteamID peerID);
   void removePeer(CSteamID peerID);
   void clearPeers();
   void syncPeers(const std::set<CSteamID> &desiredPeers);
   std::set<CSteamID> getPeers() const;
+  // Whether peerID is currently a peer; lock-free, for the packet path.
+  bool isPeer(CSteamID peerID) const;
 
   int getPeerPing(CSteamID peerID) const;
   bool isPeerConnected(CSteamID peerID) const;
   std::string getPeerConnectionType(CSteamID peerID) const;
+  // Whether traffic to peerID goes through a Steam relay; true when unknown.
+  bool isPeerRelayed(CSteamID peerID) const;
+  // Largest message Steam sends to peerID in a single packet, or 0 if it
+  // cannot tell (only known for connection data plane peers).
+  int getPeerMessageMtu(CSteamID peerID) const;
+  // Steam's send queue towards peerID: bytes not yet on the wire, how long
+  // they will take to go out, the rate they go out at, and the fraction of
+  // our packets the peer reports receiving (< 0 if unknown). False (all
+  // zero) if there is no connected path to ask.
+  struct SendQueueStatus {
+    int pendingBytes = 0;
+    int64_t queueTimeUsec = 0;
+    int sendRateBytesPerSec = 0;
+    float remoteQuality = -1.0f;
+  };
+  bool getPeerSendQueue(CSteamID peerID, SendQueueStatus &out) const;
 
   void startMessageHandler();
   void stopMessageHandler();
 
+  // Opt-in: carry VPN traffic over one ConnectP2P connection per peer instead
+  // of ISteamNetworkingMessages. Must be called before initialize().
+  void setConnectionDataPlaneEnabled(bool enabled) {
+    connectionDataPlane_ = enabled;
+  }
+  bool connectionDataPlaneEnabled() const { return connectionDataPlane_; }
+  DataPlaneStats getDataPlaneStats() const;
+  // Only connection data plane peers have a controllable send rate.
+  bool getPeerSendRate(CSteamID peerID,
+                       SendRateController::RateInfo &out) const;
+
   void setVpnBridge(SteamVpnBridge *vpnBridge) { vpnBridge_ = vpnBridge; }
   SteamVpnBridge *getVpnBridge() { return vpnBridge_; }
 
   void handleIncomingVpnMessage(const uint8_t *data, size_t size,
                                 CSteamID senderSteamID);
+  void flushIncomingVpnMessages();
 
   void setHostSteamID(CSteamID id) { hostSteamID_ = id; }
   CSteamID getHostSteamID() const { return hostSteamID_; }
 
 private:
+  static void OnConnectionStatusChanged(
+      SteamNetConnectionStatusChangedCallback_t *pInfo);
+  void handleConnectionStatusChanged(
+      SteamNetConnectionStatusChangedCallback_t *pInfo);
+  bool initiatesConnectionTo(CSteamID peerID) const;
+  void connectPeer(CSteamID peerID);
+  void closePeerConnection(CSteamID peerID);
+  void maintainConnections();
+  HSteamNetConnection connectedHandleFor(CSteamID peerID) const;
+  bool sendOnPath(CSteamID peerID, HSteamNetConnection conn, const void *data,
+                  uint32_t size, int flags);
+
+  // Peers with their connected data plane handle (or invalid), republished
+  // whenever peers_ or a connection changes so broadcasts never lock.
+  struct PeerPath {
+    CSteamID steamID;
+    HSteamNetConnection conn;
+  };
+  using PeerSnapshotPtr = std::shared_ptr<const std::vector<PeerPath>>;
+  PeerSnapshotPtr loadPeers() const;
+  // Takes peersMutex_ and connectionsMutex_; call with neither held.
+  void publishPeers();
+
+  static SteamVpnNetworkingManager *instance_;
+
   ISteamNetworkingMessages *messagesInterface_;
   std::set<CSteamID> peers_;
   mutable std::mutex peersMutex_;
 
+  bool connectionDataPlane_ = false;
+  ISteamNetworkingSockets *socketsInterface_ = nullptr;
+  HSteamListenSocket listenSocket_ = k_HSteamListenSocket_Invalid;
+  HSteamNetPollGroup pollGroup_ = k_HSteamNetPollGroup_Invalid;
+  struct PeerConnection {
+    HSteamNetConnection handle = k_HSteamNetConnection_Invalid;
+    bool connected = false;
+  };
+  std::map<CSteamID, PeerConnection> peerConnections_;
+  std::map<CSteamID, std::chrono::steady_clock::time_point> lastDialAttempt_;
+  mutable std::mutex connectionsMutex_;
+  std::unique_ptr<SendRateController> rateController_;
+  PeerSnapshotPtr peerSnapshot_ =
+      std::make_shared<const std::vector<PeerPath>>();
+  std::chrono::steady_clock::time_point lastStatsLog_;
+
+  std::atomic<uint64_t> messagesSends_{0};
+  std::atomic<uint64_t> messagesSendNs_{0};
+  std::atomic<uint64_t> connectionSends_{0};
+  std::atomic<uint64_t> connectionSendNs_{0};
+
   VpnMessageHandler *messageHandler_;
   SteamVpnBridge *vpnBridge_;
   CSteamID hostSteamID_;
@@ -59,4 +171,6 @@ private:
                  SteamNetworkingMessagesSessionRequest_t);
   STEAM_CALLBACK(SteamVpnNetworkingManager, OnSessionFailed,
                  SteamNetworkingMessagesSessionFailed_t);
+  STEAM_CALLBACK(SteamVpnNetworkingManager, OnPersonaStateChange,
+                 PersonaStateChange_t);
 };
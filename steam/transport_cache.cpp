@@ -0,0 +1,87 @@
+#include "transport_cache.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+int64_t unixNow() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace
+
+void TransportCache::load(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  path_ = path;
+  entries_.clear();
+  std::ifstream in(path_);
+  if (!in) {
+    return;
+  }
+  const int64_t now = unixNow();
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    uint64_t peer = 0;
+    int relay = 0;
+    Entry entry;
+    if (!(fields >> peer >> relay >> entry.rttMs >> entry.popId >>
+          entry.quality >> entry.updatedAt)) {
+      continue;
+    }
+    if (now - entry.updatedAt > kMaxAgeSeconds) {
+      continue;
+    }
+    entry.relay = relay != 0;
+    entries_[peer] = entry;
+  }
+  std::cout << "[SteamNet] Loaded " << entries_.size()
+            << " cached transport entries" << std::endl;
+}
+
+bool TransportCache::lookup(uint64_t peer, Entry &out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(peer);
+  if (it == entries_.end() ||
+      unixNow() - it->second.updatedAt > kMaxAgeSeconds) {
+    return false;
+  }
+  out = it->second;
+  return true;
+}
+
+void TransportCache::record(uint64_t peer, const Entry &entry) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Entry stored = entry;
+  stored.updatedAt = unixNow();
+  entries_[peer] = stored;
+  saveLocked();
+}
+
+void TransportCache::invalidate(uint64_t peer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.erase(peer) > 0) {
+    std::cout << "[SteamNet] Dropped cached transport for " << peer
+              << std::endl;
+    saveLocked();
+  }
+}
+
+void TransportCache::saveLocked() const {
+  if (path_.empty()) {
+    return;
+  }
+  std::ofstream out(path_, std::ios::trunc);
+  if (!out) {
+    std::cerr << "[SteamNet] Failed to write transport cache " << path_
+              << std::endl;
+    return;
+  }
+  for (const auto &kv : entries_) {
+    const Entry &e = kv.second;
+    out << kv.first << ' ' << (e.relay ? 1 : 0) << ' ' << e.rttMs << ' '
+        << e.popId << ' ' << e.quality << ' ' << e.updatedAt << '\n';
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Last path that worked for each peer, kept on disk so a reconnect can
+// preselect ICE or relay instead of relearning it.
+class TransportCache {
+public:
+  struct Entry {
+    bool relay = false;
+    int rttMs = -1;
+    uint32_t popId = 0; // SteamNetworkingPOPID of the relay, 0 for ICE
+    float quality = -1.0f;
+    int64_t updatedAt = 0; // unix seconds
+  };
+
+  static constexpr int64_t kMaxAgeSeconds = 7 * 24 * 3600;
+
+  void load(const std::string &path);
+  bool lookup(uint64_t peer, Entry &out) const;
+  void record(uint64_t peer, const Entry &entry);
+  void invalidate(uint64_t peer);
+
+private:
+  void saveLocked() const;
+
+  std::string path_;
+  std::map<uint64_t, Entry> entries_;
+  mutable std::mutex mutex_;
+};
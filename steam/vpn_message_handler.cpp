@@ -22,6 +22,14 @@ void VpnMessageHandler::setIoContext(boost::asio::io_context *externalContext) {
   }
 }
 
+void VpnMessageHandler::setPollGroup(ISteamNetworkingSockets *sockets,
+                                     HSteamNetPollGroup pollGroup) {
+  if (!running_) {
+    sockets_ = sockets;
+    pollGroup_ = pollGroup;
+  }
+}
+
 void VpnMessageHandler::start() {
   if (running_) {
     return;
@@ -96,10 +104,24 @@ void VpnMessageHandler::pollMessages() {
     return;
   }
   ISteamNetworkingMessage *incoming[64];
-  const int numMsgs =
-      interface_->ReceiveMessagesOnChannel(VPN_CHANNEL, incoming, 64);
-  for (int i = 0; i < numMsgs; ++i) {
-    ISteamNetworkingMessage *msg = incoming[i];
+  int numMsgs = dispatchMessages(
+      incoming, interface_->ReceiveMessagesOnChannel(VPN_CHANNEL, incoming, 64));
+  if (sockets_ && pollGroup_ != k_HSteamNetPollGroup_Invalid) {
+    numMsgs += dispatchMessages(
+        incoming, sockets_->ReceiveMessagesOnPollGroup(pollGroup_, incoming, 64));
+  }
+  if (numMsgs > 0) {
+    currentPollInterval_ = MIN_POLL_INTERVAL;
+  } else {
+    currentPollInterval_ =
+        std::min(currentPollInterval_ + POLL_INCREMENT, MAX_POLL_INTERVAL);
+  }
+}
+
+int VpnMessageHandler::dispatchMessages(ISteamNetworkingMessage **messages,
+                                        int count) {
+  for (int i = 0; i < count; ++i) {
+    ISteamNetworkingMessage *msg = messages[i];
     const uint8_t *data = static_cast<const uint8_t *>(msg->m_pData);
     const size_t size = msg->m_cbSize;
     const CSteamID sender = msg->m_identityPeer.GetSteamID();
@@ -113,10 +135,8 @@ void VpnMessageHandler::pollMessages() {
     }
     msg->Release();
   }
-  if (numMsgs > 0) {
-    currentPollInterval_ = MIN_POLL_INTERVAL;
-  } else {
-    currentPollInterval_ =
-        std::min(currentPollInterval_ + POLL_INCREMENT, MAX_POLL_INTERVAL);
+  if (manager_ && count > 0) {
+    manager_->flushIncomingVpnMessages();
   }
+  return count < 0 ? 0 : count;
 }
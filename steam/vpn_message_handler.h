@@ -4,6 +4,7 @@
 #include <boost/asio.hpp>
 #include <chrono>
 #include <isteamnetworkingmessages.h>
+#include <isteamnetworkingsockets.h>
 #include <memory>
 #include <steamnetworkingtypes.h>
 #include <thread>
@@ -19,14 +20,20 @@ public:
   void start();
   void stop();
   void setIoContext(boost::asio::io_context *externalContext);
+  // Also drain connection-oriented traffic from this poll group.
+  void setPollGroup(ISteamNetworkingSockets *sockets,
+                    HSteamNetPollGroup pollGroup);
 
 private:
   void schedulePoll();
   void pollMessages();
   void runInternalLoop();
+  int dispatchMessages(ISteamNetworkingMessage **messages, int count);
 
   ISteamNetworkingMessages *interface_;
   SteamVpnNetworkingManager *manager_;
+  ISteamNetworkingSockets *sockets_ = nullptr;
+  HSteamNetPollGroup pollGroup_ = k_HSteamNetPollGroup_Invalid;
 
   std::unique_ptr<boost::asio::io_context> internalIoContext_;
   boost::asio::io_context *ioContext_;
@@ -0,0 +1,176 @@
+#include "flow_scheduler.h"
+#include "packet_pool.h"
+#include "test_util.h"
+#include <cstring>
+
+namespace {
+using Clock = FlowScheduler::Clock;
+
+void enqueue(FlowScheduler &scheduler, const std::vector<uint8_t> &ip,
+             Clock::time_point now) {
+  FlowScheduler::Packet packet;
+  packet.buffer = PacketPool::instance().acquire();
+  packet.ip = packet.buffer;
+  packet.ipLength = ip.size();
+  packet.enqueued = now;
+  std::memcpy(packet.ip, ip.data(), ip.size());
+  scheduler.enqueue(packet);
+}
+
+// The source port of the next packet out, or 0 if there is none.
+uint16_t dequeuePort(FlowScheduler &scheduler, Clock::time_point now,
+                     FlowScheduler::Packet *kept = nullptr) {
+  FlowScheduler::Packet packet;
+  if (!scheduler.dequeue(packet, now)) {
+    return 0;
+  }
+  const uint16_t port =
+      static_cast<uint16_t>((packet.ip[20] << 8) | packet.ip[21]);
+  if (kept) {
+    *kept = packet;
+  } else {
+    PacketPool::instance().release(packet.buffer);
+  }
+  return port;
+}
+
+std::vector<uint8_t> udp(uint16_t sourcePort, size_t payload,
+                         uint8_t tos = 0) {
+  TestPacket spec;
+  spec.sourcePort = sourcePort;
+  spec.payloadLength = payload;
+  spec.tos = tos;
+  return spec.build();
+}
+
+void testDrrSharesBetweenBulkFlows() {
+  FlowScheduler scheduler;
+  const auto now = Clock::now();
+  for (int i = 0; i < 10; ++i) {
+    enqueue(scheduler, udp(1, 1000), now);
+  }
+  for (int i = 0; i < 10; ++i) {
+    enqueue(scheduler, udp(2, 1000), now);
+  }
+  // A 1514-byte quantum lets each flow send at most two 1028-byte packets
+  // before the other gets its turn.
+  uint16_t previous = 0;
+  int run = 0;
+  int served[3] = {};
+  for (int i = 0; i < 14; ++i) {
+    const uint16_t port = dequeuePort(scheduler, now);
+    CHECK(port == 1 || port == 2);
+    if (port != 1 && port != 2) {
+      return;
+    }
+    run = port == previous ? run + 1 : 1;
+    previous = port;
+    CHECK(run <= 2);
+    served[port]++;
+  }
+  CHECK(served[1] >= 6 && served[2] >= 6);
+  scheduler.clear();
+  CHECK(scheduler.empty());
+}
+
+void testSparseFlowGoesFirst() {
+  FlowScheduler scheduler;
+  const auto now = Clock::now();
+  for (int i = 0; i < 10; ++i) {
+    enqueue(scheduler, udp(1, 1000), now);
+  }
+  for (int i = 0; i < 3; ++i) {
+    CHECK(dequeuePort(scheduler, now) == 1);
+  }
+  enqueue(scheduler, udp(3, 100), now);
+  CHECK(dequeuePort(scheduler, now) == 3);
+  CHECK(dequeuePort(scheduler, now) == 1);
+}
+
+void testPriorityPackets() {
+  FlowScheduler scheduler;
+  const auto now = Clock::now();
+  for (int i = 0; i < 4; ++i) {
+    enqueue(scheduler, udp(1, 1000), now);
+  }
+  enqueue(scheduler, udp(4, 100, 46 << 2), now); // DSCP EF
+  TestPacket ack;
+  ack.protocol = 6;
+  ack.sourcePort = 5;
+  enqueue(scheduler, ack.build(), now);
+  CHECK(dequeuePort(scheduler, now) == 4);
+  CHECK(dequeuePort(scheduler, now) == 5);
+  CHECK(dequeuePort(scheduler, now) == 1);
+}
+
+void testCodelSheds() {
+  FlowScheduler scheduler;
+  const auto start = Clock::now();
+  for (int i = 0; i < 20; ++i) {
+    enqueue(scheduler, udp(1, 1000), start);
+  }
+  // The first packet over target only arms CoDel; a full interval later it
+  // sheds one packet and still delivers the next.
+  auto now = start + std::chrono::milliseconds(50);
+  CHECK(dequeuePort(scheduler, now) == 1);
+  CHECK(scheduler.drops() == 0);
+  now += std::chrono::milliseconds(101);
+  CHECK(dequeuePort(scheduler, now) == 1);
+  CHECK(scheduler.drops() == 1);
+  CHECK(scheduler.backlogPackets() == 17);
+  // Below target again: no more drops.
+  FlowScheduler fresh;
+  for (int i = 0; i < 20; ++i) {
+    enqueue(fresh, udp(1, 1000), now);
+  }
+  for (int i = 0; i < 20; ++i) {
+    CHECK(dequeuePort(fresh, now + std::chrono::milliseconds(1)) == 1);
+  }
+  CHECK(fresh.drops() == 0);
+}
+
+void testCodelMarksEcn() {
+  FlowScheduler scheduler;
+  const auto start = Clock::now();
+  std::vector<uint8_t> ect = udp(1, 1000, 0x02); // ECT(0)
+  // A valid header checksum, to check the CE rewrite keeps it valid.
+  uint32_t sum = 0;
+  for (size_t i = 0; i < 20; i += 2) {
+    sum += static_cast<uint32_t>((ect[i] << 8) | ect[i + 1]);
+  }
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  sum = (sum & 0xFFFF) + (sum >> 16);
+  ect[10] = static_cast<uint8_t>(~sum >> 8);
+  ect[11] = static_cast<uint8_t>(~sum);
+  for (int i = 0; i < 20; ++i) {
+    enqueue(scheduler, ect, start);
+  }
+  // Path delay alone puts the flow over target.
+  FlowScheduler::Packet packet;
+  const auto pathDelay = std::chrono::milliseconds(50);
+  CHECK(scheduler.dequeue(packet, start, pathDelay));
+  PacketPool::instance().release(packet.buffer);
+  CHECK(scheduler.dequeue(packet, start + std::chrono::milliseconds(101),
+                          pathDelay));
+  CHECK(scheduler.drops() == 0);
+  CHECK(scheduler.ecnMarked() == 1);
+  CHECK((packet.ip[1] & 0x03) == 0x03);
+  uint32_t check = 0;
+  for (size_t i = 0; i < 20; i += 2) {
+    check += static_cast<uint32_t>((packet.ip[i] << 8) | packet.ip[i + 1]);
+  }
+  check = (check & 0xFFFF) + (check >> 16);
+  check = (check & 0xFFFF) + (check >> 16);
+  CHECK(check == 0xFFFF);
+  PacketPool::instance().release(packet.buffer);
+}
+} // namespace
+
+int main() {
+  testDrrSharesBetweenBulkFlows();
+  testSparseFlowGoesFirst();
+  testPriorityPackets();
+  testCodelSheds();
+  testCodelMarksEcn();
+  return testResult("flow_scheduler");
+}
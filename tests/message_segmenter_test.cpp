@@ -0,0 +1,122 @@
+#include "message_segmenter.h"
+#include "packet_pool.h"
+#include "test_util.h"
+#include "vpn_wire.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+using Clock = MessageReassembler::Clock;
+
+std::vector<uint8_t> pattern(size_t length, uint8_t seed) {
+  std::vector<uint8_t> data(length);
+  for (size_t i = 0; i < length; ++i) {
+    data[i] = static_cast<uint8_t>(i * 13 + seed);
+  }
+  return data;
+}
+
+// The IP_PACKET_SEGMENT payloads (after the message header) for message.
+std::vector<std::vector<uint8_t>> split(MessageSegmenter &segmenter,
+                                        const std::vector<uint8_t> &message,
+                                        size_t budget) {
+  std::vector<std::vector<uint8_t>> payloads;
+  const bool ok = segmenter.split(
+      message.data(), message.size(), budget,
+      [&](uint8_t *segment, size_t size) {
+        CHECK(size <= budget);
+        VpnMessageHeader header{};
+        std::memcpy(&header, segment, sizeof(header));
+        CHECK(header.type == VpnMessageType::IP_PACKET_SEGMENT);
+        payloads.emplace_back(segment + sizeof(header), segment + size);
+        PacketPool::instance().release(segment);
+      });
+  CHECK(ok);
+  return payloads;
+}
+
+void testRoundTripOutOfOrder() {
+  MessageSegmenter segmenter;
+  MessageReassembler reassembler;
+  const auto message = pattern(3000, 1);
+  auto payloads = split(segmenter, message, 1200);
+  CHECK(payloads.size() == 3);
+  std::reverse(payloads.begin(), payloads.end());
+  std::vector<uint8_t> out;
+  const auto now = Clock::now();
+  CHECK(!reassembler.add(payloads[0].data(), payloads[0].size(), now, out));
+  CHECK(!reassembler.add(payloads[0].data(), payloads[0].size(), now, out));
+  CHECK(!reassembler.add(payloads[1].data(), payloads[1].size(), now, out));
+  CHECK(reassembler.add(payloads[2].data(), payloads[2].size(), now, out));
+  CHECK(out == message);
+  CHECK(reassembler.abandoned() == 0);
+}
+
+void testLossTimesOut() {
+  MessageSegmenter segmenter;
+  MessageReassembler reassembler;
+  const auto lost = split(segmenter, pattern(2000, 2), 1200);
+  const auto next = split(segmenter, pattern(2000, 3), 1200);
+  CHECK(lost.size() == 2 && next.size() == 2);
+  std::vector<uint8_t> out;
+  const auto start = Clock::now();
+  CHECK(!reassembler.add(lost[0].data(), lost[0].size(), start, out));
+  // The missing piece never arrives; the next message, past the timeout,
+  // gives up on it.
+  const auto later = start + std::chrono::milliseconds(600);
+  CHECK(!reassembler.add(next[0].data(), next[0].size(), later, out));
+  CHECK(reassembler.abandoned() == 1);
+  CHECK(reassembler.add(next[1].data(), next[1].size(), later, out));
+  CHECK(out == pattern(2000, 3));
+  // A straggler of the abandoned message does not complete anything.
+  CHECK(!reassembler.add(lost[1].data(), lost[1].size(), later, out));
+}
+
+void testPendingLimit() {
+  MessageSegmenter segmenter;
+  MessageReassembler reassembler;
+  std::vector<uint8_t> out;
+  const auto now = Clock::now();
+  for (uint8_t i = 0; i < 9; ++i) {
+    const auto payloads = split(segmenter, pattern(2000, i), 1200);
+    CHECK(!reassembler.add(payloads[0].data(), payloads[0].size(), now, out));
+  }
+  CHECK(reassembler.abandoned() == 1);
+}
+
+void testMalformed() {
+  MessageSegmenter segmenter;
+  MessageReassembler reassembler;
+  std::vector<uint8_t> out;
+  const auto now = Clock::now();
+  SegmentHeader header{};
+  header.index = 2;
+  header.count = 2; // index out of range
+  std::vector<uint8_t> payload(sizeof(header) + 10);
+  std::memcpy(payload.data(), &header, sizeof(header));
+  CHECK(!reassembler.add(payload.data(), payload.size(), now, out));
+  header.index = 0;
+  header.count = 0;
+  std::memcpy(payload.data(), &header, sizeof(header));
+  CHECK(!reassembler.add(payload.data(), payload.size(), now, out));
+  CHECK(!reassembler.add(payload.data(), sizeof(header), now, out));
+
+  // Too small a budget, or too many pieces.
+  const auto message = pattern(3000, 4);
+  const auto ignore = [](uint8_t *segment, size_t) {
+    PacketPool::instance().release(segment);
+  };
+  CHECK(!segmenter.split(message.data(), message.size(),
+                         sizeof(VpnMessageHeader) + sizeof(SegmentHeader),
+                         ignore));
+  CHECK(!segmenter.split(message.data(), message.size(), 40, ignore));
+}
+} // namespace
+
+int main() {
+  testRoundTripOutOfOrder();
+  testLossTimesOut();
+  testPendingLimit();
+  testMalformed();
+  return testResult("message_segmenter");
+}
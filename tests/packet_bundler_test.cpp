@@ -0,0 +1,86 @@
+#include "packet_bundler.h"
+#include "packet_pool.h"
+#include "test_util.h"
+#include "vpn_wire.h"
+#include <cstring>
+
+namespace {
+constexpr size_t kHeaders =
+    sizeof(VpnMessageHeader) + sizeof(CompactPacketHeader);
+
+std::vector<std::vector<uint8_t>> parse(const std::vector<uint8_t> &payload,
+                                        bool &ok) {
+  std::vector<std::vector<uint8_t>> packets;
+  ok = PacketBundler::forEach(payload.data(), payload.size(),
+                              [&](const uint8_t *ip, size_t length) {
+                                packets.emplace_back(ip, ip + length);
+                              });
+  return packets;
+}
+
+void testRoundTrip() {
+  std::vector<std::vector<uint8_t>> packets;
+  for (size_t i = 0; i < 3; ++i) {
+    TestPacket spec;
+    spec.sourcePort = static_cast<uint16_t>(i + 1);
+    spec.payloadLength = 20 + i * 30;
+    packets.push_back(spec.build());
+  }
+  PacketBundler bundler;
+  const auto now = PacketBundler::Clock::now();
+  for (const auto &packet : packets) {
+    CHECK(bundler.fits(packet.size(), 1200));
+    bundler.add(packet.data(), packet.size(), false, now);
+  }
+  CHECK(bundler.packets() == 3);
+  CHECK(!bundler.fits(1200, 1200));
+  const PacketBundler::Message message = bundler.finish(7);
+  CHECK(!bundler.open());
+  VpnMessageHeader header{};
+  std::memcpy(&header, message.data, sizeof(header));
+  CHECK(header.type == VpnMessageType::IP_PACKET_BUNDLE);
+  CHECK(message.size == kHeaders + 3 * 2 + 48 + 78 + 108);
+  bool ok = false;
+  const auto parsed = parse(
+      std::vector<uint8_t>(message.data + kHeaders,
+                           message.data + message.size),
+      ok);
+  CHECK(ok);
+  CHECK(parsed == packets);
+  PacketPool::instance().release(message.buffer);
+
+  // One packet alone goes out as a plain compact message.
+  bundler.add(packets[0].data(), packets[0].size(), true, now);
+  CHECK(bundler.urgent());
+  const PacketBundler::Message single = bundler.finish(7);
+  std::memcpy(&header, single.data, sizeof(header));
+  CHECK(header.type == VpnMessageType::IP_PACKET_COMPACT);
+  CHECK(single.size == kHeaders + packets[0].size());
+  CHECK(std::memcmp(single.data + kHeaders, packets[0].data(),
+                    packets[0].size()) == 0);
+  PacketPool::instance().release(single.buffer);
+}
+
+void testMalformed() {
+  bool ok = false;
+  CHECK(parse({}, ok).empty() && ok);
+  // A length field cut short.
+  parse({0x00, 0x02, 0xAA, 0xBB, 0x00}, ok);
+  CHECK(!ok);
+  // An entry running past the end.
+  CHECK(parse({0x00, 0x02, 0xAA, 0xBB, 0x00, 0x05, 0x01}, ok).size() == 1);
+  CHECK(!ok);
+  // A zero-length entry.
+  parse({0x00, 0x00, 0x00, 0x01, 0xAA}, ok);
+  CHECK(!ok);
+  // A length field claiming the whole 64 KiB.
+  parse({0xFF, 0xFF, 0x01, 0x02}, ok);
+  CHECK(!ok);
+}
+} // namespace
+
+int main() {
+  testRoundTrip();
+  testMalformed();
+  return testResult("packet_bundler");
+}
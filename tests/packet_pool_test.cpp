@@ -0,0 +1,106 @@
+#include "packet_pool.h"
+#include "test_util.h"
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace {
+// Buffers acquired on one thread and released on another, as TUN reads and
+// Steam's free callback do.
+void testAcrossThreads() {
+  constexpr size_t kCount = 200000;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<uint8_t *> handoff;
+  bool done = false;
+  size_t corrupt = 0;
+
+  std::thread consumer([&] {
+    size_t seen = 0;
+    for (;;) {
+      uint8_t *buffer = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return !handoff.empty() || done; });
+        if (handoff.empty()) {
+          break;
+        }
+        buffer = handoff.front();
+        handoff.pop_front();
+      }
+      size_t value = 0;
+      std::memcpy(&value, buffer, sizeof(value));
+      if (value != seen++) {
+        corrupt++;
+      }
+      PacketPool::instance().release(buffer);
+    }
+  });
+  std::thread producer([&] {
+    for (size_t i = 0; i < kCount; ++i) {
+      const size_t size = i % 16 == 0 ? PacketPool::kJumboBufferSize
+                                      : PacketPool::kBufferSize;
+      uint8_t *buffer = PacketPool::instance().acquire(size);
+      std::memset(buffer, 0xAB, size);
+      std::memcpy(buffer, &i, sizeof(i));
+      std::lock_guard<std::mutex> lock(mutex);
+      handoff.push_back(buffer);
+      ready.notify_one();
+    }
+  });
+  producer.join();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    ready.notify_one();
+  }
+  consumer.join();
+  CHECK(corrupt == 0);
+}
+
+// A thread's cached buffers go back to the shared lists when it exits.
+void testThreadExitReturnsCache() {
+  std::set<uint8_t *> released;
+  std::thread worker([&] {
+    std::vector<uint8_t *> buffers;
+    for (int i = 0; i < 8; ++i) {
+      buffers.push_back(PacketPool::instance().acquire());
+    }
+    for (uint8_t *buffer : buffers) {
+      released.insert(buffer);
+      PacketPool::instance().release(buffer);
+    }
+  });
+  worker.join();
+  std::thread reader([&] {
+    uint8_t *buffer = PacketPool::instance().acquire();
+    CHECK(released.count(buffer) == 1);
+    PacketPool::instance().release(buffer);
+  });
+  reader.join();
+}
+
+void testDistinctBuffers() {
+  std::set<uint8_t *> live;
+  std::vector<uint8_t *> buffers;
+  for (int i = 0; i < 300; ++i) {
+    uint8_t *buffer = PacketPool::instance().acquire();
+    CHECK(live.insert(buffer).second);
+    buffers.push_back(buffer);
+  }
+  for (uint8_t *buffer : buffers) {
+    PacketPool::instance().release(buffer);
+  }
+  PacketPool::instance().release(nullptr);
+}
+} // namespace
+
+int main() {
+  testThreadExitReturnsCache();
+  testAcrossThreads();
+  testDistinctBuffers();
+  return testResult("packet_pool");
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Minimal checks for the unit tests: a failed CHECK is reported and counted,
+// and the test exits non-zero if any failed.
+inline int &testFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,    \
+                   #condition);                                                \
+      ++testFailures();                                                        \
+    }                                                                          \
+  } while (0)
+
+inline int testResult(const char *name) {
+  if (testFailures() == 0) {
+    std::printf("[%s] passed\n", name);
+    return 0;
+  }
+  std::printf("[%s] %d check(s) failed\n", name, testFailures());
+  return 1;
+}
+
+// An IPv4 packet (no options) carrying a TCP header without options, or a
+// UDP header, followed by payloadLength pattern bytes. Checksums are left
+// zero; addresses are 10.0.0.1 -> 10.0.0.2.
+struct TestPacket {
+  uint8_t protocol = 17;
+  uint16_t sourcePort = 1000;
+  uint16_t destPort = 2000;
+  uint8_t tos = 0;
+  uint8_t tcpFlags = 0x10; // ACK
+  uint32_t seq = 0;
+  size_t payloadLength = 0;
+
+  std::vector<uint8_t> build() const {
+    const size_t l4 = protocol == 6 ? 20 : 8;
+    std::vector<uint8_t> p(20 + l4 + payloadLength, 0);
+    const size_t total = p.size();
+    p[0] = 0x45;
+    p[1] = tos;
+    p[2] = static_cast<uint8_t>(total >> 8);
+    p[3] = static_cast<uint8_t>(total);
+    p[4] = 0x12;
+    p[5] = 0x34;
+    p[6] = 0x40; // DF
+    p[8] = 64;
+    p[9] = protocol;
+    const uint8_t addresses[8] = {10, 0, 0, 1, 10, 0, 0, 2};
+    for (size_t i = 0; i < 8; ++i) {
+      p[12 + i] = addresses[i];
+    }
+    uint8_t *l = p.data() + 20;
+    l[0] = static_cast<uint8_t>(sourcePort >> 8);
+    l[1] = static_cast<uint8_t>(sourcePort);
+    l[2] = static_cast<uint8_t>(destPort >> 8);
+    l[3] = static_cast<uint8_t>(destPort);
+    if (protocol == 6) {
+      l[4] = static_cast<uint8_t>(seq >> 24);
+      l[5] = static_cast<uint8_t>(seq >> 16);
+      l[6] = static_cast<uint8_t>(seq >> 8);
+      l[7] = static_cast<uint8_t>(seq);
+      l[11] = 1; // ack
+      l[12] = 5 << 4;
+      l[13] = tcpFlags;
+      l[14] = 0xFF;
+      l[15] = 0xFF;
+    } else {
+      l[4] = static_cast<uint8_t>((8 + payloadLength) >> 8);
+      l[5] = static_cast<uint8_t>(8 + payloadLength);
+    }
+    for (size_t i = 0; i < payloadLength; ++i) {
+      p[20 + l4 + i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+    return p;
+  }
+};
@@ -0,0 +1,182 @@
+#include "test_util.h"
+#include "tun_offload.h"
+#include <cstring>
+
+namespace {
+uint16_t load16(const uint8_t *p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t load32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+uint32_t sumBytes(uint32_t sum, const uint8_t *data, size_t length) {
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    sum += load16(data + i);
+  }
+  if (length & 1) {
+    sum += static_cast<uint32_t>(data[length - 1]) << 8;
+  }
+  return sum;
+}
+
+uint16_t fold(uint32_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return static_cast<uint16_t>(sum);
+}
+
+bool ipChecksumValid(const uint8_t *ip) {
+  return fold(sumBytes(0, ip, 20)) == 0xFFFF;
+}
+
+bool tcpChecksumValid(const uint8_t *ip, size_t length) {
+  const size_t tcpLength = length - 20;
+  const uint32_t pseudo =
+      sumBytes(0, ip + 12, 8) + 6 + static_cast<uint32_t>(tcpLength);
+  return fold(sumBytes(pseudo, ip + 20, tcpLength)) == 0xFFFF;
+}
+
+std::vector<std::vector<uint8_t>> segment(tun::GsoSegmenter &segmenter,
+                                          const std::vector<uint8_t> &packet,
+                                          const tun::VnetHeader &hdr) {
+  std::vector<std::vector<uint8_t>> segments;
+  std::memcpy(segmenter.buffer(), packet.data(), packet.size());
+  segmenter.begin(hdr, packet.size());
+  while (segmenter.pending()) {
+    std::vector<uint8_t> out(2048);
+    const int length = segmenter.next(out.data(), out.size());
+    CHECK(length > 0);
+    if (length <= 0) {
+      break;
+    }
+    out.resize(static_cast<size_t>(length));
+    segments.push_back(out);
+  }
+  return segments;
+}
+
+void testTsoSplitAndGroMerge() {
+  TestPacket spec;
+  spec.protocol = 6;
+  spec.tcpFlags = 0x18; // ACK|PSH
+  spec.seq = 1000000;
+  spec.payloadLength = 3500;
+  const std::vector<uint8_t> superPacket = spec.build();
+
+  tun::VnetHeader hdr{};
+  hdr.flags = tun::kVnetFlagNeedsCsum;
+  hdr.gsoType = tun::kVnetGsoTcpV4;
+  hdr.hdrLen = 40;
+  hdr.gsoSize = 1400;
+  hdr.csumStart = 20;
+  hdr.csumOffset = 16;
+
+  tun::GsoSegmenter segmenter;
+  const auto segments = segment(segmenter, superPacket, hdr);
+  CHECK(segments.size() == 3);
+  size_t offset = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const std::vector<uint8_t> &s = segments[i];
+    const bool last = i + 1 == segments.size();
+    CHECK(s.size() == 40 + (last ? 700 : 1400));
+    CHECK(load16(s.data() + 2) == s.size());
+    CHECK(load16(s.data() + 4) == 0x1234 + i);
+    CHECK(load32(s.data() + 24) == 1000000 + offset);
+    CHECK(((s[33] & 0x08) != 0) == last); // PSH on the last only
+    CHECK(ipChecksumValid(s.data()));
+    CHECK(tcpChecksumValid(s.data(), s.size()));
+    CHECK(std::memcmp(s.data() + 40, superPacket.data() + 40 + offset,
+                      s.size() - 40) == 0);
+    offset += s.size() - 40;
+  }
+
+  tun::GroCoalescer coalescer;
+  for (const auto &s : segments) {
+    CHECK(coalescer.add(s.data(), s.size()));
+  }
+  tun::VnetHeader merged{};
+  const std::vector<uint8_t> packet = coalescer.finish(merged);
+  CHECK(merged.gsoType == tun::kVnetGsoTcpV4);
+  CHECK(merged.flags == tun::kVnetFlagNeedsCsum);
+  CHECK(merged.gsoSize == 1400);
+  CHECK(merged.hdrLen == 40);
+  CHECK(packet.size() == superPacket.size());
+  CHECK(load16(packet.data() + 2) == packet.size());
+  CHECK(ipChecksumValid(packet.data()));
+  CHECK(std::memcmp(packet.data() + 40, superPacket.data() + 40,
+                    superPacket.size() - 40) == 0);
+  coalescer.clear();
+  CHECK(coalescer.empty());
+
+  // Cutting the merged run again gives back the very same segments.
+  CHECK(segment(segmenter, packet, merged) == segments);
+}
+
+void testChecksumCompletion() {
+  TestPacket spec;
+  spec.protocol = 6;
+  spec.payloadLength = 101;
+  std::vector<uint8_t> packet = spec.build();
+  // As the kernel leaves it: the pseudo-header sum in the checksum field.
+  const uint32_t pseudo =
+      sumBytes(0, packet.data() + 12, 8) + 6 + (packet.size() - 20);
+  packet[36] = static_cast<uint8_t>(fold(pseudo) >> 8);
+  packet[37] = static_cast<uint8_t>(fold(pseudo));
+
+  tun::VnetHeader hdr{};
+  hdr.flags = tun::kVnetFlagNeedsCsum;
+  hdr.csumStart = 20;
+  hdr.csumOffset = 16;
+  tun::GsoSegmenter segmenter;
+  const auto segments = segment(segmenter, packet, hdr);
+  CHECK(segments.size() == 1);
+  if (!segments.empty()) {
+    CHECK(segments[0].size() == packet.size());
+    CHECK(tcpChecksumValid(segments[0].data(), segments[0].size()));
+  }
+
+  hdr.csumOffset = 200; // past the end
+  std::memcpy(segmenter.buffer(), packet.data(), packet.size());
+  segmenter.begin(hdr, packet.size());
+  uint8_t out[2048];
+  CHECK(segmenter.next(out, sizeof(out)) == -1);
+}
+
+void testGroRejects() {
+  TestPacket spec;
+  spec.protocol = 6;
+  spec.payloadLength = 1000;
+  spec.seq = 5000;
+  const std::vector<uint8_t> first = spec.build();
+  spec.seq = 7000; // a gap
+  const std::vector<uint8_t> gap = spec.build();
+  spec.seq = 6000;
+  spec.tcpFlags = 0x11; // FIN
+  const std::vector<uint8_t> fin = spec.build();
+  spec.tcpFlags = 0x10;
+  spec.sourcePort = 1001;
+  const std::vector<uint8_t> otherFlow = spec.build();
+
+  tun::GroCoalescer coalescer;
+  CHECK(coalescer.add(first.data(), first.size()));
+  CHECK(!coalescer.add(gap.data(), gap.size()));
+  CHECK(!coalescer.add(fin.data(), fin.size()));
+  CHECK(!coalescer.add(otherFlow.data(), otherFlow.size()));
+  tun::VnetHeader hdr{};
+  const std::vector<uint8_t> &single = coalescer.finish(hdr);
+  CHECK(hdr.gsoType == tun::kVnetGsoNone);
+  CHECK(single == first);
+}
+} // namespace
+
+int main() {
+  testTsoSplitAndGroMerge();
+  testChecksumCompletion();
+  testGroRejects();
+  return testResult("tun_offload");
+}
@@ -0,0 +1,94 @@
+#include "test_util.h"
+#include "vpn_wire.h"
+#include "xor_fec.h"
+
+namespace {
+std::vector<std::vector<uint8_t>> group() {
+  std::vector<std::vector<uint8_t>> messages;
+  const size_t lengths[4] = {60, 1200, 333, 7};
+  for (size_t m = 0; m < 4; ++m) {
+    std::vector<uint8_t> message(lengths[m]);
+    for (size_t i = 0; i < message.size(); ++i) {
+      message[i] = static_cast<uint8_t>(i * 31 + m * 17 + 1);
+    }
+    messages.push_back(message);
+  }
+  return messages;
+}
+
+// The FEC_PARITY payload for messages.
+std::vector<uint8_t> parity(const std::vector<std::vector<uint8_t>> &messages) {
+  XorFecEncoder encoder;
+  encoder.setGroupSize(messages.size());
+  const auto now = XorFecEncoder::Clock::now();
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const bool full =
+        encoder.add(messages[i].data(), messages[i].size(), now);
+    CHECK(full == (i + 1 == messages.size()));
+  }
+  std::vector<uint8_t> out;
+  encoder.finish(out, sizeof(VpnMessageHeader));
+  CHECK(!encoder.open());
+  return std::vector<uint8_t>(out.begin() + sizeof(VpnMessageHeader),
+                              out.end());
+}
+
+void testSingleLossRecovery() {
+  const auto messages = group();
+  const auto payload = parity(messages);
+  for (size_t lost = 0; lost < messages.size(); ++lost) {
+    XorFecDecoder decoder;
+    for (size_t i = 0; i < messages.size(); ++i) {
+      if (i != lost) {
+        CHECK(decoder.remember(messages[i].data(), messages[i].size()));
+      }
+    }
+    std::vector<uint8_t> out;
+    size_t missing = 0;
+    CHECK(decoder.recover(payload.data(), payload.size(), out, missing) ==
+          XorFecDecoder::Result::Recovered);
+    CHECK(missing == 1);
+    CHECK(out == messages[lost]);
+    // The original arriving late is a duplicate of the rebuilt copy, once.
+    CHECK(!decoder.remember(messages[lost].data(), messages[lost].size()));
+    CHECK(decoder.remember(messages[lost].data(), messages[lost].size()));
+  }
+}
+
+void testCompleteAndUnrecoverable() {
+  const auto messages = group();
+  const auto payload = parity(messages);
+  std::vector<uint8_t> out;
+  size_t missing = 0;
+
+  XorFecDecoder decoder;
+  for (const auto &message : messages) {
+    decoder.remember(message.data(), message.size());
+  }
+  CHECK(decoder.recover(payload.data(), payload.size(), out, missing) ==
+        XorFecDecoder::Result::Complete);
+  CHECK(missing == 0);
+
+  decoder.clear();
+  decoder.remember(messages[0].data(), messages[0].size());
+  decoder.remember(messages[1].data(), messages[1].size());
+  CHECK(decoder.recover(payload.data(), payload.size(), out, missing) ==
+        XorFecDecoder::Result::Unrecoverable);
+  CHECK(missing == 2);
+
+  // Truncated or empty parity.
+  CHECK(decoder.recover(payload.data(), 3, out, missing) ==
+        XorFecDecoder::Result::Unrecoverable);
+  CHECK(decoder.recover(payload.data(), sizeof(FecParityHeader) + 8, out,
+                        missing) == XorFecDecoder::Result::Unrecoverable);
+  std::vector<uint8_t> empty(sizeof(FecParityHeader), 0);
+  CHECK(decoder.recover(empty.data(), empty.size(), out, missing) ==
+        XorFecDecoder::Result::Unrecoverable);
+}
+} // namespace
+
+int main() {
+  testSingleLossRecovery();
+  testCompleteAndUnrecoverable();
+  return testResult("xor_fec");
+}
@@ -28,6 +28,29 @@ public:
   virtual bool set_non_blocking(bool nonBlocking) = 0;
   virtual std::string get_last_error() const = 0;
   virtual void *get_read_wait_event() const { return nullptr; }
+  // Pollable descriptor that turns readable when a packet is queued, or -1.
+  virtual int get_read_fd() const { return -1; }
+
+  // Multi-queue devices expose one descriptor per queue so each can be
+  // serviced by its own thread. Request the count before open(); queue 0 is
+  // the one read()/write() use.
+  virtual bool set_queue_count(int queues) { return queues <= 1; }
+  virtual int queue_count() const { return 1; }
+  virtual int read_queue(int queue, uint8_t *buffer, size_t size) {
+    return queue == 0 ? read(buffer, size) : -1;
+  }
+  virtual int write_queue(int queue, const uint8_t *buffer, size_t size) {
+    return queue == 0 ? write(buffer, size) : -1;
+  }
+  virtual int get_queue_read_fd(int queue) const {
+    return queue == 0 ? get_read_fd() : -1;
+  }
+
+  // Request TSO/GRO offloads before open(). Reads then return segments cut
+  // from kernel super-segments, and writes may be held for coalescing until
+  // flush().
+  virtual bool set_offload(bool enable) { return !enable; }
+  virtual void flush() {}
 };
 
 std::unique_ptr<TunInterface> create_tun();
@@ -1,6 +1,7 @@
 #ifdef __linux__
 
 #include "tun_interface.h"
+#include "tun_offload.h"
 #include <arpa/inet.h>
 #include <cctype>
 #include <cerrno>
@@ -8,13 +9,17 @@
 #include <fcntl.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
+#include <memory>
+#include <mutex>
 // Avoid including <net/if.h> with the kernel headers to prevent struct redefs
 // on some glibc versions.
 #include <stdexcept>
 #include <string>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 namespace tun {
 
@@ -59,7 +64,9 @@ int maskToPrefix(const std::string &mask) {
 
 class TunLinux : public TunInterface {
 public:
-  TunLinux() : fd_(-1), mtu_(1500) {}
+  TunLinux()
+      : fd_(-1), mtu_(1500), requestedQueues_(1), requestOffload_(false),
+        vnetHdr_(false) {}
   ~TunLinux() override { close(); }
 
   bool open(const std::string &deviceName, int mtu) override {
@@ -72,26 +79,29 @@ public:
       return false;
     }
 
-    fd_ = ::open("/dev/net/tun", O_RDWR);
+    const bool multiQueue = requestedQueues_ > 1;
+    fd_ = openQueue(deviceName, multiQueue);
     if (fd_ < 0) {
-      lastError_ = "Failed to open /dev/net/tun";
       return false;
     }
-
-    struct ifreq ifr {};
-    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
-    if (!deviceName.empty()) {
-      std::strncpy(ifr.ifr_name, deviceName.c_str(), IFNAMSIZ - 1);
+    addQueue(fd_);
+    vnetHdr_ = requestOffload_;
+    if (vnetHdr_ &&
+        ioctl(fd_, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO_ECN) <
+            0) {
+      // Still framed with vnet headers, just without super-segments.
+      lastError_ = "ioctl(TUNSETOFFLOAD) failed";
     }
-
-    if (ioctl(fd_, TUNSETIFF, &ifr) < 0) {
-      lastError_ = "ioctl(TUNSETIFF) failed";
-      ::close(fd_);
-      fd_ = -1;
-      return false;
+    // Further queues attach to the same interface by name. Keep whatever we
+    // managed to open if the kernel refuses more.
+    for (int i = 1; i < requestedQueues_; ++i) {
+      const int queueFd = openQueue(name_, true);
+      if (queueFd < 0) {
+        break;
+      }
+      addQueue(queueFd);
     }
 
-    name_ = ifr.ifr_name;
     mtu_ = mtu;
     if (mtu > 0) {
       set_mtu(mtu_);
@@ -100,28 +110,22 @@ public:
   }
 
   void close() override {
-    if (fd_ >= 0) {
-      ::close(fd_);
-      fd_ = -1;
+    for (auto &queue : queues_) {
+      ::close(queue->fd);
     }
+    queues_.clear();
+    fd_ = -1;
+    vnetHdr_ = false;
   }
 
   bool is_open() const override { return fd_ >= 0; }
 
   int read(uint8_t *buffer, size_t size) override {
-    if (fd_ < 0) {
-      return -1;
-    }
-    const ssize_t n = ::read(fd_, buffer, size);
-    return n >= 0 ? static_cast<int>(n) : -1;
+    return read_queue(0, buffer, size);
   }
 
   int write(const uint8_t *buffer, size_t size) override {
-    if (fd_ < 0) {
-      return -1;
-    }
-    const ssize_t n = ::write(fd_, buffer, size);
-    return n >= 0 ? static_cast<int>(n) : -1;
+    return write_queue(0, buffer, size);
   }
 
   std::string get_device_name() const override { return name_; }
@@ -264,26 +268,170 @@ public:
       lastError_ = "Interface not open";
       return false;
     }
-    const int flags = fcntl(fd_, F_GETFL, 0);
-    if (flags < 0) {
-      lastError_ = "Failed to get flags";
+    for (auto &queue : queues_) {
+      const int fd = queue->fd;
+      const int flags = fcntl(fd, F_GETFL, 0);
+      if (flags < 0) {
+        lastError_ = "Failed to get flags";
+        return false;
+      }
+      if (fcntl(fd, F_SETFL, nonBlocking ? flags | O_NONBLOCK
+                                         : (flags & ~O_NONBLOCK)) < 0) {
+        lastError_ = "Failed to set non-blocking";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::string get_last_error() const override { return lastError_; }
+  int get_read_fd() const override { return fd_; }
+
+  bool set_queue_count(int queues) override {
+    if (fd_ >= 0 || queues < 1) {
       return false;
     }
-    if (fcntl(fd_, F_SETFL, nonBlocking ? flags | O_NONBLOCK
-                                        : (flags & ~O_NONBLOCK)) < 0) {
-      lastError_ = "Failed to set non-blocking";
+    requestedQueues_ = queues;
+    return true;
+  }
+
+  int queue_count() const override {
+    return static_cast<int>(queues_.size());
+  }
+
+  int read_queue(int queue, uint8_t *buffer, size_t size) override {
+    if (queue < 0 || queue >= queue_count()) {
+      return -1;
+    }
+    Queue &q = *queues_[queue];
+    if (!vnetHdr_) {
+      const ssize_t n = ::read(q.fd, buffer, size);
+      return n >= 0 ? static_cast<int>(n) : -1;
+    }
+    // Hand out the rest of the last super-segment before reading again.
+    if (!q.segmenter.pending()) {
+      VnetHeader hdr{};
+      iovec iov[2] = {{&hdr, sizeof(hdr)},
+                      {q.segmenter.buffer(), q.segmenter.capacity()}};
+      const ssize_t n = ::readv(q.fd, iov, 2);
+      if (n <= static_cast<ssize_t>(sizeof(hdr))) {
+        return -1;
+      }
+      q.segmenter.begin(hdr, static_cast<size_t>(n) - sizeof(hdr));
+    }
+    return q.segmenter.next(buffer, size);
+  }
+
+  int write_queue(int queue, const uint8_t *buffer, size_t size) override {
+    if (queue < 0 || queue >= queue_count()) {
+      return -1;
+    }
+    Queue &q = *queues_[queue];
+    if (!vnetHdr_) {
+      const ssize_t n = ::write(q.fd, buffer, size);
+      return n >= 0 ? static_cast<int>(n) : -1;
+    }
+    std::lock_guard<std::mutex> lock(q.writeMutex);
+    if (q.coalescer.add(buffer, size)) {
+      return static_cast<int>(size);
+    }
+    flushLocked(q);
+    if (q.coalescer.add(buffer, size)) {
+      return static_cast<int>(size);
+    }
+    return writeWithHeader(q.fd, VnetHeader{}, buffer, size);
+  }
+
+  int get_queue_read_fd(int queue) const override {
+    return queue >= 0 && queue < queue_count() ? queues_[queue]->fd : -1;
+  }
+
+  bool set_offload(bool enable) override {
+    if (fd_ >= 0) {
       return false;
     }
+    requestOffload_ = enable;
     return true;
   }
 
-  std::string get_last_error() const override { return lastError_; }
+  void flush() override {
+    for (auto &queue : queues_) {
+      std::lock_guard<std::mutex> lock(queue->writeMutex);
+      flushLocked(*queue);
+    }
+  }
 
 private:
-  int fd_;
+  struct Queue {
+    int fd = -1;
+    GsoSegmenter segmenter; // read side, owned by the queue's reader
+    std::mutex writeMutex;
+    GroCoalescer coalescer;
+  };
+
+  void addQueue(int fd) {
+    auto queue = std::make_unique<Queue>();
+    queue->fd = fd;
+    queues_.push_back(std::move(queue));
+  }
+
+  void flushLocked(Queue &q) {
+    if (q.coalescer.empty()) {
+      return;
+    }
+    VnetHeader hdr{};
+    const std::vector<uint8_t> &packet = q.coalescer.finish(hdr);
+    writeWithHeader(q.fd, hdr, packet.data(), packet.size());
+    q.coalescer.clear();
+  }
+
+  static int writeWithHeader(int fd, const VnetHeader &hdr,
+                             const uint8_t *buffer, size_t size) {
+    iovec iov[2] = {{const_cast<VnetHeader *>(&hdr), sizeof(hdr)},
+                    {const_cast<uint8_t *>(buffer), size}};
+    const ssize_t n = ::writev(fd, iov, 2);
+    return n >= static_cast<ssize_t>(sizeof(hdr))
+               ? static_cast<int>(n - sizeof(hdr))
+               : -1;
+  }
+
+  // Open one descriptor and attach it to the named (or a new) interface.
+  int openQueue(const std::string &deviceName, bool multiQueue) {
+    const int fd = ::open("/dev/net/tun", O_RDWR);
+    if (fd < 0) {
+      lastError_ = "Failed to open /dev/net/tun";
+      return -1;
+    }
+
+    struct ifreq ifr {};
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    if (multiQueue) {
+      ifr.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+    if (requestOffload_) {
+      ifr.ifr_flags |= IFF_VNET_HDR;
+    }
+    if (!deviceName.empty()) {
+      std::strncpy(ifr.ifr_name, deviceName.c_str(), IFNAMSIZ - 1);
+    }
+
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+      lastError_ = "ioctl(TUNSETIFF) failed";
+      ::close(fd);
+      return -1;
+    }
+    name_ = ifr.ifr_name;
+    return fd;
+  }
+
+  int fd_; // queue 0
+  std::vector<std::unique_ptr<Queue>> queues_;
   std::string name_;
   std::string lastError_;
   int mtu_;
+  int requestedQueues_;
+  bool requestOffload_;
+  bool vnetHdr_;
 };
 
 std::unique_ptr<TunInterface> create_tun() {
@@ -0,0 +1,231 @@
+#ifdef __linux__
+
+#include "tun_offload.h"
+#include <algorithm>
+#include <cstring>
+
+namespace tun {
+
+namespace {
+constexpr size_t kMaxPacket = 65535;
+constexpr uint8_t kProtoTcp = 6;
+constexpr uint8_t kTcpFin = 0x01;
+constexpr uint8_t kTcpPsh = 0x08;
+constexpr uint8_t kTcpAck = 0x10;
+constexpr uint8_t kTcpCwr = 0x80;
+
+uint16_t load16(const uint8_t *p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+uint32_t load32(const uint8_t *p) {
+  return (static_cast<uint32_t>(p[0]) << 24) |
+         (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+void store16(uint8_t *p, uint16_t v) {
+  p[0] = static_cast<uint8_t>(v >> 8);
+  p[1] = static_cast<uint8_t>(v);
+}
+
+void store32(uint8_t *p, uint32_t v) {
+  p[0] = static_cast<uint8_t>(v >> 24);
+  p[1] = static_cast<uint8_t>(v >> 16);
+  p[2] = static_cast<uint8_t>(v >> 8);
+  p[3] = static_cast<uint8_t>(v);
+}
+
+uint32_t sumBytes(uint32_t sum, const uint8_t *data, size_t length) {
+  for (size_t i = 0; i + 1 < length; i += 2) {
+    sum += load16(data + i);
+  }
+  if (length & 1) {
+    sum += static_cast<uint32_t>(data[length - 1]) << 8;
+  }
+  return sum;
+}
+
+uint16_t fold(uint32_t sum) {
+  while (sum >> 16) {
+    sum = (sum & 0xFFFF) + (sum >> 16);
+  }
+  return static_cast<uint16_t>(sum);
+}
+
+uint32_t tcpPseudoHeaderSum(const uint8_t *ip, size_t tcpLength) {
+  return sumBytes(0, ip + 12, 8) + kProtoTcp +
+         static_cast<uint32_t>(tcpLength);
+}
+
+void fixIpChecksum(uint8_t *ip, size_t headerLength) {
+  store16(ip + 10, 0);
+  store16(ip + 10, static_cast<uint16_t>(~fold(sumBytes(0, ip, headerLength))));
+}
+} // namespace
+
+GsoSegmenter::GsoSegmenter() : buffer_(kMaxPacket + 1) {}
+
+void GsoSegmenter::begin(const VnetHeader &hdr, size_t length) {
+  hdr_ = hdr;
+  length_ = length;
+  offset_ = 0;
+  index_ = 0;
+  pending_ = true;
+}
+
+int GsoSegmenter::next(uint8_t *out, size_t size) {
+  pending_ = false;
+  uint8_t *ip = buffer_.data();
+
+  if (hdr_.gsoType == kVnetGsoNone) {
+    if (length_ > size) {
+      return -1;
+    }
+    if (hdr_.flags & kVnetFlagNeedsCsum) {
+      // The checksum field already holds the pseudo-header sum.
+      const size_t start = hdr_.csumStart;
+      const size_t field = start + hdr_.csumOffset;
+      if (field + 2 > length_) {
+        return -1;
+      }
+      store16(ip + field, static_cast<uint16_t>(~fold(
+                              sumBytes(0, ip + start, length_ - start))));
+    }
+    std::memcpy(out, ip, length_);
+    return static_cast<int>(length_);
+  }
+
+  if ((hdr_.gsoType & ~kVnetGsoEcn) != kVnetGsoTcpV4 ||
+      hdr_.gsoSize == 0 || length_ < 20) {
+    return -1;
+  }
+  const size_t ipHeaderLength = static_cast<size_t>(ip[0] & 0x0F) * 4;
+  if (length_ < ipHeaderLength + 20) {
+    return -1;
+  }
+  const size_t tcpHeaderLength =
+      static_cast<size_t>(ip[ipHeaderLength + 12] >> 4) * 4;
+  const size_t headerLength = ipHeaderLength + tcpHeaderLength;
+  if (tcpHeaderLength < 20 || headerLength > length_) {
+    return -1;
+  }
+
+  const size_t payloadTotal = length_ - headerLength;
+  const size_t chunk =
+      std::min<size_t>(hdr_.gsoSize, payloadTotal - offset_);
+  const size_t segmentLength = headerLength + chunk;
+  if (segmentLength > size) {
+    return -1;
+  }
+  std::memcpy(out, ip, headerLength);
+  std::memcpy(out + headerLength, ip + headerLength + offset_, chunk);
+
+  store16(out + 2, static_cast<uint16_t>(segmentLength));
+  store16(out + 4, static_cast<uint16_t>(load16(ip + 4) + index_));
+  fixIpChecksum(out, ipHeaderLength);
+
+  uint8_t *tcp = out + ipHeaderLength;
+  store32(tcp + 4, load32(ip + ipHeaderLength + 4) +
+                       static_cast<uint32_t>(offset_));
+  const bool last = offset_ + chunk >= payloadTotal;
+  if (!last) {
+    tcp[13] &= static_cast<uint8_t>(~(kTcpFin | kTcpPsh));
+  }
+  if (index_ > 0) {
+    tcp[13] &= static_cast<uint8_t>(~kTcpCwr);
+  }
+  const size_t tcpLength = tcpHeaderLength + chunk;
+  store16(tcp + 16, 0);
+  store16(tcp + 16,
+          static_cast<uint16_t>(~fold(sumBytes(
+              tcpPseudoHeaderSum(out, tcpLength), tcp, tcpLength))));
+
+  offset_ += chunk;
+  ++index_;
+  pending_ = !last;
+  return static_cast<int>(segmentLength);
+}
+
+bool GroCoalescer::add(const uint8_t *packet, size_t length) {
+  // Plain IPv4 (no options), unfragmented TCP carrying data with only
+  // ACK/PSH set.
+  if (length < 40 || packet[0] != 0x45 || packet[9] != kProtoTcp ||
+      ((packet[6] & 0x3F) | packet[7]) != 0 || load16(packet + 2) != length) {
+    return false;
+  }
+  const uint8_t *tcp = packet + 20;
+  const size_t tcpHeaderLength = static_cast<size_t>(tcp[12] >> 4) * 4;
+  if (tcpHeaderLength < 20 || 20 + tcpHeaderLength >= length) {
+    return false;
+  }
+  const uint8_t flags = tcp[13];
+  if ((flags & ~kTcpPsh) != kTcpAck) {
+    return false;
+  }
+  const size_t payload = length - 20 - tcpHeaderLength;
+  const uint32_t seq = load32(tcp + 4);
+
+  if (packet_.empty()) {
+    packet_.assign(packet, packet + length);
+    headerLength_ = 20 + tcpHeaderLength;
+    segmentSize_ = payload;
+    segments_ = 1;
+    nextSeq_ = seq + static_cast<uint32_t>(payload);
+    closed_ = (flags & kTcpPsh) != 0;
+    return true;
+  }
+
+  const uint8_t *head = packet_.data();
+  if (closed_ || 20 + tcpHeaderLength != headerLength_ || seq != nextSeq_ ||
+      payload > segmentSize_ || packet_.size() + payload > kMaxPacket) {
+    return false;
+  }
+  // Same TOS/TTL, addresses, ports, ack, window and TCP options.
+  if (head[1] != packet[1] || head[8] != packet[8] ||
+      std::memcmp(head + 12, packet + 12, 8) != 0 ||
+      std::memcmp(head + 20, tcp, 4) != 0 ||
+      std::memcmp(head + 28, tcp + 8, 4) != 0 ||
+      std::memcmp(head + 34, tcp + 14, 2) != 0 ||
+      std::memcmp(head + 40, tcp + 20, tcpHeaderLength - 20) != 0) {
+    return false;
+  }
+
+  packet_.insert(packet_.end(), packet + 20 + tcpHeaderLength,
+                 packet + length);
+  ++segments_;
+  nextSeq_ += static_cast<uint32_t>(payload);
+  if (payload < segmentSize_ || (flags & kTcpPsh)) {
+    closed_ = true;
+    packet_[33] |= flags & kTcpPsh;
+  }
+  return true;
+}
+
+const std::vector<uint8_t> &GroCoalescer::finish(VnetHeader &hdr) {
+  hdr = VnetHeader{};
+  if (segments_ > 1) {
+    uint8_t *ip = packet_.data();
+    store16(ip + 2, static_cast<uint16_t>(packet_.size()));
+    fixIpChecksum(ip, 20);
+    // Partial checksum: the kernel completes it per segment.
+    store16(ip + 36, fold(tcpPseudoHeaderSum(ip, packet_.size() - 20)));
+    hdr.flags = kVnetFlagNeedsCsum;
+    hdr.gsoType = kVnetGsoTcpV4;
+    hdr.hdrLen = static_cast<uint16_t>(headerLength_);
+    hdr.gsoSize = static_cast<uint16_t>(segmentSize_);
+    hdr.csumStart = 20;
+    hdr.csumOffset = 16;
+  }
+  return packet_;
+}
+
+void GroCoalescer::clear() {
+  packet_.clear();
+  segments_ = 0;
+  closed_ = false;
+}
+
+} // namespace tun
+
+#endif // __linux__
@@ -0,0 +1,80 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tun {
+
+// struct virtio_net_hdr as the TUN driver exchanges it (native byte order).
+// Spelled out here because <linux/virtio_net.h> does not compile as C++.
+struct VnetHeader {
+  uint8_t flags;
+  uint8_t gsoType;
+  uint16_t hdrLen;
+  uint16_t gsoSize;
+  uint16_t csumStart;
+  uint16_t csumOffset;
+};
+static_assert(sizeof(VnetHeader) == 10, "virtio_net_hdr is 10 bytes");
+
+constexpr uint8_t kVnetFlagNeedsCsum = 1;
+constexpr uint8_t kVnetGsoNone = 0;
+constexpr uint8_t kVnetGsoTcpV4 = 1;
+constexpr uint8_t kVnetGsoEcn = 0x80;
+
+// Software halves of the virtio-net offloads used with IFF_VNET_HDR: the
+// kernel hands us TCPv4 super-segments (TSO) that we cut to MTU size, and we
+// hand it back coalesced TCP runs (GRO) that it segments on delivery.
+
+// Splits one packet read from the device into wire-sized packets.
+class GsoSegmenter {
+public:
+  GsoSegmenter();
+
+  uint8_t *buffer() { return buffer_.data(); }
+  size_t capacity() const { return buffer_.size(); }
+
+  // Start emitting the packet now held in buffer().
+  void begin(const VnetHeader &hdr, size_t length);
+  bool pending() const { return pending_; }
+  // Copy the next segment to out; returns its length or -1 if it is
+  // malformed or does not fit.
+  int next(uint8_t *out, size_t size);
+
+private:
+  std::vector<uint8_t> buffer_;
+  VnetHeader hdr_{};
+  size_t length_ = 0;
+  size_t offset_ = 0; // payload bytes already emitted
+  uint16_t index_ = 0;
+  bool pending_ = false;
+};
+
+// Merges consecutive in-order TCPv4 segments of one flow into a single
+// super-packet for one write.
+class GroCoalescer {
+public:
+  bool empty() const { return packet_.empty(); }
+  // Append to the pending run, or start one if the run is empty. Returns
+  // false if the packet cannot be coalesced with it.
+  bool add(const uint8_t *packet, size_t length);
+  // Finish the run: fills hdr and returns the packet to write. Call clear()
+  // once it has been written.
+  const std::vector<uint8_t> &finish(VnetHeader &hdr);
+  void clear();
+
+private:
+  std::vector<uint8_t> packet_;
+  size_t headerLength_ = 0;
+  size_t segmentSize_ = 0;
+  size_t segments_ = 0;
+  uint32_t nextSeq_ = 0;
+  bool closed_ = false; // a short or PSH segment ends the run
+};
+
+} // namespace tun
+
+#endif // __linux__